@@ -2,6 +2,30 @@
 #include "../infrastructure/enqueue-dequeue.h"
 #include "../infrastructure/jLock.h"
 #include "../dataStructures/PTEpermissions.h"
+#include "../dataStructures/pageDirectory.h"
+#include "pageMagazine.h"
+#include "pageReserve.h"
+
+
+//
+// Lists holding available pages - zero, free and every standby list
+//
+
+#define NUM_AVAILABLE_LISTS (STANDBY + 2 * NUM_STANDBY_PRIORITIES)
+
+static PlistData
+getAvailableListHead(int index)
+{
+
+    if (index < STANDBY) {
+
+        return &listHeads[index];
+
+    }
+
+    return &listHeads[STANDBY_LISTS_BASE + index - STANDBY];
+
+}
 
 PPFNdata
 getZeroPage(BOOLEAN returnLocked)
@@ -24,7 +48,7 @@ getZeroPage(BOOLEAN returnLocked)
             
         }
 
-        returnPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(returnPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         return returnPFN;        
 
@@ -57,7 +81,7 @@ getFreePage(BOOLEAN returnLocked)
         // Set PF offset to our "null" value in the PFN metadata
         //
 
-        returnPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(returnPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         return returnPFN;
 
@@ -78,116 +102,153 @@ getStandbyPage(BOOLEAN returnLocked)
     PTE oldPTE;
     PTE newPTE;
     ULONG_PTR pageNum;
+    PlistData standbyList;
 
 
-    if (standbyListHead.count != 0) {
-
-        //
-        // dequeue a page from standby page (with lock bits set, 
-        // since PTE lock acquisition could cause deadlock).
-        // Since PTE lock is not acquired, other functions MUST
-        // verify page has not changed state post acquisition of a 
-        // transition PFn from trans state PTE.
-        //
+    //
+    // dequeue a page from standby page (with lock bits set, 
+    // since PTE lock acquisition could cause deadlock).
+    // Since PTE lock is not acquired, other functions MUST
+    // verify page has not changed state post acquisition of a 
+    // transition PFn from trans state PTE.
+    //
+    // The lowest standby priority is repurposed first, and within a priority
+    // probationary pages - protected pages (re-referenced while cached) only
+    // once the probationary list is empty, so a single sequential sweep
+    // cannot flush them
+    //
 
-        returnPFN = dequeueLockedPageFromTail(&standbyListHead, TRUE);
+    returnPFN = NULL;
 
-        if (returnPFN == NULL) {
+    for (ULONG i = 0; i < 2 * NUM_STANDBY_PRIORITIES && returnPFN == NULL; i++) {
 
-            PRINT("[getPage] standby list empty\n");
-            return NULL;
+        standbyList = &standbyListHeadAt(i >> 1, i & 1);
 
-        } 
+        if (standbyList->count != 0) {
 
-        //
-        // Derive currPTE pointer (page lock, NOT PTE lock, is held)
-        //
+            returnPFN = dequeueLockedPageFromTail(standbyList, TRUE);
 
-        currPTE = PTEarray + returnPFN->PTEindex;
+        }
 
-        //
-        // Create local copy of the currPTE to reference
-        //
+    }
 
-        oldPTE = *currPTE; 
+    if (returnPFN == NULL) {
 
-        pageNum = returnPFN - PFNarray;
+        PRINT("[getPage] standby lists empty\n");
+        return NULL;
 
-        ASSERT(oldPTE.u1.tPTE.transitionBit == 1 && oldPTE.u1.tPTE.PFN == pageNum);
+    } 
 
-        //
-        //  Create newPTE initialized to zero (blank slate)
-        //
+    //
+    // The page is repurposed, so its promotion (and read-ahead mark) does not carry over
+    //
 
-        newPTE.u1.ulongPTE = 0;
+    returnPFN->protectedBit = 0;
 
-        //
-        // If standby page is not already in pagefile, it MUST be a zero page 
-        // (i.e. faulted into active but never written, then trimmed to standby)
-        // Therefore, the PTE can be set to demand zero 
-        //
+    returnPFN->readAheadBit = 0;
 
-        if (returnPFN->pageFileOffset == INVALID_BITARRAY_INDEX) {
+    //
+    // A trimmed page table page is referenced by its PDE rather than a PTE
+    //
 
-            // copy permissions to dz format PTE
-            newPTE.u1.dzPTE.permissions = oldPTE.u1.tPTE.permissions;
+    if (returnPFN->pageTableBit == 1) {
 
-            // put an invalid index into dz format PTE
-            newPTE.u1.dzPTE.pageFileIndex = INVALID_BITARRAY_INDEX;
+        repurposePageTable(returnPFN);
 
-            returnPFN->statusBits = FREE;
+        if (returnLocked == FALSE) {
 
-            // copy newPTE back into currPTE
-            writePTE(currPTE, newPTE);
-        
-            return returnPFN;
+            releaseJLock(&returnPFN->lockBits);
 
         }
 
-        //
-        // Copy old permissions to new pf format PTE
-        //
-        
-        newPTE.u1.pfPTE.permissions = oldPTE.u1.tPTE.permissions;
+        return returnPFN;
 
-        //
-        // Put PF index into pf format PTE
-        //
+    }
 
-        newPTE.u1.pfPTE.pageFileIndex = returnPFN->pageFileOffset;
+    //
+    // Derive currPTE pointer (page lock, NOT PTE lock, is held)
+    //
 
-        returnPFN->statusBits = FREE;
+    currPTE = PTEarray + returnPFN->PTEindex;
 
-        //
-        // set PF offset to our "null" value in the PFN metadata
-        //
+    //
+    // Create local copy of the currPTE to reference
+    //
 
-        returnPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+    oldPTE = *currPTE; 
 
-        //
-        // Write newPTE back into currPTE
-        //
+    pageNum = returnPFN - PFNarray;
 
-        writePTE(currPTE, newPTE);
-       
-        //
-        // release PFN lock once PTE is written out (if returnLocked is FALSE)
-        //
+    ASSERT(oldPTE.u1.tPTE.transitionBit == 1 && oldPTE.u1.tPTE.PFN == pageNum);
 
-        if (returnLocked == FALSE) {
-    
-            releaseJLock(&returnPFN->lockBits);
+    //
+    //  Create newPTE initialized to zero (blank slate)
+    //
 
-        }
+    newPTE.u1.ulongPTE = 0;
+
+    //
+    // If standby page is not already in pagefile, it MUST be a zero page 
+    // (i.e. faulted into active but never written, then trimmed to standby)
+    // Therefore, the PTE can be set to demand zero 
+    //
+
+    if (getPFNextension(returnPFN)->pageFileOffset == INVALID_BITARRAY_INDEX) {
+
+        // copy permissions to dz format PTE
+        newPTE.u1.dzPTE.permissions = oldPTE.u1.tPTE.permissions;
+
+        // put an invalid index into dz format PTE
+        newPTE.u1.dzPTE.pageFileIndex = INVALID_BITARRAY_INDEX;
+
+        returnPFN->statusBits = FREE;
+
+        // copy newPTE back into currPTE
+        writePTE(currPTE, newPTE);
     
         return returnPFN;
 
-    } else {
+    }
 
-        return NULL;
+    //
+    // Copy old permissions to new pf format PTE
+    //
+    
+    newPTE.u1.pfPTE.permissions = oldPTE.u1.tPTE.permissions;
+
+    //
+    // Put PF index into pf format PTE
+    //
+
+    newPTE.u1.pfPTE.pageFileIndex = getPFNextension(returnPFN)->pageFileOffset;
+
+    returnPFN->statusBits = FREE;
+
+    //
+    // set PF offset to our "null" value in the PFN metadata
+    //
+
+    getPFNextension(returnPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+    //
+    // Write newPTE back into currPTE
+    //
+
+    writePTE(currPTE, newPTE);
+   
+    //
+    // release PFN lock once PTE is written out (if returnLocked is FALSE)
+    //
+
+    if (returnLocked == FALSE) {
+
+        releaseJLock(&returnPFN->lockBits);
 
     }
-} 
+
+    return returnPFN;
+
+}
 
 
 PPFNdata
@@ -196,6 +257,20 @@ getPage(BOOLEAN returnLocked)
 
     PPFNdata returnPFN;
 
+    #ifdef PAGE_MAGAZINES
+
+    // this thread's zero/free magazines (refilled in batches from the lists)
+    returnPFN = getMagazinePage(returnLocked);
+    if (returnPFN != NULL) {
+
+        PRINT("[getPage] Allocated PFN from page magazine\n");
+
+        return returnPFN;
+
+    }
+
+    #endif
+
     // Zero list
     returnPFN = getZeroPage(returnLocked);
     if (returnPFN != NULL) {
@@ -245,6 +320,40 @@ getPage(BOOLEAN returnLocked)
 }
 
 
+PPFNdata
+getFaultPage(BOOLEAN returnLocked)
+{
+
+    PPFNdata returnPFN;
+
+    returnPFN = getPage(returnLocked);
+
+    #ifdef FAULT_PAGE_RESERVE
+
+    //
+    // Lists are exhausted - draw on the reserve rather than stalling the
+    // fault until the trimmer and modified writer catch up
+    //
+
+    if (returnPFN == NULL) {
+
+        returnPFN = getReservePage(returnLocked);
+
+        if (returnPFN != NULL) {
+
+            PRINT("[getFaultPage] Allocated PFN from fault page reserve\n");
+
+        }
+
+    }
+
+    #endif
+
+    return returnPFN;
+
+}
+
+
 PPFNdata
 getPageAlways(BOOLEAN returnLocked) 
 {
@@ -257,9 +366,25 @@ getPageAlways(BOOLEAN returnLocked)
 
         if (freedPFN == NULL) {
 
-            HANDLE pageEventHandles[] = {zeroListHead.newPagesEvent, freeListHead.newPagesEvent, standbyListHead.newPagesEvent};
+            #ifdef PAGE_MAGAZINES
+
+            //
+            // Reclaimed pages set the new page events, so the wait returns at once
+            //
+
+            reclaimPageMagazines();
+
+            #endif
 
-            WaitForMultipleObjects(STANDBY + 1, pageEventHandles, FALSE, INFINITE);
+            HANDLE pageEventHandles[NUM_AVAILABLE_LISTS];
+
+            for (int i = 0; i < NUM_AVAILABLE_LISTS; i++) {
+
+                pageEventHandles[i] = getAvailableListHead(i)->newPagesEvent;
+
+            }
+
+            WaitForMultipleObjects(NUM_AVAILABLE_LISTS, pageEventHandles, FALSE, INFINITE);
 
             continue;
 
@@ -274,4 +399,85 @@ getPageAlways(BOOLEAN returnLocked)
         }
     }
     return freedPFN;
-}
\ No newline at end of file
+}
+
+
+VOID
+waitForAvailablePages()
+{
+
+    ULONG_PTR availablePages;
+    availablePages = 0;
+
+    #ifdef PAGE_MAGAZINES
+
+    //
+    // Pages cached by other threads count as available - put them back on
+    // the lists rather than waiting on them
+    //
+
+    reclaimPageMagazines();
+
+    #endif
+
+    //
+    // Pages already available - return without touching any list locks
+    //
+
+    if (availablePageCount != 0) {
+
+        return;
+
+    }
+
+    //
+    // Acquire all list locks to verify no pages are available
+    //
+
+    for (int i = 0; i < NUM_AVAILABLE_LISTS; i++) {
+
+        EnterCriticalSection(&getAvailableListHead(i)->lock);
+        availablePages += getAvailableListHead(i)->count;
+        
+    }
+
+    if (availablePages == 0) {
+
+        //
+        // If all counts are zero, reset events and leave
+        // critical sections
+        //
+
+        BOOL bRes;
+        HANDLE pageEventHandles[NUM_AVAILABLE_LISTS];
+
+
+        for (int i = 0; i < NUM_AVAILABLE_LISTS; i++) {
+
+            bRes = ResetEvent(getAvailableListHead(i)->newPagesEvent);
+
+            if (bRes != TRUE) {
+                PRINT_ERROR("[dequeueLockedEvent] unable to reset event\n");
+            }
+
+            pageEventHandles[i] = getAvailableListHead(i)->newPagesEvent;
+
+            LeaveCriticalSection(&getAvailableListHead(i)->lock);
+
+        }
+
+        WaitForMultipleObjects(NUM_AVAILABLE_LISTS, pageEventHandles, FALSE, INFINITE);
+
+
+    } else {
+
+        for (int i = NUM_AVAILABLE_LISTS - 1; i >= 0; i--) {
+
+
+            LeaveCriticalSection(&getAvailableListHead(i)->lock);
+
+        }
+
+    }
+
+}
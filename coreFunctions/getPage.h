@@ -55,6 +55,19 @@ PPFNdata
 getPage(BOOLEAN returnLocked);
 
 
+/*
+ * getFaultPage: function to get a page for a page fault
+ *  - wrapper function for getPage, falling back to the fault page reserve
+ *    once all lists are empty (only page fault paths may call this)
+ * 
+ * Returns PPFNdata
+ *  - returnPFN (pfn metadata for the returned page) on success
+ *  - NULL on failure (all lists and the reserve empty)
+ */
+PPFNdata
+getFaultPage(BOOLEAN returnLocked);
+
+
 /*
  * getPageAlways: function to get available page, waits if lists are initially empty
  * - wrapper function for getPage
@@ -67,4 +80,15 @@ PPFNdata
 getPageAlways(BOOLEAN returnLocked);
 
 
+/*
+ * waitForAvailablePages: function to wait for new pages if none are available
+ *  - returns immediately if any of the zero/free/standby lists are non-empty
+ *  - should never be called while holding a lock (since wait can cause deadlock)
+ * 
+ * No return value
+ */
+VOID
+waitForAvailablePages();
+
+
 #endif
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "../usermodeMemoryManager.h"
 #include "../infrastructure/enqueue-dequeue.h" 
 #include "../infrastructure/jLock.h"
+#include "../infrastructure/physicalPages.h"
 #include "../dataStructures/PTEpermissions.h"
 #include "../dataStructures/VADNodes.h"
+#include "../dataStructures/pageDirectory.h"
 #include "pageFile.h"
 #include "getPage.h"
 
@@ -17,6 +19,12 @@ validPageFault(PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
 
     PTEpermissions tempRWEpermissions;
 
+    #ifdef TRANSPARENT_FAULTS
+        PTEpermissions mappedRWEpermissions;
+
+        mappedRWEpermissions = getMappedPermissions(snapPTE);
+    #endif
+
     //
     // Check requested permissions against PTE permissions
     //
@@ -45,34 +53,57 @@ validPageFault(PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
     if (permissionMasks[RWEpermissions] & writeMask) {
 
         PPFNdata PFN;
+        PFNstate oldState;
+        PFNstate newState;
+        ULONG currSpins;
 
         snapPTE.u1.hPTE.dirtyBit = 1;
 
         PFN = PFNarray + snapPTE.u1.hPTE.PFN;
 
-        acquireJLock(&PFN->lockBits);
+        currSpins = 0;
 
         //
-        // If the write in progress bit is clear, immediately free pf location 
-        // and pf PFN pointer
+        // Resolved with a CAS on the PFN state word rather than the PFN lock - the
+        // page is active and its PTE lock is held, so a pagefile write cannot start,
+        // only complete (which the modified writer does holding the PFN lock)
         //
 
-        if (PFN->writeInProgressBit == 0) {
+        while (TRUE) {
 
-            //
-            // Free pagefile space
-            //
+            oldState = readPFNstate(PFN);
 
-            clearPFBitIndex(PFN->pageFileOffset);
+            if (oldState.lockBit == 1) {
+
+                backoffSpin(&currSpins);
+
+                continue;
+
+            }
 
             //
-            // Clear pagefile pointer out of PFN
+            // If the write in progress bit is clear, immediately free pf location 
+            // and pf PFN pointer (no other thread may touch the pagefile offset of 
+            // an active page without a write in progress)
             //
 
-            PFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+            if (oldState.writeInProgressBit == 0) {
 
-        }         
-        else {
+                //
+                // Free pagefile space
+                //
+
+                clearPFBitIndex(getPFNextension(PFN)->pageFileOffset);
+
+                //
+                // Clear pagefile pointer out of PFN
+                //
+
+                getPFNextension(PFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+                break;
+
+            }
 
             //
             // If PFN write in progress bit is set on write fault,
@@ -81,22 +112,57 @@ validPageFault(PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
             // write completion (since contents are now stale)
             //
 
-            PFN->remodifiedBit = 1; 
+            newState = oldState;
+
+            newState.remodifiedBit = 1;
+
+            if (compareExchangePFNstate(PFN, oldState, newState) == TRUE) {
+
+                break;
+
+            }
 
         }
 
+        writePTE(masterPTE, snapPTE);
+
+    }
+    else if (masterPTE->u1.hPTE.agingBit == 1) {
+
         //
-        // Otherwise, if the write in progress bit is set, the modified writer is 
-        // still writing to the pagefile, and so the bit index and pagefileOffset field
-        // are cleared by the modified page writer once it finishes writing
+        // Persist the cleared aging bit so the trimmer sees the access
         //
 
-        releaseJLock(&PFN->lockBits);
-
         writePTE(masterPTE, snapPTE);
 
     }
 
+    #ifdef TRANSPARENT_FAULTS
+
+        //
+        // The page may be mapped with reduced access (clean or aged), which is what
+        // raised this fault - persist the cleared aging bit and widen the mapping
+        //
+
+        if (getMappedPermissions(snapPTE) != mappedRWEpermissions) {
+
+            PVOID virtualAddress;
+            DWORD oldPermissions;
+
+            virtualAddress = (PVOID) ( (ULONG_PTR) leafVABlock + ( (masterPTE - PTEarray) << PAGE_SHIFT ) );
+
+            writePTE(masterPTE, snapPTE);
+
+            if (VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[getMappedPermissions(snapPTE)], &oldPermissions) != TRUE) {
+
+                PRINT_ERROR("[validPageFault] Kernel state issue: Error virtual protecting VA\n");
+
+            }
+
+        }
+
+    #endif
+
     PRINT("PFN is already valid\n");
 
     return SUCCESS;
@@ -179,7 +245,7 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
 
         currPTEIndex = transitionPFN->PTEindex;
 
-        currEventNode = transitionPFN->readInProgEventNode;
+        currEventNode = getPFNextension(transitionPFN)->readInProgEventNode;
 
         currEvent = currEventNode->event;
 
@@ -216,7 +282,7 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
         // page changes in the trim/decommit/other pagefault functions)
         //
 
-        ASSERT(currEventNode == transitionPFN->readInProgEventNode);
+        ASSERT(currEventNode == getPFNextension(transitionPFN)->readInProgEventNode);
 
         ASSERT(currPTEIndex == transitionPFN->PTEindex);
 
@@ -230,7 +296,7 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
 
         if (transitionPFN->refCount == 0) {  
 
-            transitionPFN->readInProgEventNode = NULL;
+            getPFNextension(transitionPFN)->readInProgEventNode = NULL;
 
             enqueueEvent(&readInProgEventListHead, currEventNode);
 
@@ -297,13 +363,13 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
             // accuracy)
             //
 
-            clearPFBitIndex(transitionPFN->pageFileOffset);
+            clearPFBitIndex(getPFNextension(transitionPFN)->pageFileOffset);
 
             //
             // Clear pagefile pointer out of PFN
             //
 
-            transitionPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+            getPFNextension(transitionPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         } 
         else {
@@ -333,6 +399,24 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
 
     }
 
+    //
+    // Re-referenced while cached - promote the page, so it goes to the protected
+    // standby list when next trimmed. A page read ahead is referenced here for the
+    // first time, so it only counts as a read-ahead hit
+    //
+
+    if (transitionPFN->readAheadBit == 1) {
+
+        transitionPFN->readAheadBit = 0;
+
+        recordVADReadAheadHit(getPFNextension(transitionPFN)->VAD);
+
+    } else {
+
+        transitionPFN->protectedBit = 1;
+
+    }
+
     //
     // Update PFN state with PTE index and status bits to active
     //
@@ -363,18 +447,18 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
     writePTE(masterPTE, newPTE);
     
     
-    // warning - "window" between MapUserPhysicalPages and VirtualProtect may result in a brief lack of permissions protection
+    // warning - "window" between mapPhysicalPages and VirtualProtect may result in a brief lack of permissions protection
 
 
     // assign VA to point at physical page, mirroring our local PTE change
-    bResult = MapUserPhysicalPages(virtualAddress, 1, &pageNum);
+    bResult = mapPhysicalPages(virtualAddress, 1, &pageNum);
 
     if (bResult != TRUE) {
         PRINT_ERROR("[trans PageFault] Kernel state issue: Error mapping user physical pages \n");
     }
 
     // update physical permissions of hardware PTE to match our software reference.
-    bResult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[transRWEpermissions], &oldPermissions);
+    bResult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[getMappedPermissions(newPTE)], &oldPermissions);
 
     if (bResult != TRUE) {
         PRINT_ERROR("[trans PageFault] Kernel state issue: Error virtual protecting VA with permissions %u\n", transRWEpermissions);
@@ -391,8 +475,213 @@ transPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE,
 }
 
 
+static ULONG_PTR
+getReadAheadPages(PPTE masterPTE, PTE snapPTE, PVADNode currVAD, PPFNdata* readAheadPages)
+{
+
+    ULONG_PTR maxReadAhead;
+    ULONG_PTR numReadAhead;
+    ULONG_PTR PTEsToNextPageTable;
+    PPTE VADEndPTE;
+    PPTE currPTE;
+    PTE currSnapPTE;
+    PTE newPTE;
+    PPFNdata currPFN;
+    PeventNode currEventNode;
+
+    //
+    // Read ahead only the PTEs following masterPTE on its page table page (the
+    // only one known to be resident) and under its PTE lock (held by caller)
+    //
+
+    maxReadAhead = getVADReadAheadPages(currVAD);
+
+    VADEndPTE = getPTEaddress(currVAD->startVA) + currVAD->numPages;
+
+    PTEsToNextPageTable = getPTEsToNextPageTable(masterPTE, PTEarray + virtualMemPages);
+
+    if (maxReadAhead >= PTEsToNextPageTable) {
+
+        maxReadAhead = PTEsToNextPageTable - 1;
+
+    }
+
+    for (numReadAhead = 0; numReadAhead < maxReadAhead; numReadAhead++) {
+
+        currPTE = masterPTE + numReadAhead + 1;
+
+        if (getLockIndex(currPTE) != getLockIndex(masterPTE) || currPTE >= VADEndPTE) {
+
+            break;
+
+        }
+
+        //
+        // Neighbour must be in pagefile state, in the slot following the previous page's
+        //
+
+        currSnapPTE = *currPTE;
+
+        if (currSnapPTE.u1.hPTE.validBit == 1
+            || currSnapPTE.u1.tPTE.transitionBit == 1
+            || currSnapPTE.u1.pfPTE.permissions == NO_ACCESS
+            || currSnapPTE.u1.pfPTE.pageFileIndex != snapPTE.u1.pfPTE.pageFileIndex + numReadAhead + 1) {
+
+            break;
+
+        }
+
+        //
+        // Speculative reads only take pages while they are plentiful, and never
+        // wait for a read in progress event
+        //
+
+        if (availablePageCount < HIGH_AVAILABLE_PAGES) {
+
+            break;
+
+        }
+
+        currEventNode = dequeueLockedEvent(&readInProgEventListHead);
+
+        if (currEventNode == NULL) {
+
+            break;
+
+        }
+
+        currPFN = getPage(TRUE);
+
+        if (currPFN == NULL) {
+
+            enqueueEvent(&readInProgEventListHead, currEventNode);
+
+            break;
+
+        }
+
+        //
+        // Set up the page exactly as pageFilePageFault sets up its own - read in
+        // progress on standby, holding the reading thread's reference and owning
+        // the pagefile slot - so other threads wait on (or decommit) it during the
+        // read, and the slot cannot be freed and reused under it
+        //
+
+        currPFN->statusBits = STANDBY;
+
+        currPFN->readInProgressBit = 1;
+
+        currPFN->readAheadBit = 1;
+
+        getPFNextension(currPFN)->readInProgEventNode = currEventNode;
+
+        currPFN->PTEindex = currPTE - PTEarray;
+
+        getPFNextension(currPFN)->VAD = currVAD;
+
+        getPFNextension(currPFN)->pageFileOffset = currSnapPTE.u1.pfPTE.pageFileIndex;
+
+        ASSERT(currPFN->refCount == 0);
+
+        currPFN->refCount = 1;
+
+        releaseJLock(&currPFN->lockBits);
+
+        //
+        // Set the neighbour's PTE to transition state before the PTE lock is released
+        //
+
+        newPTE.u1.ulongPTE = 0;
+
+        newPTE.u1.tPTE.transitionBit = 1;
+
+        newPTE.u1.tPTE.permissions = currSnapPTE.u1.pfPTE.permissions;
+
+        newPTE.u1.tPTE.PFN = currPFN - PFNarray;
+
+        writePTE(currPTE, newPTE);
+
+        readAheadPages[numReadAhead] = currPFN;
+
+    }
+
+    if (numReadAhead != 0) {
+
+        recordVADReadAhead(currVAD, numReadAhead);
+
+    }
+
+    return numReadAhead;
+
+}
+
+
+static VOID
+completeReadAhead(PPFNdata* readAheadPages, ULONG_PTR numReadAhead)
+{
+
+    PPFNdata currPFN;
+    PeventNode currEventNode;
+
+    for (ULONG_PTR i = 0; i < numReadAhead; i++) {
+
+        currPFN = readAheadPages[i];
+
+        acquireJLock(&currPFN->lockBits);
+
+        currEventNode = getPFNextension(currPFN)->readInProgEventNode;
+
+        //
+        // Clear readInProgressBit and set event to notify any other threads
+        // in transition pagefault that have waited on this page's read
+        //
+
+        ASSERT(currPFN->readInProgressBit == 1);
+
+        currPFN->readInProgressBit = 0;
+
+        currPFN->refCount--;
+
+        //
+        // If the PTE was decommitted during the read, the page is freed - otherwise
+        // it is cached on standby (the pagefile slot stays with the PFN, exactly as
+        // for a page written out and then trimmed). Either way, the last thread
+        // referencing the page enqueues it (see transPageFault)
+        //
+
+        if (currPFN->refCount == 0) {
+
+            getPFNextension(currPFN)->readInProgEventNode = NULL;
+
+            enqueueEvent(&readInProgEventListHead, currEventNode);
+
+            if (currPFN->statusBits == AWAITING_FREE) {
+
+                releaseAwaitingFreePFN(currPFN);
+
+            } else {
+
+                ASSERT(currPFN->statusBits == STANDBY && currPFN->remodifiedBit == 0);
+
+                enqueuePage(&standbyListHead, currPFN);
+
+            }
+
+        } else {
+
+            SetEvent(currEventNode->event);
+
+        }
+
+        releaseJLock(&currPFN->lockBits);
+
+    }
+
+}
+
+
 faultStatus
-pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
+pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE, PVADNode currVAD)
 {
     
     ULONG_PTR pageNum;
@@ -403,6 +692,10 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
     BOOL bResult;
     BOOL clearIndex;
     PeventNode readInProgEventNode;
+    PPFNdata readAheadPages[READ_AHEAD_MAX];
+    ULONG_PTR readPFNs[READ_AHEAD_MAX + 1];
+    ULONG_PTR signatures[READ_AHEAD_MAX + 1];
+    ULONG_PTR numReadAhead;
 
     clearIndex = FALSE;
 
@@ -444,13 +737,13 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
     // dequeue a page of memory from freed list
     //
 
-    freedPFN = getPage(TRUE);
+    freedPFN = getFaultPage(TRUE);
 
     if (freedPFN == NULL) {
 
         //
         // Return immediately to caller so PTE lock can be released
-        // No page lock is held since getPage call failed
+        // No page lock is held since getFaultPage call failed
         // Signals to caller to wait for new pages and then re-fault post 
         // release of PTE lock
         //
@@ -471,17 +764,19 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     freedPFN->readInProgressBit = 1;
 
-    freedPFN->readInProgEventNode = readInProgEventNode;
+    getPFNextension(freedPFN)->readInProgEventNode = readInProgEventNode;
 
 
     freedPFN->PTEindex = masterPTE - PTEarray;
 
+    getPFNextension(freedPFN)->VAD = currVAD;
+
     //
     // Assqign PFN pagefile offset field to PTE pagefile index
     // so that upon possible failure it can be freed
     //
 
-    freedPFN->pageFileOffset = snapPTE.u1.pfPTE.pageFileIndex;
+    getPFNextension(freedPFN)->pageFileOffset = snapPTE.u1.pfPTE.pageFileIndex;
 
     //
     // Initialize PFN refCount to 1, since page is being referenced upon read by
@@ -501,6 +796,14 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     releaseJLock(&freedPFN->lockBits);
 
+    //
+    // Take pages for the neighbouring PTEs whose contents sit in the following
+    // pagefile slots, to be read in along with this page (their PTEs are put in
+    // transition with reads in progress, just as this PTE is below)
+    //
+
+    numReadAhead = getReadAheadPages(masterPTE, snapPTE, currVAD, readAheadPages);
+
     //
     // set PTE to transition state so it can be faulted by other threads
     //
@@ -543,30 +846,47 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
     // or standby at)
     //
 
-    ULONG_PTR signature;
+    readPFNs[0] = pageNum;
 
-    #ifdef TESTING_VERIFY_ADDRESSES
+    for (ULONG_PTR i = 0; i < numReadAhead; i++) {
 
-        signature = (ULONG_PTR) virtualAddress & ~(PAGE_SIZE - 1);
-    
-    #else
+        readPFNs[i + 1] = readAheadPages[i] - PFNarray;
+
+    }
 
-        signature = 0;
+    for (ULONG_PTR i = 0; i <= numReadAhead; i++) {
 
-    #endif
+        #ifdef TESTING_VERIFY_ADDRESSES
+
+            signatures[i] = ( (ULONG_PTR) virtualAddress & ~(PAGE_SIZE - 1) ) + (i << PAGE_SHIFT);
+        
+        #else
+
+            signatures[i] = 0;
+
+        #endif
+
+    }
+
+    //
+    // Read this page and the read-ahead pages in with a single copy (their slots are contiguous)
+    //
 
     while (bResult != TRUE) {
 
-        bResult = readPageFromFileSystem(pageNum, snapPTE.u1.pfPTE.pageFileIndex, signature);
+        bResult = readPagesFromFileSystem(readPFNs, numReadAhead + 1, snapPTE.u1.pfPTE.pageFileIndex, signatures);
 
     }
 
     //
-    // Re-acquire PTE lock (post read from filesystem)
+    // Re-acquire PTE lock (post read from filesystem), and complete the reads of
+    // the read-ahead pages
     //
 
     acquirePTELock(masterPTE);
 
+    completeReadAhead(readAheadPages, numReadAhead);
+
     //
     // While page is being read in from filesystem, the only PTE state change that 
     // can occur is a decommit. However, a subsequent recommit/pagefault/trim/etc 
@@ -601,7 +921,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
         if (freedPFN->refCount == 0) {
 
-            freedPFN->readInProgEventNode = NULL;
+            getPFNextension(freedPFN)->readInProgEventNode = NULL;
 
             enqueueEvent(&readInProgEventListHead, readInProgEventNode);
 
@@ -690,13 +1010,13 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     DWORD oldPermissions;
 
-    // warning - "window" between MapUserPhysicalPages and VirtualProtect may result in a lack of permissions protection
+    // warning - "window" between mapPhysicalPages and VirtualProtect may result in a lack of permissions protection
 
     //
     // Assign VA to point at physical page, mirroring our local PTE change
     //
 
-    bResult = MapUserPhysicalPages(virtualAddress, 1, &pageNum);
+    bResult = mapPhysicalPages(virtualAddress, 1, &pageNum);
 
     if (bResult != TRUE) {
 
@@ -708,7 +1028,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
     // Update physical permissions of hardware PTE to match our software reference.
     //
 
-    bResult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[pageFileRWEpermissions], &oldPermissions);
+    bResult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[getMappedPermissions(newPTE)], &oldPermissions);
 
     if (bResult != TRUE) {
 
@@ -732,7 +1052,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     freedPFN->statusBits = ACTIVE;
 
-    ASSERT(freedPFN->pageFileOffset == snapPTE.u1.pfPTE.pageFileIndex);
+    ASSERT(getPFNextension(freedPFN)->pageFileOffset == snapPTE.u1.pfPTE.pageFileIndex);
 
     //
     // If current thread is the last waiting thread, clear the 
@@ -746,7 +1066,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     if (freedPFN->refCount == 0) {
 
-        freedPFN->readInProgEventNode = NULL;
+        getPFNextension(freedPFN)->readInProgEventNode = NULL;
 
         enqueueEvent(&readInProgEventListHead, readInProgEventNode);
 
@@ -763,7 +1083,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     if (clearIndex == TRUE) {
 
-        freedPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(freedPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
     }
 
@@ -781,7 +1101,7 @@ pageFilePageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
 
 faultStatus
-demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
+demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE, PVADNode currVAD)
 {
 
     PRINT(" - dz page fault\n");
@@ -830,13 +1150,13 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
     // dequeue a page of memory from freed list, setting status bits to active
     //
 
-    freedPFN = getPage(TRUE);
+    freedPFN = getFaultPage(TRUE);
 
     if (freedPFN == NULL) {
 
         //
         // Return immediately to caller so PTE lock can be released
-        // No page lock is held since getPage call failed
+        // No page lock is held since getFaultPage call failed
         // Signals to caller to wait for new pages and then re-fault post 
         // release of PTE lock
         //
@@ -853,6 +1173,8 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
 
     freedPFN->PTEindex = PTEindex;
 
+    getPFNextension(freedPFN)->VAD = currVAD;
+
     //
     // Release pfn lock so that it can now be viewed/modified by other threads
     //
@@ -892,7 +1214,7 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
     writePTE(masterPTE, newPTE);
     
     //
-    // Note: Without PTE locking/synchronization, the time between MapUserPhysicalPages
+    // Note: Without PTE locking/synchronization, the time between mapPhysicalPages
     // and VirtualProtect calls would result in an exploitable lack of permissions protection
     //
 
@@ -900,7 +1222,7 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
     // assign VA to point at physical page, mirroring our local PTE change
     //
 
-    bresult = MapUserPhysicalPages(virtualAddress, 1, &pageNum);
+    bresult = mapPhysicalPages(virtualAddress, 1, &pageNum);
 
     if (bresult != TRUE) {
 
@@ -912,7 +1234,7 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
     // update physical permissions of hardware PTE to match our software reference.
     //
 
-    bresult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[dZeroRWEpermissions], &oldPermissions);
+    bresult = VirtualProtect(virtualAddress, PAGE_SIZE, windowsPermissions[getMappedPermissions(newPTE)], &oldPermissions);
 
     if (bresult != TRUE) {
         PRINT_ERROR("[dz PageFault] Error virtual protecting VA with permissions %u\n", dZeroRWEpermissions);
@@ -924,6 +1246,31 @@ demandZeroPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE sna
 
 
 
+static PVADNode
+getFaultVAD(void* virtualAddress)
+{
+
+    PVADNode currVAD;
+
+    //
+    // Only the VAD "write" lock is acquired (as in checkVADPageFault). The VA is
+    // committed and its PTE lock is held, so the VAD cannot be freed once the lock
+    // is released (deleteVAD must first decommit the PTE)
+    //
+
+    EnterCriticalSection(&VADWriteLock);
+
+    currVAD = getVAD(virtualAddress);
+
+    LeaveCriticalSection(&VADWriteLock);
+
+    ASSERT(currVAD != NULL);
+
+    return currVAD;
+
+}
+
+
 faultStatus
 checkVADPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapPTE, PPTE masterPTE)
 {
@@ -966,7 +1313,7 @@ checkVADPageFault(void* virtualAddress, PTEpermissions RWEpermissions, PTE snapP
 
     snapPTE.u1.dzPTE.permissions = VADpermissions;
 
-    dzStatus = demandZeroPageFault(virtualAddress, RWEpermissions, snapPTE, masterPTE);
+    dzStatus = demandZeroPageFault(virtualAddress, RWEpermissions, snapPTE, masterPTE, currVAD);
 
     //
     // VAD "write" lock must be held throughout fault to avoid the VAD from 
@@ -998,12 +1345,13 @@ pageFault(void* virtualAddress, PTEpermissions RWEpermissions)
     currPTE = getPTE(virtualAddress);
 
     //
-    // Check for invalid VA (not in range)
+    // Check for invalid VA (not in range, or no page table page committed - 
+    // i.e. the VA has never been part of a VAD)
     //
 
     if (currPTE == NULL) {
 
-        PRINT_ERROR(" VA not in range\n");
+        PRINT(" VA not in range or not in a VAD\n");
         return ACCESS_VIOLATION;
 
     }
@@ -1048,12 +1396,12 @@ pageFault(void* virtualAddress, PTEpermissions RWEpermissions)
         // Note: PTE is not held through - instead, it is released pre-filesystem read and re-acquired post read
         //
 
-        status = pageFilePageFault(virtualAddress, RWEpermissions, oldPTE, currPTE);  
+        status = pageFilePageFault(virtualAddress, RWEpermissions, oldPTE, currPTE, getFaultVAD(virtualAddress));  
 
     }
     else if (oldPTE.u1.dzPTE.permissions != NO_ACCESS) {                // DEMAND ZERO STATE PTE  
 
-        status = demandZeroPageFault(virtualAddress, RWEpermissions, oldPTE, currPTE);
+        status = demandZeroPageFault(virtualAddress, RWEpermissions, oldPTE, currPTE, getFaultVAD(virtualAddress));
 
     }
     else if (oldPTE.u1.dzPTE.decommitBit == 1) {
@@ -1074,6 +1422,16 @@ pageFault(void* virtualAddress, PTEpermissions RWEpermissions)
 
     }
 
+    //
+    // Count faults that brought a page in, for the VAD's fault rate (PFF)
+    //
+
+    if (status == SUCCESS && oldPTE.u1.hPTE.validBit == 0 && currPTE->u1.hPTE.validBit == 1) {
+
+        recordVADFault(getValidPTEVAD(currPTE));
+
+    }
+
     //
     // Release PTE lock
     //
@@ -1088,71 +1446,115 @@ pageFault(void* virtualAddress, PTEpermissions RWEpermissions)
 
     if (status == NO_AVAILABLE_PAGES) {
 
-        ULONG_PTR availablePages;
-        availablePages = 0;
+        waitForAvailablePages();
+
+    }
+    else if (status == PAGE_STATE_CHANGE) {
+
+        PRINT("[pageFile] transition page has changed state\n");
 
         //
-        // Acquire all list locks to verify no pages are available
+        // set status to SUCCESS so that caller will re-fault the PTE
         //
 
-        for (int i = 0; i < STANDBY + 1; i++) {
+        status = SUCCESS;
 
-            EnterCriticalSection(&listHeads[i].lock);
-            availablePages += listHeads[i].count;
-            
-        }
+    }
+    
+    return status;
 
-        if (availablePages == 0) {
+}
 
-            //
-            // If all counts are zero, reset events and leave
-            // critical sections
-            //
 
-            BOOL bRes;
+#ifdef TRANSPARENT_FAULTS
 
+LONG WINAPI
+transparentFaultHandler(PEXCEPTION_POINTERS exceptionInfo)
+{
 
-            for (int i = 0; i < STANDBY + 1; i++) {
+    PEXCEPTION_RECORD exceptionRecord;
+    PVOID virtualAddress;
+    PTEpermissions RWEpermissions;
+    faultStatus status;
 
-                bRes = ResetEvent(listHeads[i].newPagesEvent);
+    exceptionRecord = exceptionInfo->ExceptionRecord;
 
-                if (bRes != TRUE) {
-                    PRINT_ERROR("[dequeueLockedEvent] unable to reset event\n");
-                }
+    if (exceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION) {
 
-                LeaveCriticalSection(&listHeads[i].lock);
+        return EXCEPTION_CONTINUE_SEARCH;
 
-            }
+    }
+
+    //
+    // ExceptionInformation[1] holds the faulting address - only faults within
+    // the simulated VA block are ours to service
+    //
 
-            HANDLE pageEventHandles[] = {zeroListHead.newPagesEvent, freeListHead.newPagesEvent, standbyListHead.newPagesEvent};
+    virtualAddress = (PVOID) exceptionRecord->ExceptionInformation[1];
 
-            WaitForMultipleObjects(STANDBY + 1, pageEventHandles, FALSE, INFINITE);
+    if (virtualAddress < leafVABlock || virtualAddress >= leafVABlockEnd) {
 
+        return EXCEPTION_CONTINUE_SEARCH;
 
-        } else {
+    }
 
-            for (int i = STANDBY; i >= 0; i--) {
+    //
+    // ExceptionInformation[0] holds the access type (0 read, 1 write, 8 execute)
+    //
 
+    if (exceptionRecord->ExceptionInformation[0] == 1) {
 
-                LeaveCriticalSection(&listHeads[i].lock);
+        RWEpermissions = READ_WRITE;
 
-            }
+    } else if (exceptionRecord->ExceptionInformation[0] == 8) {
 
-        }
+        RWEpermissions = READ_EXECUTE;
+
+    } else {
+
+        RWEpermissions = READ_ONLY;
 
     }
-    else if (status == PAGE_STATE_CHANGE) {
 
-        PRINT("[pageFile] transition page has changed state\n");
+    status = pageFault(virtualAddress, RWEpermissions);
 
-        //
-        // set status to SUCCESS so that caller will re-fault the PTE
-        //
+    //
+    // A genuine access violation is passed on to any enclosing _except block.
+    // Otherwise the faulting instruction is simply rerun - if the fault could
+    // not be resolved yet (no pages, state change) it will fault again
+    //
 
-        status = SUCCESS;
+    if (status == ACCESS_VIOLATION) {
+
+        return EXCEPTION_CONTINUE_SEARCH;
 
     }
-    
-    return status;
+
+    return EXCEPTION_CONTINUE_EXECUTION;
 
 }
+
+
+PVOID transparentFaultHandle;
+
+
+BOOLEAN
+initTransparentFaults()
+{
+
+    transparentFaultHandle = AddVectoredExceptionHandler(1, transparentFaultHandler);
+
+    return (transparentFaultHandle != NULL);
+
+}
+
+
+VOID
+freeTransparentFaults()
+{
+
+    RemoveVectoredExceptionHandler(transparentFaultHandle);
+
+}
+
+#endif
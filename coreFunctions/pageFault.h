@@ -21,4 +21,36 @@ faultStatus
 pageFault(void* virtualAddress, PTEpermissions RWEpermissions);
 
 
+
+// Array used to convert PTEpermissions enum to standard windows permissions
+extern DWORD windowsPermissions[];
+
+
+#ifdef TRANSPARENT_FAULTS
+
+/*
+ * initTransparentFaults: function to register a vectored exception handler that services
+ * faults on raw dereferences of leafVABlock
+ *  - handler calls pageFault with the access type of the faulting instruction
+ *  - valid pages with matching hardware protection never fault (no software overhead)
+ * 
+ * Returns BOOLEAN:
+ *  - TRUE on success
+ *  - FALSE on failure
+ */
+BOOLEAN
+initTransparentFaults();
+
+
+/*
+ * freeTransparentFaults: function to unregister the handler from initTransparentFaults
+ * 
+ * No return value
+ */
+VOID
+freeTransparentFaults();
+
+#endif
+
+
 #endif
\ No newline at end of file
@@ -1,71 +1,12 @@
 #include "../usermodeMemoryManager.h"
 #include "../infrastructure/enqueue-dequeue.h"
 #include "../infrastructure/jLock.h"
-#include "../datastructures/PTEpermissions.h"
-#include "pagefile.h"
+#include "../infrastructure/physicalPages.h"
+#include "../infrastructure/bitOps.h"
+#include "../dataStructures/PTEpermissions.h"
+#include "pageFile.h"
 
-#ifndef PAGEFILE_PFN_CHECK
-
-ULONG_PTR
-setPFBitIndex()
-{
-
-    ULONG_PTR bitIndex;
-
-    EnterCriticalSection(&pageFileLock);
-
-    for (ULONG_PTR i = 0; i < ARRAYSIZE (pageFileBitArray); i++) {
-
-        ULONG_PTR currFrame;
-        currFrame = pageFileBitArray[i];
-
-        for (ULONG_PTR j = 0; j < (sizeof(currFrame) * 8); j++) {
-
-            //
-            // If the current bit is clear, set the bit and return the
-            // bitIndex
-            //
-
-            if ((currFrame & 1) == 0) {
-
-                // reset currFrame
-                currFrame = pageFileBitArray[i];
-
-                //
-                // Assert the current bit is clear
-                //
-                
-                ASSERT( ( currFrame & ((ULONG_PTR)1 << j) ) == 0);
-
-
-                // set the bit
-                currFrame |= ((ULONG_PTR)1 << j);
-
-                // set the frame in the bitarray to the edited frame
-                pageFileBitArray[i] = currFrame;
-
-                LeaveCriticalSection(&pageFileLock);
-
-                // calculate bitIndex
-                bitIndex = (i * (sizeof(currFrame)) * 8) + j;
-
-                return bitIndex;
-
-            }
-
-            currFrame >>= 1;   
-
-        }
-
-    }
-
-    LeaveCriticalSection(&pageFileLock);
-
-    return INVALID_BITARRAY_INDEX;
-    
-}
-
-#else
+#ifdef PAGEFILE_PFN_CHECK
 
 ULONG_PTR
 setPFDebugIndex(PPFNdata currPFN)
@@ -90,7 +31,7 @@ setPFDebugIndex(PPFNdata currPFN)
     
     EnterCriticalSection(&pageFileLock);
 
-    for (ULONG_PTR j = 0; j < PAGEFILE_PAGES; j++) {
+    for (ULONG_PTR j = 0; j < pageFilePages; j++) {
 
         checkEntry = pageFileDebugArray + j;
         ULONG_PTR checkPTEindex = checkEntry->currPTE - PTEarray;
@@ -105,7 +46,7 @@ setPFDebugIndex(PPFNdata currPFN)
     }
 
 
-    for (ULONG_PTR i = 0; i < PAGEFILE_PAGES; i++) {
+    for (ULONG_PTR i = 0; i < pageFilePages; i++) {
 
         if (pageFileDebugArray[i].currPFN == NULL && pageFileDebugArray[i].currPTE == NULL) {
 
@@ -128,6 +69,76 @@ setPFDebugIndex(PPFNdata currPFN)
 #endif
 
 
+ULONG_PTR
+reservePFBitRange(PPFNdata firstPFN, ULONG_PTR maxSlots, PULONG_PTR numSlots)
+{
+
+    ASSERT(maxSlots != 0);
+
+    #ifdef PAGEFILE_PFN_CHECK
+
+        //
+        // Debug pagefile entries are logged per PFN - reserve a single slot
+        //
+
+        *numSlots = 1;
+
+        return setPFDebugIndex(firstPFN);
+
+    #else
+
+        ULONG_PTR bitIndex;
+        ULONG_PTR hintIndex;
+
+        bitIndex = INVALID_BITARRAY_INDEX;
+
+        //
+        // Place the run at the slot its first PTE index scales to, so pages adjacent
+        // in VA space land in adjacent (and ascending) pagefile slots. PTEindex
+        // cannot change while the page's write is in progress. Page table pages
+        // (whose PTEindex is a PDE index) take the lowest free run
+        //
+
+        hintIndex = 0;
+
+        if (firstPFN->pageTableBit == 0) {
+
+            hintIndex = (firstPFN->PTEindex * pageFilePages) / virtualMemPages;
+
+        }
+
+        EnterCriticalSection(&pageFileLock);
+
+        //
+        // Look for the whole run first, halving the request each time the pagefile
+        // is too fragmented to hold it
+        //
+
+        while (maxSlots != 0) {
+
+            bitIndex = reserveBitRangeNear(maxSlots, pageFileBitArray, pageFileBitArraySize * 8 * sizeof(ULONG_PTR), hintIndex);
+
+            if (bitIndex != INVALID_BITARRAY_INDEX) {
+
+                break;
+
+            }
+
+            maxSlots >>= 1;
+
+        }
+
+        LeaveCriticalSection(&pageFileLock);
+
+        *numSlots = maxSlots;
+
+        return bitIndex;
+
+    #endif
+
+}
+
+
 VOID
 clearPFBitIndex(ULONG_PTR pfVA) 
 {
@@ -202,10 +213,26 @@ clearPFBitIndex(ULONG_PTR pfVA)
 }
 
 
-BOOLEAN
-writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig)
+ULONG_PTR
+writePagesToFileSystem(PPFNdata* pagesToWrite, ULONG_PTR numPages, PULONG_PTR expectedSigs, PBOOLEAN pageWritten)
 {
 
+    ULONG_PTR PFNs[MODIFIED_WRITE_BATCH_SIZE];
+    ULONG_PTR bitIndices[MODIFIED_WRITE_BATCH_SIZE];
+    ULONG_PTR numWritten;
+    ULONG_PTR bitIndex;
+    ULONG_PTR numSlots;
+
+    ASSERT(numPages != 0 && numPages <= MODIFIED_WRITE_BATCH_SIZE);
+
+    for (ULONG_PTR i = 0; i < numPages; i++) {
+
+        PFNs[i] = pagesToWrite[i] - PFNarray;
+
+        pageWritten[i] = FALSE;
+
+    }
+
     PVANode writeVANode;
     writeVANode = dequeueLockedVA(&writeVAListHead);
 
@@ -222,69 +249,107 @@ writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig)
     PVOID modifiedWriteVA;
     modifiedWriteVA = writeVANode->VA;
 
-    ULONG_PTR PFN;
-    PFN = PFNtoWrite - PFNarray;
-
-    ULONG_PTR bitIndex;
+    //
+    // Map the whole batch to the modifiedWriteVA window at once
+    //
 
-    #ifdef PAGEFILE_PFN_CHECK
-        bitIndex = setPFDebugIndex(PFNtoWrite);
-    #else
-        bitIndex = setPFBitIndex();
-    #endif
+    if (!mapPhysicalPages(modifiedWriteVA, numPages, PFNs)) {
 
+        enqueueVA(&writeVAListHead, writeVANode);
 
-    if (bitIndex == INVALID_BITARRAY_INDEX) {
+        PRINT_ERROR("error mapping modifiedWriteVA\n");
 
-        enqueueVA(&writeVAListHead, writeVANode);
-        PRINT("no remaining space in pagefile - could not write out\n");
-        return FALSE;
+        return 0;
 
     }
 
+    //
+    // Verify signatures written to filesystem are expected (either VA signature or 0)
+    //
 
-    // map given page to the modifiedWriteVA
-    if (!MapUserPhysicalPages(modifiedWriteVA, 1, &PFN)) {
+    #ifdef TESTING_VERIFY_ADDRESSES
 
-        clearPFBitIndex(bitIndex);
+        for (ULONG_PTR i = 0; i < numPages; i++) {
 
-        enqueueVA(&writeVAListHead, writeVANode);
+            PULONG_PTR pageSig;
+            pageSig = (PULONG_PTR) ( (ULONG_PTR) modifiedWriteVA + (i << PAGE_SHIFT) );
 
-        PRINT_ERROR("error mapping modifiedWriteVA\n");
+            ASSERT(expectedSigs[i] == NO_PAGE_SIGNATURE || expectedSigs[i] == *pageSig || *pageSig == 0 );
 
-        return FALSE;
+        }
 
-    }
+    #endif
 
     //
-    // Verify signature written to filesystem is expected (either VA signature or 0)
+    // Copy the batch out a contiguous run of pagefile slots at a time. The whole
+    // (PTEindex sorted) batch is requested as one run at its first page's slot -
+    // only if the pagefile is too fragmented to hold it is the rest split into a
+    // run per stretch of adjacent PTEs, each placed at its own first page's slot
     //
 
-    #ifdef TESTING_VERIFY_ADDRESSES
+    numWritten = 0;
 
-        ASSERT(expectedSig == * (PULONG_PTR) modifiedWriteVA || * (PULONG_PTR) modifiedWriteVA == 0 );
+    while (numWritten < numPages) {
 
-    #endif
+        ULONG_PTR runLength;
+
+        runLength = numPages;
 
-    // get location in pagefile from bitindex
-    PVOID PFLocation;
-    PFLocation = (void*) ( (ULONG_PTR)pageFileVABlock + ( bitIndex << PAGE_SHIFT ) );        // equiv to bitIndex*page_size
+        if (numWritten != 0) {
 
+            runLength = 1;
 
-    // copy the contents in the currentPFN out to the pagefile
-    memcpy(PFLocation, modifiedWriteVA, PAGE_SIZE);
+            while (numWritten + runLength < numPages
+                   && pagesToWrite[numWritten + runLength]->pageTableBit == pagesToWrite[numWritten]->pageTableBit
+                   && pagesToWrite[numWritten + runLength]->PTEindex == pagesToWrite[numWritten]->PTEindex + runLength) {
 
+                runLength++;
+
+            }
+
+        }
 
-    // unmap modifiedWriteVA from page
-    if (!MapUserPhysicalPages(modifiedWriteVA, 1, NULL)) {
+        bitIndex = reservePFBitRange(pagesToWrite[numWritten], runLength, &numSlots);
 
-        clearPFBitIndex(bitIndex);
+        if (bitIndex == INVALID_BITARRAY_INDEX) {
+
+            PRINT("no remaining space in pagefile - could not write out\n");
+            break;
+
+        }
+
+        // get location in pagefile from bitindex
+        PVOID PFLocation;
+        PFLocation = (void*) ( (ULONG_PTR)pageFileVABlock + ( bitIndex << PAGE_SHIFT ) );        // equiv to bitIndex*page_size
+
+        // copy the contents of the run out to the pagefile
+        memcpy(PFLocation, (void*) ( (ULONG_PTR) modifiedWriteVA + (numWritten << PAGE_SHIFT) ), numSlots << PAGE_SHIFT);
+
+        for (ULONG_PTR i = 0; i < numSlots; i++) {
+
+            bitIndices[numWritten] = bitIndex + i;
+
+            numWritten++;
+
+        }
+
+    }
+
+
+    // unmap modifiedWriteVA window from the batch
+    if (!unmapPhysicalPages(modifiedWriteVA, numPages)) {
+
+        for (ULONG_PTR i = 0; i < numWritten; i++) {
+
+            clearPFBitIndex(bitIndices[i]);
+
+        }
 
         enqueueVA(&writeVAListHead, writeVANode);
 
         PRINT_ERROR("error unmapping modifiedWriteVA\n");
 
-        return FALSE;
+        return 0;
 
     }
 
@@ -292,18 +357,24 @@ writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig)
     enqueueVA(&writeVAListHead, writeVANode);
 
 
-    // add/update pageFileOffset field of PFN
+    // add/update pageFileOffset field of each PFN written
     // ONLY updates if the mapuserphysical pages calls are also successful
 
-    acquireJLock(&PFNtoWrite->lockBits);
+    for (ULONG_PTR i = 0; i < numWritten; i++) {
 
-    PFNtoWrite->pageFileOffset = bitIndex;
+        acquireJLock(&pagesToWrite[i]->lockBits);
 
-    releaseJLock(&PFNtoWrite->lockBits);
+        getPFNextension(pagesToWrite[i])->pageFileOffset = bitIndices[i];
 
-    PRINT("successfully wrote page to pagefile\n");
+        releaseJLock(&pagesToWrite[i]->lockBits);
 
-    return TRUE;
+        pageWritten[i] = TRUE;
+
+    }
+
+    PRINT("successfully wrote %llu pages to pagefile\n", numWritten);
+
+    return numWritten;
 
 }
 
@@ -311,14 +382,24 @@ writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig)
 BOOLEAN
 readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR expectedSig) {
 
+    return readPagesFromFileSystem(&destPFN, 1, pageFileIndex, &expectedSig);
+
+}
+
+
+BOOLEAN
+readPagesFromFileSystem(PULONG_PTR destPFNs, ULONG_PTR numPages, ULONG_PTR pageFileIndex, PULONG_PTR expectedSigs) {
+
     
     PVANode readPFVANode;
     PVOID readPFVA;
     PVOID PFsourceVA;
 
+    ASSERT(numPages != 0 && numPages <= READ_AHEAD_MAX + 1);
+
     //
-    // Acquire a spare VA from readPFVAList to temporarily
-    // map to page for memcpy operation
+    // Acquire a spare VA window from readPFVAList to temporarily
+    // map to pages for memcpy operation
     //
 
     readPFVANode = dequeueLockedVA(&readPFVAListHead);
@@ -337,10 +418,12 @@ readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR exp
     readPFVA = readPFVANode->VA;    
 
     //
-    // Map given page to the temporary reading-in VA
+    // Map given pages to the temporary reading-in VA window
     //
 
-    if (!MapUserPhysicalPages(readPFVA, 1, &destPFN)) {
+    if (!mapPhysicalPages(readPFVA, numPages, destPFNs)) {
+
+        enqueueVA(&readPFVAListHead, readPFVANode);
 
         PRINT_ERROR("[pageFilePageFault]error remapping page to copy from PF\n");
 
@@ -355,26 +438,35 @@ readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR exp
     PFsourceVA = (PVOID) ( (ULONG_PTR) pageFileVABlock + (pageFileIndex << PAGE_SHIFT) );
 
     //
-    // Copy contents from pagefile to our new 
+    // Copy contents from the contiguous pagefile slots to our new pages
     //
 
-    memcpy(readPFVA, PFsourceVA, PAGE_SIZE);
+    memcpy(readPFVA, PFsourceVA, numPages << PAGE_SHIFT);
 
     //
-    // Verify signature is coming back as expected (either VA signature or 0)
+    // Verify signatures are coming back as expected (either VA signature or 0)
     //
 
     #ifdef TESTING_VERIFY_ADDRESSES
 
-        ASSERT(expectedSig == * (PULONG_PTR) readPFVA || * (PULONG_PTR) readPFVA == 0 );
+        for (ULONG_PTR i = 0; i < numPages; i++) {
+
+            PULONG_PTR pageSig;
+            pageSig = (PULONG_PTR) ( (ULONG_PTR) readPFVA + (i << PAGE_SHIFT) );
+
+            ASSERT(expectedSigs[i] == NO_PAGE_SIGNATURE || expectedSigs[i] == *pageSig || *pageSig == 0 );
+
+        }
 
     #endif
 
     //
-    // Unmap VA from page - PFN is now filled w contents from pagefile
+    // Unmap VA window from pages - PFNs are now filled w contents from pagefile
     //
 
-    if (!MapUserPhysicalPages(readPFVA, 1, NULL) ) {
+    if (!unmapPhysicalPages(readPFVA, numPages) ) {
+
+        enqueueVA(&readPFVAListHead, readPFVANode);
 
         PRINT_ERROR("error copying page from into page\n");
         return FALSE;
@@ -385,4 +477,4 @@ readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR exp
 
     return TRUE;
     
-}
\ No newline at end of file
+}
@@ -1,24 +1,14 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
-
-/*
- * setPFBitIndex: function to set (change from 0 to 1) bit index of pagefile bit array
- *  - denotes that that PF offset is now in use
- * 
- * Returns ULONG_PTR:
- *  - bitIndex on success
- *  - INVALID_BITARRAY_INDEX on failure ( no available space)
- */
-ULONG_PTR
-setPFBitIndex();
+#define NO_PAGE_SIGNATURE MAXULONG_PTR              // expectedSig for pages with no VA signature (page table pages)
 
 
 /*
- * setPFDebugIndex: debugging alternative to setPFBitIndex
- *  - if PAGEFILE_PFN_CHECK is enabled, logs additional data
- *    within a larger pagefile array (containing pageFileDebug 
- *    structs)
+ * setPFDebugIndex: function to reserve a pagefile slot for currPFN's page
+ *  - only compiled if PAGEFILE_PFN_CHECK is enabled, where it replaces the
+ *    pagefile bit array with a larger array of pageFileDebug structs that
+ *    record the PFN and PTE occupying each slot
  * 
  * Returns ULONG_PTR:
  *  - bitIndex on success
@@ -42,21 +32,55 @@ clearPFBitIndex(ULONG_PTR pfVA);
 
 
 /*
- * writePageToFileSystem: function to write out a given page (associated w PFN metadata) to pagefile
- *  - calls setPFBitIndex to find and set free block in pageFile
- *  - if found
- *    - copy contents of given page to pagefile location
+ * reservePFBitRange: function to set a run of contiguous bit indices of pagefile bit array
+ *  - reserves the longest run of up to maxSlots free slots it can find, halving the
+ *    request until a run is found (single slots at worst)
+ *  - the run is placed at the nearest free run at or after (else before) the slot
+ *    firstPFN's PTEindex scales to, keeping pages adjacent in VA space adjacent in
+ *    the pagefile
+ *  - if PAGEFILE_PFN_CHECK is enabled, reserves a single slot via setPFDebugIndex
+ *
+ * Returns ULONG_PTR:
+ *  - first bitIndex of the run on success (run length written to numSlots)
+ *  - INVALID_BITARRAY_INDEX on failure (no available space)
+ */
+ULONG_PTR
+reservePFBitRange(PPFNdata firstPFN, ULONG_PTR maxSlots, PULONG_PTR numSlots);
+
+
+/*
+ * writePagesToFileSystem: function to write out a batch of pages (associated w PFN metadata) to pagefile
+ *  - maps the whole batch at a write VA window with a single call
+ *  - calls reservePFBitRange to find a contiguous run of free pagefile slots for the
+ *    whole batch, falling back to a run per stretch of pages with adjacent PTE indices
+ *    when the pagefile is fragmented - each run is copied out with a single memcpy
+ *  - callers sort the batch by PTEindex so that it lands in ascending pagefile slots
+ *  - sets the pageFileOffset of every page written, and its pageWritten entry
+ *  - pages that found no pagefile space are left unwritten (pageWritten FALSE)
+ *
+ * Returns ULONG_PTR:
+ *  - number of pages written (zero on failure)
+ */
+ULONG_PTR
+writePagesToFileSystem(PPFNdata* pagesToWrite, ULONG_PTR numPages, PULONG_PTR expectedSigs, PBOOLEAN pageWritten);
+
+
+/*
+ * readPageFromFileSystem: function to read in a given page from file system
  * 
- * Returns BOOLEAN:
+ * returns BOOLEAN:
  *  - TRUE on success
  *  - FALSE on failure
+ * 
  */
 BOOLEAN
-writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig);
+readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR expectedSig);
 
 
 /*
- * readPageFromFileSystem: function to read in a given page from file system
+ * readPagesFromFileSystem: function to read in a run of contiguous pagefile slots,
+ * starting at pageFileIndex, to the given pages in a single copy
+ *  - at most READ_AHEAD_MAX + 1 pages (the size of a read VA window)
  * 
  * returns BOOLEAN:
  *  - TRUE on success
@@ -64,6 +88,6 @@ writePageToFileSystem(PPFNdata PFNtoWrite, ULONG_PTR expectedSig);
  * 
  */
 BOOLEAN
-readPageFromFileSystem(ULONG_PTR destPFN, ULONG_PTR pageFileIndex, ULONG_PTR expectedSig);
+readPagesFromFileSystem(PULONG_PTR destPFNs, ULONG_PTR numPages, ULONG_PTR pageFileIndex, PULONG_PTR expectedSigs);
 
 #endif
\ No newline at end of file
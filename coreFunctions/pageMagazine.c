@@ -0,0 +1,257 @@
+#include "../usermodeMemoryManager.h"
+#include "../infrastructure/enqueue-dequeue.h"
+#include "../infrastructure/jLock.h"
+#include "pageMagazine.h"
+
+
+typedef struct _pageMagazine {
+    volatile LONG lock;                         // jLock - only contended while pages are being reclaimed
+    ULONG_PTR numZeroPages;
+    ULONG_PTR numFreePages;
+    PPFNdata zeroPages[PAGE_MAGAZINE_SIZE];
+    PPFNdata freePages[PAGE_MAGAZINE_SIZE];
+} pageMagazine, *PpageMagazine;
+
+
+pageMagazine pageMagazines[MAX_PAGE_MAGAZINES];
+volatile LONG numPageMagazines;                 // magazines handed out (may exceed MAX_PAGE_MAGAZINES)
+volatile LONG64 magazinePageCount;
+
+static THREAD_LOCAL PpageMagazine currMagazine;
+
+
+static PpageMagazine
+getThreadMagazine()
+{
+
+    LONG magazineIndex;
+
+    if (currMagazine != NULL) {
+
+        return currMagazine;
+
+    }
+
+    //
+    // Claim the next magazine from the pool on first use
+    //
+
+    magazineIndex = InterlockedIncrement(&numPageMagazines) - 1;
+
+    if (magazineIndex >= MAX_PAGE_MAGAZINES) {
+
+        return NULL;
+
+    }
+
+    currMagazine = &pageMagazines[magazineIndex];
+
+    return currMagazine;
+
+}
+
+
+static VOID
+refillMagazine(PpageMagazine magazine)
+{
+
+    ULONG_PTR batchSize;
+    ULONG_PTR numRefilled;
+
+    //
+    // Only cache pages while available pages are well above the trim
+    // threshold - under pressure, take a single page per refill
+    //
+
+    batchSize = PAGE_MAGAZINE_SIZE;
+
+    if (availablePageCount < LOW_AVAILABLE_PAGES + MAX_PAGE_MAGAZINES) {
+
+        batchSize = 1;
+
+    }
+
+    //
+    // Zero pages first, so free pages (which must be zeroed on the way out)
+    // are only cached once the zero list is exhausted
+    //
+
+    numRefilled = dequeuePages(&zeroListHead, batchSize, magazine->zeroPages, FALSE);
+
+    magazine->numZeroPages = numRefilled;
+
+    if (numRefilled == 0) {
+
+        numRefilled = dequeuePages(&freeListHead, batchSize, magazine->freePages, FALSE);
+
+        magazine->numFreePages = numRefilled;
+
+    }
+
+    InterlockedAdd64(&magazinePageCount, numRefilled);
+
+}
+
+
+PPFNdata
+getMagazinePage(BOOLEAN returnLocked)
+{
+
+    PpageMagazine magazine;
+    PPFNdata returnPFN;
+    BOOLEAN zeroed;
+
+    magazine = getThreadMagazine();
+
+    if (magazine == NULL) {
+
+        return NULL;
+
+    }
+
+    acquireJLock(&magazine->lock);
+
+    if (magazine->numZeroPages == 0 && magazine->numFreePages == 0) {
+
+        refillMagazine(magazine);
+
+    }
+
+    if (magazine->numZeroPages != 0) {
+
+        magazine->numZeroPages--;
+
+        returnPFN = magazine->zeroPages[magazine->numZeroPages];
+
+        zeroed = TRUE;
+
+    }
+    else if (magazine->numFreePages != 0) {
+
+        magazine->numFreePages--;
+
+        returnPFN = magazine->freePages[magazine->numFreePages];
+
+        zeroed = FALSE;
+
+    }
+    else {
+
+        releaseJLock(&magazine->lock);
+
+        return NULL;
+
+    }
+
+    releaseJLock(&magazine->lock);
+
+    InterlockedDecrement64(&magazinePageCount);
+
+    ASSERT(returnPFN->statusBits == NONE);
+
+    if (zeroed == FALSE) {
+
+        //
+        // zeroPage (does not update status bits in PFN metadata)
+        //
+
+        zeroPage(returnPFN - PFNarray);
+
+    }
+
+    getPFNextension(returnPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+    if (returnLocked == TRUE) {
+
+        acquireJLock(&returnPFN->lockBits);
+
+    }
+
+    return returnPFN;
+
+}
+
+
+static VOID
+returnMagazinePages(PpageMagazine magazine)
+{
+
+    PPFNdata currPFN;
+
+    while (magazine->numZeroPages != 0) {
+
+        magazine->numZeroPages--;
+
+        currPFN = magazine->zeroPages[magazine->numZeroPages];
+
+        acquireJLock(&currPFN->lockBits);
+
+        enqueuePage(&zeroListHead, currPFN);
+
+        releaseJLock(&currPFN->lockBits);
+
+        InterlockedDecrement64(&magazinePageCount);
+
+    }
+
+    while (magazine->numFreePages != 0) {
+
+        magazine->numFreePages--;
+
+        currPFN = magazine->freePages[magazine->numFreePages];
+
+        acquireJLock(&currPFN->lockBits);
+
+        enqueuePage(&freeListHead, currPFN);
+
+        releaseJLock(&currPFN->lockBits);
+
+        InterlockedDecrement64(&magazinePageCount);
+
+    }
+
+}
+
+
+VOID
+reclaimPageMagazines()
+{
+
+    LONG numMagazines;
+
+    if (magazinePageCount == 0) {
+
+        return;
+
+    }
+
+    numMagazines = numPageMagazines;
+
+    if (numMagazines > MAX_PAGE_MAGAZINES) {
+
+        numMagazines = MAX_PAGE_MAGAZINES;
+
+    }
+
+    for (LONG i = 0; i < numMagazines; i++) {
+
+        acquireJLock(&pageMagazines[i].lock);
+
+        returnMagazinePages(&pageMagazines[i]);
+
+        releaseJLock(&pageMagazines[i].lock);
+
+    }
+
+}
+
+
+VOID
+drainPageMagazines()
+{
+
+    reclaimPageMagazines();
+
+    ASSERT(magazinePageCount == 0);
+
+}
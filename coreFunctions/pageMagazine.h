@@ -0,0 +1,60 @@
+#ifndef PAGEMAGAZINE_H
+#define PAGEMAGAZINE_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * Per-thread page magazines:
+ *  - each allocating thread keeps small stacks of zero and free pages that
+ *    were dequeued in batches (one list lock acquisition per refill)
+ *  - pages in a magazine are off every list (status NONE, unlocked), and are
+ *    only taken by the owning thread, unless a thread about to wait for pages
+ *    reclaims them (see reclaimPageMagazines)
+ *  - magazines come from a fixed pool - threads beyond MAX_PAGE_MAGAZINES
+ *    fall back to the page lists directly
+ */
+
+#define PAGE_MAGAZINE_SIZE 8                    // pages per magazine (and per refill batch)
+
+#define MAX_PAGE_MAGAZINES 64
+
+extern volatile LONG64 magazinePageCount;       // pages currently held in magazines
+
+
+/*
+ * getMagazinePage: function to get a zeroed page from the calling thread's magazines
+ *  - zero magazine first, then free magazine (page is zeroed before return)
+ *  - an empty magazine is refilled from the corresponding list in a single batch
+ *
+ * Returns PPFNdata
+ *  - page (locked if returnLocked is TRUE, with an invalid pagefile offset) on success
+ *  - NULL if the zero and free lists are both empty (or no magazine is available)
+ */
+PPFNdata
+getMagazinePage(BOOLEAN returnLocked);
+
+
+/*
+ * reclaimPageMagazines: function to return every thread's magazine pages to the
+ * zero/free lists
+ *  - called before a thread waits for available pages, so pages cached by other
+ *    (possibly blocked or idle) threads are never out of reach
+ *  - no PTE, page or list locks should be held upon call
+ *
+ * No return value
+ */
+VOID
+reclaimPageMagazines();
+
+
+/*
+ * drainPageMagazines: function to return all magazine pages to the zero/free lists
+ *  - called on exit, once all other threads have finished, to account for every page
+ *
+ * No return value
+ */
+VOID
+drainPageMagazines();
+
+
+#endif
@@ -0,0 +1,115 @@
+#include "../usermodeMemoryManager.h"
+#include "../infrastructure/enqueue-dequeue.h"
+#include "../infrastructure/jLock.h"
+#include "pageReserve.h"
+
+
+volatile LONG reserveLock;                      // jLock guarding the reserve stack
+PPFNdata reservePages[PAGE_RESERVE_SIZE];
+volatile LONG64 reservePageCount;
+
+
+PPFNdata
+getReservePage(BOOLEAN returnLocked)
+{
+
+    PPFNdata returnPFN;
+
+    if (reservePageCount == 0) {
+
+        return NULL;
+
+    }
+
+    acquireJLock(&reserveLock);
+
+    if (reservePageCount == 0) {
+
+        releaseJLock(&reserveLock);
+
+        return NULL;
+
+    }
+
+    reservePageCount--;
+
+    returnPFN = reservePages[reservePageCount];
+
+    releaseJLock(&reserveLock);
+
+    ASSERT(returnPFN->statusBits == NONE);
+
+    getPFNextension(returnPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+    if (returnLocked == TRUE) {
+
+        acquireJLock(&returnPFN->lockBits);
+
+    }
+
+    return returnPFN;
+
+}
+
+
+ULONG_PTR
+refillPageReserve(PPFNdata* pages, ULONG_PTR numPages)
+{
+
+    ULONG_PTR numReserved;
+    PPFNdata currPFN;
+
+    if (reservePageCount == PAGE_RESERVE_SIZE) {
+
+        return 0;
+
+    }
+
+    numReserved = 0;
+
+    acquireJLock(&reserveLock);
+
+    while (reservePageCount < PAGE_RESERVE_SIZE && numReserved < numPages) {
+
+        numReserved++;
+
+        currPFN = pages[numPages - numReserved];
+
+        ASSERT(currPFN->statusBits == NONE);
+
+        reservePages[reservePageCount] = currPFN;
+
+        reservePageCount++;
+
+        releaseJLock(&currPFN->lockBits);
+
+    }
+
+    releaseJLock(&reserveLock);
+
+    return numReserved;
+
+}
+
+
+VOID
+drainPageReserve()
+{
+
+    PPFNdata currPFN;
+
+    while (reservePageCount != 0) {
+
+        reservePageCount--;
+
+        currPFN = reservePages[reservePageCount];
+
+        acquireJLock(&currPFN->lockBits);
+
+        enqueuePage(&zeroListHead, currPFN);
+
+        releaseJLock(&currPFN->lockBits);
+
+    }
+
+}
@@ -0,0 +1,55 @@
+#ifndef PAGERESERVE_H
+#define PAGERESERVE_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * Fault page reserve:
+ *  - a small pool of zeroed pages that only page faults may draw from, once
+ *    the zero/free/standby lists are empty (see getFaultPage)
+ *  - refilled by the zero page writer before its pages reach the zero list,
+ *    so the reserve is topped up ahead of every other consumer
+ *  - pages in the reserve are off every list (status NONE, unlocked) and are
+ *    not counted as available pages
+ */
+
+#define PAGE_RESERVE_SIZE 16                    // pages held back for page faults
+
+extern volatile LONG64 reservePageCount;        // pages currently held in the reserve
+
+
+/*
+ * getReservePage: function to get a zeroed page from the fault page reserve
+ *  - only called on page fault paths, once getPage has failed
+ *
+ * Returns PPFNdata
+ *  - page (locked if returnLocked is TRUE, with an invalid pagefile offset) on success
+ *  - NULL if the reserve is empty
+ */
+PPFNdata
+getReservePage(BOOLEAN returnLocked);
+
+
+/*
+ * refillPageReserve: function to top up the fault page reserve from a batch of zeroed pages
+ *  - pages are taken from the end of the batch, and must be locked by the caller
+ *    with status NONE - the locks of taken pages are released here
+ *
+ * Returns ULONG_PTR
+ *  - number of pages taken into the reserve (zero if already full)
+ */
+ULONG_PTR
+refillPageReserve(PPFNdata* pages, ULONG_PTR numPages);
+
+
+/*
+ * drainPageReserve: function to return all reserved pages to the zero list
+ *  - called on exit, once all other threads have finished, to account for every page
+ *
+ * No return value
+ */
+VOID
+drainPageReserve();
+
+
+#endif
@@ -1,6 +1,7 @@
 #include "../usermodeMemoryManager.h"
 #include "../infrastructure/enqueue-dequeue.h"
 #include "../infrastructure/jLock.h"
+#include "../infrastructure/physicalPages.h"
 #include "../dataStructures/VApermissions.h"
 #include "../dataStructures/PTEpermissions.h"
 #include "getPage.h"
@@ -84,7 +85,7 @@ copyPage(ULONG_PTR dest, ULONG_PTR src)
     destVA = destVANode->VA;
 
     // map given page to the pageTradeSoureVA
-    if (!MapUserPhysicalPages(sourceVA, 1, &src)) {
+    if (!mapPhysicalPages(sourceVA, 1, &src)) {
         enqueueVA(&pageTradeVAListHead, sourceVANode);
         enqueueVA(&pageTradeVAListHead, destVANode);
         PRINT_ERROR("error remapping srcVA\n");
@@ -92,7 +93,7 @@ copyPage(ULONG_PTR dest, ULONG_PTR src)
     }
 
     // map given page to the pageTradeDestVA VA
-    if (!MapUserPhysicalPages(destVA, 1, &dest)) {
+    if (!mapPhysicalPages(destVA, 1, &dest)) {
         enqueueVA(&pageTradeVAListHead, sourceVANode);
         enqueueVA(&pageTradeVAListHead, destVANode);
         PRINT_ERROR("error remapping destVA\n");
@@ -102,7 +103,7 @@ copyPage(ULONG_PTR dest, ULONG_PTR src)
     memcpy(destVA, sourceVA, PAGE_SIZE);
 
     // unmap pageTradeDestVA from page - PFN is now ready to be alloc'd
-    if (!MapUserPhysicalPages(destVA, 1, NULL)) {
+    if (!unmapPhysicalPages(destVA, 1)) {
         enqueueVA(&pageTradeVAListHead, sourceVANode);
         enqueueVA(&pageTradeVAListHead, destVANode);
         PRINT_ERROR("error copying page\n");
@@ -110,7 +111,7 @@ copyPage(ULONG_PTR dest, ULONG_PTR src)
     }
 
         // unmap pageTradeSoureVA from page - PFN is now ready to be alloc'd
-    if (!MapUserPhysicalPages(sourceVA, 1, NULL)) {
+    if (!unmapPhysicalPages(sourceVA, 1)) {
 
         enqueueVA(&pageTradeVAListHead, sourceVANode);
         enqueueVA(&pageTradeVAListHead, destVANode);
@@ -147,6 +148,31 @@ tradeTransitionPage(ULONG_PTR PFNtoTrade)
         return FALSE;
     }
 
+    //
+    // A page being read in from the pagefile (by a fault or its read-ahead) is
+    // not on a list until the read completes
+    //
+
+    if (pageToTrade->readInProgressBit == 1) {
+
+        releaseJLock(&(pageToTrade->lockBits));
+        PRINT ("[tradeTransitionPage] Page is being read in from the pagefile\n");
+
+        return FALSE;
+    }
+
+    //
+    // Below MIN_AVAILABLE_PAGES, only page faults may take an available page
+    //
+
+    if (availablePageCount < MIN_AVAILABLE_PAGES) {
+
+        releaseJLock(&(pageToTrade->lockBits));
+        PRINT ("[tradeTransitionPage] Too few available pages to trade\n");
+
+        return FALSE;
+    }
+
     // dequeue from current list
     dequeueSpecificPage(pageToTrade);
 
@@ -181,6 +207,9 @@ tradeTransitionPage(ULONG_PTR PFNtoTrade)
 
     acquireJLock(&newPage->lockBits);
 
+    // carry over the VAD before the replacement page is enqueued (standby pages are routed by it)
+    getPFNextension(newPage)->VAD = getPFNextension(pageToTrade)->VAD;
+
     // enqueue replacement page onto list
     enqueuePage(&listHeads[currStatus], newPage);
 
@@ -194,7 +223,7 @@ tradeTransitionPage(ULONG_PTR PFNtoTrade)
     PTEindex = currPTE - PTEarray;
     newPage->PTEindex = PTEindex;
 
-    newPage->pageFileOffset = pageToTrade->pageFileOffset;
+    getPFNextension(newPage)->pageFileOffset = getPFNextension(pageToTrade)->pageFileOffset;
     newPage->refCount = pageToTrade->refCount;         
 
     releaseJLock(&newPage->lockBits);
@@ -225,7 +254,7 @@ tradeVA(PVOID virtualAddress)
     currPTE = getPTE(virtualAddress);
 
     if (currPTE == NULL) {
-        PRINT_ERROR("No PTE associated with VA %llu\n", (ULONG_PTR) virtualAddress);
+        PRINT("No PTE associated with VA %llu\n", (ULONG_PTR) virtualAddress);
         return FALSE;
     }
 
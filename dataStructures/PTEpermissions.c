@@ -1,8 +1,11 @@
 #include "../usermodeMemoryManager.h"
 #include "../coreFunctions/pageFile.h"
 #include "../infrastructure/jLock.h"
+#include "../infrastructure/physicalPages.h"
 #include "../infrastructure/enqueue-dequeue.h"
 #include "PTEpermissions.h"
+#include "pageDirectory.h"
+#include "VADNodes.h"
 
 
 //
@@ -80,15 +83,17 @@ logEntry(PPTE dest, PTE oldValue, PTE newValue, PPFNdata currPage)
 VOID
 writePTE(PPTE dest, PTE value)
 {
+
+    volatile ULONG64* sequence;
+    ULONG_PTR PTEindex;
+    LONG64 idleBit;
+
+    PTEindex = dest - PTEarray;
     
     #ifdef PTE_CHANGE_LOG
 
         PPFNdata currPage;
 
-        ULONG_PTR PTEindex;
-
-        PTEindex = dest - PTEarray;
-
         if (value.u1.hPTE.validBit == 1) {
 
             currPage = PFNarray + value.u1.hPTE.PFN;
@@ -136,13 +141,125 @@ writePTE(PPTE dest, PTE value)
 
     #endif
 
+    //
+    // A PTE becoming valid, or having its aging bit cleared, means the page was
+    // accessed - it is no longer idle
+    //
+
+    if (value.u1.hPTE.validBit == 1 && value.u1.hPTE.agingBit == 0 &&
+        (dest->u1.hPTE.validBit == 0 || dest->u1.hPTE.agingBit == 1)) {
+
+        idleBit = (LONG64) 1 << (PTEindex & 63);
+
+        if ( (PTEidleBitmap[PTEindex >> 6] & idleBit) != 0) {
+
+            InterlockedAnd64(&PTEidleBitmap[PTEindex >> 6], ~idleBit);
+
+        }
+
+    }
+
+    //
+    // Account PTEs becoming valid/invalid to their VAD's working set (recorded
+    // in the page's PFN)
+    //
+
+    if (value.u1.hPTE.validBit == 1 && dest->u1.hPTE.validBit == 0) {
+
+        updateVADResidentPages(getPFNextension(PFNarray + value.u1.hPTE.PFN)->VAD, 1);
+
+    }
+    else if (value.u1.hPTE.validBit == 0 && dest->u1.hPTE.validBit == 1) {
+
+        updateVADResidentPages(getPFNextension(PFNarray + dest->u1.hPTE.PFN)->VAD, -1);
+
+    }
+
+    //
+    // Bump the lock group's sequence counter around the store so lock-free
+    // readers (see accessVA) can detect the change
+    //
+
+    sequence = &PTESequenceArray[getLockIndex(dest)];
+
+    InterlockedIncrement64((volatile LONG64*) sequence);
+
     * (volatile PTE *) dest = value;
+
+    InterlockedIncrement64((volatile LONG64*) sequence);
     
 }
 
 
-BOOLEAN
-trimPTE(PPTE PTEaddress) 
+static VOID
+signalModifiedWriter()
+{
+
+    BOOL bRes;
+
+    bRes = SetEvent(wakeModifiedWriterHandle);
+
+    if (bRes != TRUE) {
+
+        PRINT_ERROR("[trimPTE] failed to set event\n");
+
+    }
+
+    ResetEvent(wakeModifiedWriterHandle);
+
+}
+
+
+static BOOLEAN
+trimInProgressPFN(PPFNdata PFNtoTrim, ULONG64 dirtyBit)
+{
+
+    PFNstate oldState;
+    PFNstate newState;
+
+    while (TRUE) {
+
+        oldState = readPFNstate(PFNtoTrim);
+
+        //
+        // The PFN lock is taken instead if it is held, or once the write/read
+        // has completed (the page is then enqueued by the trimmer)
+        //
+
+        if (oldState.lockBit == 1 || (oldState.writeInProgressBit == 0 && oldState.refCount == 0)) {
+
+            return FALSE;
+
+        }
+
+        newState = oldState;
+
+        if (dirtyBit == 0) {
+
+            newState.statusBits = STANDBY;
+
+        }
+        else {
+
+            newState.remodifiedBit = 1;
+
+            newState.statusBits = MODIFIED;
+
+        }
+
+        if (compareExchangePFNstate(PFNtoTrim, oldState, newState) == TRUE) {
+
+            return TRUE;
+
+        }
+
+    }
+
+}
+
+
+static BOOLEAN
+trimPTEInternal(PPTE PTEaddress, PtrimBatch batch) 
 {
 
     BOOLEAN wakeModifiedWriter;
@@ -151,6 +268,8 @@ trimPTE(PPTE PTEaddress)
     PPFNdata PFNtoTrim;
     PVOID currVA;
     PTE newPTE;
+    BOOLEAN batched;
+    PFNstate snapState;
 
     if (PTEaddress == NULL) {
 
@@ -162,6 +281,8 @@ trimPTE(PPTE PTEaddress)
 
     wakeModifiedWriter = FALSE;
 
+    batched = FALSE;
+
     //
     // Acquire PTE lock - although it may also be acquired in trimming function in 
     // main, the recursive nature of underlying CRITICAL_SECTION locking functionality
@@ -193,18 +314,63 @@ trimPTE(PPTE PTEaddress)
     ASSERT(PFNtoTrim->statusBits == ACTIVE);
 
     //
-    // Initialize new PTE to zero
+    // Initialize new PTE to zero, then set transitionBit to 1 and assign 
+    // PFN and permissions
     //
 
     newPTE.u1.ulongPTE = 0;
 
+    newPTE.u1.tPTE.transitionBit = 1;  
+
+    newPTE.u1.tPTE.PFN = pageNum;
+
+    newPTE.u1.tPTE.permissions = getPTEpermissions(oldPTE);
+
     currVA = (PVOID) ( (ULONG_PTR) leafVABlock + (PTEaddress - PTEarray) *PAGE_SIZE );
     
     //
-    // Unmap page from VA (invalidates hardwarePTE)
+    // Unmap page from VA (invalidates hardwarePTE) - batched trims defer this
+    // to the batch flush, which still precedes the PTE lock release (so any
+    // fault on the VA waits for it)
     //
 
-    MapUserPhysicalPages(currVA, 1, NULL);
+    if (batch == NULL) {
+
+        unmapPhysicalPages(currVA, 1);
+
+    }
+
+    //
+    // A page with a write or read in progress is enqueued by its completion, so
+    // trimming it only changes the PFN state word - done with a CAS rather than
+    // the PFN lock. The completion may reuse the page as soon as the CAS lands, 
+    // so the page is unmapped and its PTE written beforehand (outside of any 
+    // batch - if the CAS does not land, the page is trimmed on its own)
+    //
+
+    snapState = readPFNstate(PFNtoTrim);
+
+    if (snapState.writeInProgressBit == 1 || snapState.refCount != 0) {
+
+        if (batch != NULL) {
+
+            unmapPhysicalPages(currVA, 1);
+
+            batch = NULL;
+
+        }
+
+        writePTE(PTEaddress, newPTE);
+
+        if (trimInProgressPFN(PFNtoTrim, oldPTE.u1.hPTE.dirtyBit) == TRUE) {
+
+            releasePTELock(PTEaddress);
+
+            return TRUE;
+
+        }
+
+    }
 
     //
     // Acquire page lock (prior to viewing/editing PFN fields)
@@ -260,21 +426,42 @@ trimPTE(PPTE PTEaddress)
         if (oldPTE.u1.hPTE.dirtyBit == 0 && PFNtoTrim->remodifiedBit == 0) {
 
             //
-            // Add given VA's page to standby list
+            // Add given VA's page to standby list (or to the batch, still locked)
             //
 
-            enqueuePage(&standbyListHead, PFNtoTrim);
+            if (batch != NULL) {
+
+                if (batch->numStandby == PAGE_LIST_BATCH_SIZE) {
+
+                    flushTrimBatch(batch);
+
+                }
+
+                batch->unmapVAs[batch->numStandby + batch->numModified] = currVA;
+
+                batch->standbyPages[batch->numStandby] = PFNtoTrim;
+
+                batch->numStandby++;
+
+                batched = TRUE;
+
+            }
+            else {
+
+                enqueuePage(&standbyListHead, PFNtoTrim);
+
+            }
 
         } 
         else {
 
-            if (PFNtoTrim->pageFileOffset != INVALID_BITARRAY_INDEX) {
+            if (getPFNextension(PFNtoTrim)->pageFileOffset != INVALID_BITARRAY_INDEX) {
 
                 ASSERT(PFNtoTrim->remodifiedBit == 1);
 
-                clearPFBitIndex(PFNtoTrim->pageFileOffset);
+                clearPFBitIndex(getPFNextension(PFNtoTrim)->pageFileOffset);
 
-                PFNtoTrim->pageFileOffset = INVALID_BITARRAY_INDEX;
+                getPFNextension(PFNtoTrim)->pageFileOffset = INVALID_BITARRAY_INDEX;
                 
             }
 
@@ -286,52 +473,136 @@ trimPTE(PPTE PTEaddress)
             PFNtoTrim->remodifiedBit = 0;
 
             //
-            // Add given VA's page to modified list
+            // Add given VA's page to modified list (or to the batch, still locked)
             //
 
-            wakeModifiedWriter = enqueuePage(&modifiedListHead, PFNtoTrim);
+            if (batch != NULL) {
+
+                if (batch->numModified == PAGE_LIST_BATCH_SIZE) {
+
+                    flushTrimBatch(batch);
+
+                }
+
+                batch->unmapVAs[batch->numStandby + batch->numModified] = currVA;
+
+                batch->modifiedPages[batch->numModified] = PFNtoTrim;
+
+                batch->numModified++;
+
+                batched = TRUE;
+
+            }
+            else {
+
+                wakeModifiedWriter = enqueuePage(&modifiedListHead, PFNtoTrim);
+
+            }
 
         }
     }
 
     //
-    // Set PTE transitionBit to 1, assign PFN and permissions,
-    // and write out
+    // A page left to the modified writer (write or read still in progress) may be
+    // reused as soon as its lock is released, so it cannot wait for the batch unmap
     //
 
-    newPTE.u1.tPTE.transitionBit = 1;  
+    if (batch != NULL && batched == FALSE) {
 
-    newPTE.u1.tPTE.PFN = pageNum;
+        unmapPhysicalPages(currVA, 1);
 
-    newPTE.u1.tPTE.permissions = getPTEpermissions(oldPTE);
+    }
+
+    //
+    // Write out transition PTE
+    //
 
     writePTE(PTEaddress, newPTE);
 
     //
-    // Release PFN and PTE lock in order of acquisition
+    // Release PFN and PTE lock in order of acquisition (a batched page stays
+    // locked until its batch is flushed)
     //
 
-    releaseJLock(&PFNtoTrim->lockBits);
+    if (batched == FALSE) {
+
+        releaseJLock(&PFNtoTrim->lockBits);
+
+    }
 
     releasePTELock(PTEaddress);
 
     if (wakeModifiedWriter == TRUE) {
 
-        BOOL bRes;
+        signalModifiedWriter();
 
-        bRes = SetEvent(wakeModifiedWriterHandle);
+    }
 
-        if (bRes != TRUE) {
+    return TRUE;
+
+}
 
-            PRINT_ERROR("[trimPTE] failed to set event\n");
 
-        }
+BOOLEAN
+trimPTE(PPTE PTEaddress)
+{
+
+    return trimPTEInternal(PTEaddress, NULL);
+
+}
 
-        ResetEvent(wakeModifiedWriterHandle);
+
+BOOLEAN
+trimPTEToBatch(PPTE PTEaddress, PtrimBatch batch)
+{
+
+    return trimPTEInternal(PTEaddress, batch);
+
+}
+
+
+VOID
+flushTrimBatch(PtrimBatch batch)
+{
+
+    BOOLEAN wakeModifiedWriter;
+
+    //
+    // Unmap every batched page at once, before any of them can be reused
+    // off the standby/modified lists
+    //
+
+    if (batch->numStandby + batch->numModified != 0) {
+
+        unmapPhysicalPagesScatter(batch->unmapVAs, batch->numStandby + batch->numModified);
 
     }
 
-    return TRUE;
+    enqueuePages(&standbyListHead, batch->standbyPages, batch->numStandby);
+
+    wakeModifiedWriter = enqueuePages(&modifiedListHead, batch->modifiedPages, batch->numModified);
+
+    for (ULONG_PTR i = 0; i < batch->numStandby; i++) {
+
+        releaseJLock(&batch->standbyPages[i]->lockBits);
+
+    }
+
+    for (ULONG_PTR i = 0; i < batch->numModified; i++) {
+
+        releaseJLock(&batch->modifiedPages[i]->lockBits);
+
+    }
+
+    batch->numStandby = 0;
+
+    batch->numModified = 0;
+
+    if (wakeModifiedWriter == TRUE) {
+
+        signalModifiedWriter();
+
+    }
 
 }
 
@@ -340,38 +611,35 @@ PPTE
 getPTE(void* virtualAddress)
 {
 
-    ULONG_PTR offset;
-    ULONG_PTR pageTableIndex;
     PPTE currPTE;
+    PDE snapPDE;
 
     //
-    // Verify VA param is within the range of the VA block
+    // Get the PTE address (NULL if VA is outside of the VA block)
     //
 
-    if (virtualAddress < leafVABlock || virtualAddress >= leafVABlockEnd) {
+    currPTE = getPTEaddress(virtualAddress);
+
+    if (currPTE == NULL) {
 
-        PRINT("[getPTE] Not within allocated VA block \n");
         return NULL;
 
     }
 
     //
-    // Get VA's offset into the leafVABlock
+    // Walk the page directory - the PTE is only readable if its page table
+    // page has been committed (a trimmed page table page reads as zero PTEs 
+    // until faulted back in under the PTE lock)
     //
 
-    offset = (ULONG_PTR) virtualAddress - (ULONG_PTR) leafVABlock;
+    snapPDE = * (volatile PDE *) getPDE(currPTE);
 
-    //
-    // Convert offset to pagetable index, dividing offset by PAGE_SIZE
-    //
-
-    pageTableIndex = offset >> PAGE_SHIFT;
+    if (snapPDE.u1.hPDE.committedBit == 0) {
 
-    //
-    // Get the corresponding page table entry from the PTE array
-    //
+        PRINT("[getPTE] page table page not committed \n");
+        return NULL;
 
-    currPTE = PTEarray + pageTableIndex;
+    }
 
     return currPTE;
 
@@ -416,6 +684,53 @@ getPTEpermissions(PTE curr)
 }
 
 
+PTEpermissions
+getMappedPermissions(PTE curr)
+{
+
+    PTEpermissions RWEpermissions;
+
+    RWEpermissions = getPTEpermissions(curr);
+
+    #ifdef TRANSPARENT_FAULTS
+
+        //
+        // Aged pages are mapped inaccessible so that the next access faults
+        // and clears the aging bit
+        //
+
+        if (curr.u1.hPTE.agingBit == 1) {
+
+            return NO_ACCESS;
+
+        }
+
+        //
+        // Clean pages are mapped without write access so that the first
+        // write faults and sets the dirty bit
+        //
+
+        if (curr.u1.hPTE.dirtyBit == 0) {
+
+            if (RWEpermissions == READ_WRITE) {
+
+                return READ_ONLY;
+
+            } else if (RWEpermissions == READ_WRITE_EXECUTE) {
+
+                return READ_EXECUTE;
+
+            }
+
+        }
+
+    #endif
+
+    return RWEpermissions;
+
+}
+
+
 VOID
 transferPTEpermissions(PPTE activeDest, PTEpermissions sourceP)
 {
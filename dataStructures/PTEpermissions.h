@@ -52,6 +52,7 @@ logEntry(PPTE dest, PTE oldValue, PTE newValue, PPFNdata currPage);
  * writePTE: function to write PTE value to destination PTE pointer
  *  - if PTE_CHANGE_LOG is defined, also logs data to PTEHistoryLog
  *    for debugging purposes
+ *  - bumps the PTE's lock group sequence counter before and after the store
  * 
  * No return value 
  */
@@ -71,12 +72,56 @@ BOOLEAN
 trimPTE(PPTE PTEaddress);
 
 
+//
+// trimBatch - pages trimmed under a single PTE lock hold, kept locked (off every
+// list, with their PTEs already in transition) until flushTrimBatch unmaps them
+// in a single scatter call and enqueues them to standby/modified a list lock
+// acquisition at a time
+//
+
+typedef struct _trimBatch {
+    ULONG_PTR numStandby;
+    ULONG_PTR numModified;
+    PPFNdata standbyPages[PAGE_LIST_BATCH_SIZE];
+    PPFNdata modifiedPages[PAGE_LIST_BATCH_SIZE];
+    PVOID unmapVAs[2 * PAGE_LIST_BATCH_SIZE];           // VAs of batched pages, still mapped until the flush
+} trimBatch, *PtrimBatch;
+
+
+/*
+ * trimPTEToBatch: function to trim a PTE from active->transition, deferring the
+ * page's unmap and list insertion to the given batch
+ *  - same as trimPTE, but pages bound for standby/modified stay locked (and
+ *    mapped) in the batch
+ *  - a full batch is flushed first
+ *  - caller MUST hold the PTE lock, and flush the batch before releasing it
+ *
+ * Returns BOOLEAN:
+ *  - TRUE if success
+ *  - FALSE if failure
+ */
+BOOLEAN
+trimPTEToBatch(PPTE PTEaddress, PtrimBatch batch);
+
+
+/*
+ * flushTrimBatch: function to unmap a trim batch and enqueue it to the standby/modified lists
+ *  - one unmapPhysicalPagesScatter call, then one enqueuePages call per list,
+ *    then releases the batched page locks
+ *  - wakes the modified writer if the modified list has grown past its threshold
+ *
+ * No return value
+ */
+VOID
+flushTrimBatch(PtrimBatch batch);
+
+
 /*
  * getPTE: function to find corresponding PTE from a given VA
  * 
  * Returns PPTE
  *  - currPTE (corresponding PTE) on success
- *  - NULL on failure (access violation, VA outside of range)
+ *  - NULL on failure (access violation, VA outside of range or page table page not committed)
  */
 PPTE
 getPTE(void* virtualAddress);
@@ -93,6 +138,20 @@ PTEpermissions
 getPTEpermissions(PTE curr);
 
 
+/*
+ * getMappedPermissions: function to get the permissions a VALID PTE's page is actually mapped with
+ *  - matches getPTEpermissions unless TRANSPARENT_FAULTS is defined, in which case clean pages
+ *    are mapped without write access and aged pages without any access, so that the next
+ *    write/access faults and lets the fault handler maintain the dirty/aging bits
+ * 
+ * Returns PTEpermissions
+ *  - PTEpermissions enum on success (must be a valid PTE input)
+ *  - NO_ACCESS on failure
+ */
+PTEpermissions
+getMappedPermissions(PTE curr);
+
+
 /*
  * transferPTEpermissions: function to convert input PTEpermissions into destionation (valid) PTE separate bits
  * 
@@ -0,0 +1,220 @@
+#include "../usermodeMemoryManager.h"
+#include "PTEscan.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+
+ULONG64
+scanPTEs(PPTE startPTE, ULONG_PTR numPTEs, PULONG64 referencedBitmap)
+{
+
+    ULONG64 validBitmap;
+    ULONG64 agedBitmap;
+    ULONG_PTR i;
+
+    ASSERT(numPTEs <= PTE_SCAN_MAX);
+
+    validBitmap = 0;
+
+    agedBitmap = 0;
+
+    i = 0;
+
+    #if defined(__AVX512F__)
+
+        __m512i validMask;
+        __m512i agingMask;
+
+        validMask = _mm512_set1_epi64(PTE_VALID_MASK);
+
+        agingMask = _mm512_set1_epi64(PTE_AGING_MASK);
+
+        for (; i + 8 <= numPTEs; i += 8) {
+
+            __m512i PTEs;
+
+            PTEs = _mm512_loadu_si512( (void*) (startPTE + i) );
+
+            validBitmap |= (ULONG64) _mm512_test_epi64_mask(PTEs, validMask) << i;
+
+            agedBitmap |= (ULONG64) _mm512_test_epi64_mask(PTEs, agingMask) << i;
+
+        }
+
+    #elif defined(__AVX2__)
+
+        __m256i validMask;
+        __m256i agingMask;
+
+        validMask = _mm256_set1_epi64x(PTE_VALID_MASK);
+
+        agingMask = _mm256_set1_epi64x(PTE_AGING_MASK);
+
+        for (; i + 4 <= numPTEs; i += 4) {
+
+            __m256i PTEs;
+            __m256i isValid;
+            __m256i isAged;
+
+            PTEs = _mm256_loadu_si256( (__m256i*) (startPTE + i) );
+
+            isValid = _mm256_cmpeq_epi64(_mm256_and_si256(PTEs, validMask), validMask);
+
+            isAged = _mm256_cmpeq_epi64(_mm256_and_si256(PTEs, agingMask), agingMask);
+
+            validBitmap |= (ULONG64) _mm256_movemask_pd(_mm256_castsi256_pd(isValid)) << i;
+
+            agedBitmap |= (ULONG64) _mm256_movemask_pd(_mm256_castsi256_pd(isAged)) << i;
+
+        }
+
+    #elif defined(__SSE2__) || defined(_M_X64)
+
+        __m128i validMask;
+        __m128i agingMask;
+
+        //
+        // SSE2 has no 64-bit compare - both bits sit in the low dword of each
+        // PTE, so compare dwords and keep the low dword's result of each lane
+        //
+
+        validMask = _mm_set1_epi64x(PTE_VALID_MASK);
+
+        agingMask = _mm_set1_epi64x(PTE_AGING_MASK);
+
+        for (; i + 2 <= numPTEs; i += 2) {
+
+            __m128i PTEs;
+            int isValid;
+            int isAged;
+
+            PTEs = _mm_loadu_si128( (__m128i*) (startPTE + i) );
+
+            isValid = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(PTEs, validMask), validMask)));
+
+            isAged = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(PTEs, agingMask), agingMask)));
+
+            validBitmap |= (ULONG64) ( (isValid & 1) | ( (isValid >> 1) & 2) ) << i;
+
+            agedBitmap |= (ULONG64) ( (isAged & 1) | ( (isAged >> 1) & 2) ) << i;
+
+        }
+
+    #endif
+
+    //
+    // Scalar fallback (and the tail of a vectorized scan)
+    //
+
+    for (; i < numPTEs; i++) {
+
+        if ( (startPTE[i].u1.ulongPTE & PTE_VALID_MASK) != 0) {
+
+            validBitmap |= (ULONG64) 1 << i;
+
+        }
+
+        if ( (startPTE[i].u1.ulongPTE & PTE_AGING_MASK) != 0) {
+
+            agedBitmap |= (ULONG64) 1 << i;
+
+        }
+
+    }
+
+    *referencedBitmap = validBitmap & ~agedBitmap;
+
+    return validBitmap;
+
+}
+
+
+VOID
+setPTEAgingBits(PPTE startPTE, ULONG64 bitmap)
+{
+
+    ULONG_PTR i;
+
+    i = 0;
+
+    #if defined(__AVX512F__)
+
+        __m512i agingMask;
+
+        agingMask = _mm512_set1_epi64(PTE_AGING_MASK);
+
+        for (; i + 8 <= PTE_SCAN_MAX && (bitmap >> i) != 0; i += 8) {
+
+            __mmask8 laneMask;
+            __m512i PTEs;
+
+            laneMask = (__mmask8) (bitmap >> i);
+
+            if (laneMask == 0) {
+
+                continue;
+
+            }
+
+            //
+            // Masked load and store, so PTEs outside the bitmap (which may lie
+            // past the end of the run) are never touched
+            //
+
+            PTEs = _mm512_maskz_loadu_epi64(laneMask, (void*) (startPTE + i) );
+
+            _mm512_mask_storeu_epi64( (void*) (startPTE + i), laneMask, _mm512_or_si512(PTEs, agingMask));
+
+        }
+
+    #elif defined(__AVX2__)
+
+        __m256i agingMask;
+
+        agingMask = _mm256_set1_epi64x(PTE_AGING_MASK);
+
+        for (; i + 4 <= PTE_SCAN_MAX && (bitmap >> i) != 0; i += 4) {
+
+            ULONG64 laneBits;
+            __m256i laneMask;
+
+            laneBits = (bitmap >> i) & 0xF;
+
+            if (laneBits == 0) {
+
+                continue;
+
+            }
+
+            //
+            // Masked load and store, so PTEs outside the bitmap (which may lie
+            // past the end of the run) are never touched
+            //
+
+            laneMask = _mm256_set_epi64x( - (LONG64) ( (laneBits >> 3) & 1), - (LONG64) ( (laneBits >> 2) & 1),
+                                          - (LONG64) ( (laneBits >> 1) & 1), - (LONG64) (laneBits & 1));
+
+            _mm256_maskstore_epi64( (long long*) (startPTE + i), laneMask,
+                                    _mm256_or_si256(_mm256_maskload_epi64( (long long*) (startPTE + i), laneMask), agingMask));
+
+        }
+
+    #endif
+
+    for (; i < PTE_SCAN_MAX && (bitmap >> i) != 0; i++) {
+
+        if ( ( (bitmap >> i) & 1) != 0) {
+
+            ASSERT(startPTE[i].u1.hPTE.validBit == 1);
+
+            startPTE[i].u1.hPTE.agingBit = 1;
+
+        }
+
+    }
+
+}
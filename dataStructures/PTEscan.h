@@ -0,0 +1,49 @@
+#ifndef PTESCAN_H
+#define PTESCAN_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * PTE scanner - harvests valid/aging bits a run of PTEs at a time for the
+ * trimming clock:
+ *  - AVX-512 (8 PTEs per instruction) or AVX2 (4 PTEs per instruction) when
+ *    the build targets them, SSE2 (2 PTEs) on any other x64 build, and a
+ *    scalar loop elsewhere
+ *  - bitmaps hold one bit per PTE, bit i for startPTE + i
+ *  - caller MUST hold the PTE lock of every PTE scanned or written
+ */
+
+#define PTE_SCAN_MAX 64                         // PTEs per scan (bits per bitmap)
+
+//
+// hPTE bit positions (bitfields are allocated from the least significant bit)
+//
+
+#define PTE_VALID_MASK ( (ULONG64) 1 << 0)
+
+#define PTE_AGING_MASK ( (ULONG64) 1 << 4)
+
+
+/*
+ * scanPTEs: function to find the valid and referenced PTEs of a run of up to PTE_SCAN_MAX PTEs
+ *  - a referenced PTE is a valid PTE with a clear aging bit (touched since the
+ *    trimming clock last aged it)
+ *
+ * Returns ULONG64:
+ *  - bitmap of valid PTEs (referenced PTEs are written to referencedBitmap)
+ */
+ULONG64
+scanPTEs(PPTE startPTE, ULONG_PTR numPTEs, PULONG64 referencedBitmap);
+
+
+/*
+ * setPTEAgingBits: function to set the aging bit of every PTE in bitmap at once
+ *  - bitmap PTEs must be valid
+ *
+ * No return value
+ */
+VOID
+setPTEAgingBits(PPTE startPTE, ULONG64 bitmap);
+
+
+#endif
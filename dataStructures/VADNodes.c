@@ -4,6 +4,12 @@
 #include "VADNodes.h"
 #include "PTEpermissions.h"
 #include "VApermissions.h"
+#include "pageDirectory.h"
+
+
+volatile LONG workingSetTrimPending;
+
+static ULONG64 totalWorkingSetMin;              // sum of VAD working-set minimums (VAD "write" lock)
 
 
 PVADNode
@@ -14,7 +20,7 @@ getVAD(void* virtualAddress)
     PPTE currPTE;
     PLIST_ENTRY currLinks;
 
-    currPTE = getPTE(virtualAddress);
+    currPTE = getPTEaddress(virtualAddress);
 
     for (currLinks = VADListHead.head.Flink; currLinks != &VADListHead.head; currLinks = currVAD->links.Flink) {
         
@@ -27,7 +33,7 @@ getVAD(void* virtualAddress)
 
         ASSERT(currVAD->numPages != 0);
 
-        currStartPTE = getPTE(currVAD->startVA);
+        currStartPTE = getPTEaddress(currVAD->startVA);
 
         //
         // Derive inclusive endPTE from starting PTE as well
@@ -81,9 +87,19 @@ checkVADRange(void* startVA, ULONG_PTR size)
 
     endVAInclusive = (PVOID) ( (ULONG_PTR) startVA + size - 1);
     
-    startPTE = getPTE(startVA);
+    startPTE = getPTEaddress(startVA);
+
+    endPTE = getPTEaddress(endVAInclusive);
+
+    //
+    // Flunk ranges that fall outside of the VA block entirely
+    //
+
+    if (startPTE == NULL || endPTE == NULL) {
+
+        return FALSE;
 
-    endPTE = getPTE(endVAInclusive);
+    }
 
     for (currLinks = VADListHead.head.Flink; currLinks != &VADListHead.head; currLinks = currVAD->links.Flink) {
 
@@ -95,7 +111,7 @@ checkVADRange(void* startVA, ULONG_PTR size)
         // Derive starting and ending PTEs within current VAD itself
         //
 
-        VADStartPTE = getPTE(currVAD->startVA);
+        VADStartPTE = getPTEaddress(currVAD->startVA);
 
         //
         // -1 for inclusivity check
@@ -124,7 +140,7 @@ checkVADRange(void* startVA, ULONG_PTR size)
 
 
 PVADNode
-createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN isMemCommit)
+createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN isMemCommit, ULONG standbyPriority)
 {
 
     PVADNode newNode;
@@ -147,6 +163,13 @@ createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN
 
     }
 
+    if (standbyPriority >= NUM_STANDBY_PRIORITIES) {
+
+        PRINT_ERROR("[commitVAD] invalid standby priority\n");
+        return NULL;
+
+    }
+
     newNode = malloc( sizeof(VADNode) );
 
     if (newNode == NULL) {
@@ -284,9 +307,9 @@ createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN
 
     endVA = (PVOID) ( (ULONG_PTR) startVA + ( numPages << PAGE_SHIFT) - 1 );
 
-    startPTE = getPTE(startVA);
+    startPTE = getPTEaddress(startVA);
 
-    endPTE = getPTE(endVA);
+    endPTE = getPTEaddress(endVA);
 
     //
     // Calculate number of pages (NOT zero-indexed) "covered" by VAD
@@ -314,6 +337,61 @@ createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN
 
     newNode->deleteBit = 0;
 
+    newNode->standbyPriority = standbyPriority;
+
+    //
+    // No working-set minimum, and a maximum the VAD can never exceed
+    //
+
+    newNode->workingSetMin = 0;
+
+    newNode->workingSetMax = numVADPages;
+
+    newNode->workingSetTarget = numVADPages;
+
+    newNode->residentPages = 0;
+
+    newNode->faultCount = 0;
+
+    newNode->lastFaultCount = 0;
+
+    newNode->readAheadPages = READ_AHEAD_INITIAL;
+
+    newNode->readAheadIssued = 0;
+
+    newNode->readAheadHits = 0;
+
+    //
+    // Commit the page table pages spanning the VAD before it becomes visible,
+    // so that any VA within a VAD always has a readable PTE
+    //
+
+    if (commitPageTables(startVA, numVADPages) == FALSE) {
+
+        LeaveCriticalSection(&VADWriteLock);
+
+        LeaveCriticalSection(&VADListHead.lock);
+
+        free(newNode);
+
+        if (isMemCommit) {
+
+            decommitPages(numPages);
+
+        }
+
+        //
+        // Release the VA range reserved in the VAD bitarray
+        //
+
+        setBitRange(FALSE, ( (ULONG_PTR) startVA - (ULONG_PTR) leafVABlock ) >> PAGE_SHIFT, numPages, VADBitArray);
+
+        PRINT("[commitVAD] Unable to create new VAD node (could not commit page table)\n");
+
+        return NULL;
+
+    }
+
     //
     // Enqueue new VAD into VAD node list
     //
@@ -334,6 +412,343 @@ createVAD(void* startVA, ULONG_PTR numPages, PTEpermissions permissions, BOOLEAN
 }
 
 
+BOOLEAN
+setVADWorkingSetLimits(void* VA, ULONG_PTR minPages, ULONG_PTR maxPages)
+{
+
+    PVADNode currVAD;
+
+    if (minPages > maxPages || maxPages == 0) {
+
+        PRINT("[setVADWorkingSetLimits] invalid working set limits\n");
+        return FALSE;
+
+    }
+
+    //
+    // Acquire both VAD locks in order to modify a VAD
+    // (Read lock first, then write lock) 
+    //
+
+    EnterCriticalSection(&VADListHead.lock);
+
+    EnterCriticalSection(&VADWriteLock);
+
+    currVAD = getVAD(VA);
+
+    if (currVAD == NULL || currVAD->deleteBit == 1 || minPages > currVAD->numPages) {
+
+        LeaveCriticalSection(&VADWriteLock);
+
+        LeaveCriticalSection(&VADListHead.lock);
+
+        PRINT("[setVADWorkingSetLimits] Provided VA does not correspond to any VAD or limits exceed it\n");
+
+        return FALSE;
+
+    }
+
+    //
+    // Minimums are guaranteed, so together they must leave the trimmer enough
+    // pages to reclaim from
+    //
+
+    if (totalWorkingSetMin - currVAD->workingSetMin + minPages > numPagesReturned / 2) {
+
+        LeaveCriticalSection(&VADWriteLock);
+
+        LeaveCriticalSection(&VADListHead.lock);
+
+        PRINT("[setVADWorkingSetLimits] Insufficient pages for working set minimum\n");
+
+        return FALSE;
+
+    }
+
+    totalWorkingSetMin = totalWorkingSetMin - currVAD->workingSetMin + minPages;
+
+    currVAD->workingSetMin = minPages;
+
+    currVAD->workingSetMax = maxPages;
+
+    if (currVAD->workingSetTarget > maxPages) {
+
+        currVAD->workingSetTarget = maxPages;
+
+    }
+    else if (currVAD->workingSetTarget < minPages) {
+
+        currVAD->workingSetTarget = minPages;
+
+    }
+
+    if ( (ULONG64) currVAD->residentPages > currVAD->workingSetTarget) {
+
+        InterlockedExchange(&workingSetTrimPending, TRIM_ALL_PARTITIONS);
+
+        SetEvent(wakeTrimHandle);
+
+    }
+
+    LeaveCriticalSection(&VADWriteLock);
+
+    LeaveCriticalSection(&VADListHead.lock);
+
+    return TRUE;
+
+}
+
+
+PVADNode
+getValidPTEVAD(PPTE currPTE)
+{
+
+    PTE snapPTE;
+
+    snapPTE = *currPTE;
+
+    ASSERT(snapPTE.u1.hPTE.validBit == 1);
+
+    return getPFNextension(PFNarray + snapPTE.u1.hPTE.PFN)->VAD;
+
+}
+
+
+VOID
+updateVADResidentPages(PVADNode currVAD, LONG64 delta)
+{
+
+    LONG64 residentPages;
+
+    ASSERT(currVAD != NULL);
+
+    residentPages = InterlockedAdd64(&currVAD->residentPages, delta);
+
+    ASSERT(residentPages >= 0);
+
+    //
+    // Only a VAD growing past its target needs the trimmer's attention
+    //
+
+    if (delta > 0 && (ULONG64) residentPages > currVAD->workingSetTarget && workingSetTrimPending == 0) {
+
+        InterlockedExchange(&workingSetTrimPending, TRIM_ALL_PARTITIONS);
+
+        SetEvent(wakeTrimHandle);
+
+    }
+
+}
+
+
+VOID
+recordVADFault(PVADNode currVAD)
+{
+
+    InterlockedIncrement64(&currVAD->faultCount);
+
+}
+
+
+ULONG_PTR
+getVADReadAheadPages(PVADNode currVAD)
+{
+
+    return currVAD->readAheadPages;
+
+}
+
+
+VOID
+recordVADReadAhead(PVADNode currVAD, ULONG_PTR numPages)
+{
+
+    LONG64 numIssued;
+    LONG64 numHits;
+
+    numIssued = InterlockedAdd64(&currVAD->readAheadIssued, (LONG64) numPages);
+
+    //
+    // Only the thread that resets the sample resizes the cluster
+    //
+
+    if (numIssued < READ_AHEAD_SAMPLE
+        || InterlockedCompareExchange64(&currVAD->readAheadIssued, 0, numIssued) != numIssued) {
+
+        return;
+
+    }
+
+    numHits = InterlockedExchange(&currVAD->readAheadHits, 0);
+
+    if (numHits * 4 >= numIssued * 3 && currVAD->readAheadPages < READ_AHEAD_MAX) {
+
+        currVAD->readAheadPages *= 2;
+
+    }
+    else if (numHits * 4 < numIssued && currVAD->readAheadPages > 1) {
+
+        currVAD->readAheadPages /= 2;
+
+    }
+
+}
+
+
+VOID
+recordVADReadAheadHit(PVADNode currVAD)
+{
+
+    InterlockedIncrement64(&currVAD->readAheadHits);
+
+}
+
+
+VOID
+adjustVADWorkingSetTargets()
+{
+
+    PLIST_ENTRY currLinks;
+    PVADNode currVAD;
+    ULONG64 numFaults;
+    ULONG64 target;
+    ULONG64 residentPages;
+    BOOLEAN overTarget;
+
+    overTarget = FALSE;
+
+    //
+    // Acquire both VAD locks, as targets are also written by setVADWorkingSetLimits
+    //
+
+    EnterCriticalSection(&VADListHead.lock);
+
+    EnterCriticalSection(&VADWriteLock);
+
+    for (currLinks = VADListHead.head.Flink; currLinks != &VADListHead.head; currLinks = currVAD->links.Flink) {
+
+        currVAD = CONTAINING_RECORD(currLinks, VADNode, links);
+
+        numFaults = currVAD->faultCount - currVAD->lastFaultCount;
+
+        currVAD->lastFaultCount += numFaults;
+
+        target = currVAD->workingSetTarget;
+
+        residentPages = currVAD->residentPages;
+
+        if ( (numFaults << PFF_HIGH_FAULT_SHIFT) > target) {
+
+            //
+            // Faulting hard (a phase change, or a working set that does not fit) -
+            // let the VAD keep what it faulted in
+            //
+
+            target += numFaults;
+
+            if (target > currVAD->workingSetMax) {
+
+                target = currVAD->workingSetMax;
+
+            }
+
+        }
+        else if ( (numFaults << PFF_LOW_FAULT_SHIFT) < target) {
+
+            //
+            // Rarely faulting - shrink from what is actually resident, so cold
+            // pages are trimmed off the VAD by the over-target sweep
+            //
+
+            if (residentPages < target) {
+
+                target = residentPages;
+
+            }
+
+            if (target > currVAD->workingSetMin) {
+
+                target -= (target - currVAD->workingSetMin) >> PFF_SHRINK_SHIFT;
+
+            }
+            else {
+
+                target = currVAD->workingSetMin;
+
+            }
+
+        }
+
+        currVAD->workingSetTarget = target;
+
+        if (residentPages > target) {
+
+            overTarget = TRUE;
+
+        }
+
+    }
+
+    LeaveCriticalSection(&VADWriteLock);
+
+    LeaveCriticalSection(&VADListHead.lock);
+
+    if (overTarget == TRUE) {
+
+        InterlockedExchange(&workingSetTrimPending, TRIM_ALL_PARTITIONS);
+
+    }
+
+}
+
+
+BOOLEAN
+setVADStandbyPriority(void* VA, ULONG standbyPriority)
+{
+
+    PVADNode currVAD;
+
+    if (standbyPriority >= NUM_STANDBY_PRIORITIES) {
+
+        PRINT("[setVADStandbyPriority] invalid standby priority\n");
+        return FALSE;
+
+    }
+
+    //
+    // Acquire both VAD locks in order to modify a VAD
+    // (Read lock first, then write lock) 
+    //
+
+    EnterCriticalSection(&VADListHead.lock);
+
+    EnterCriticalSection(&VADWriteLock);
+
+    currVAD = getVAD(VA);
+
+    if (currVAD == NULL || currVAD->deleteBit == 1) {
+
+        LeaveCriticalSection(&VADWriteLock);
+
+        LeaveCriticalSection(&VADListHead.lock);
+
+        PRINT("[setVADStandbyPriority] Provided VA does not correspond to any VAD or is being deleted\n");
+
+        return FALSE;
+
+    }
+
+    currVAD->standbyPriority = standbyPriority;
+
+    LeaveCriticalSection(&VADWriteLock);
+
+    LeaveCriticalSection(&VADListHead.lock);
+
+    return TRUE;
+
+}
+
+
 BOOLEAN
 deleteVAD(void* VA)
 {
@@ -411,7 +826,7 @@ deleteVAD(void* VA)
         // Once "read" lock is acquired, check PTEs to verify that all pages have been decommmitted
         //
 
-        numDecommitted = checkDecommitted(removeVAD, getPTE(removeVAD->startVA), getPTE((PVOID) ( (ULONG_PTR)removeVAD->startVA + (removeVAD->numPages << PAGE_SHIFT) - 1) ) );
+        numDecommitted = checkDecommitted(removeVAD, getPTE(removeVAD->startVA), getPTE((PVOID) ( (ULONG_PTR)removeVAD->startVA + (removeVAD->numPages << PAGE_SHIFT) - 1) ), FALSE);
 
         ASSERT(numDecommitted == removeVAD->numPages);
 
@@ -432,6 +847,10 @@ deleteVAD(void* VA)
 
     ASSERT(removeVAD->commitCount == 0);
 
+    ASSERT(removeVAD->residentPages == 0);
+
+    totalWorkingSetMin -= removeVAD->workingSetMin;
+
     //
     // Calculate starting bitindex to clear from PF bitarray and clear bit
     // range from the VAD bit array
@@ -504,7 +923,18 @@ checkVADCommit(PVADNode currVAD)
     // accurately as a parameter to checkDecommitted
     //
 
-    numDecommitted = checkDecommitted(currVAD, startPTE, endPTE);
+    numDecommitted = checkDecommitted(currVAD, startPTE, endPTE, TRUE);
+
+    //
+    // Callers hold PTE and page locks, so PTEs whose locks are held elsewhere (or
+    // whose page table page is not resident) cannot be checked
+    //
+
+    if (numDecommitted == MAXULONG_PTR) {
+
+        return;
+
+    }
 
     numCommitted = currVAD->numPages - numDecommitted;
 
@@ -9,12 +9,54 @@ typedef struct _VADNode {
     ULONG64 permissions: PERMISSIONS_BITS;
     ULONG64 commitBit: 1;
     ULONG64 deleteBit: 1;
+    ULONG64 standbyPriority: STANDBY_PRIORITY_BITS;     // standby list priority of the VAD's trimmed pages
     ULONG64 commitCount;
+    ULONG64 workingSetMin;                              // resident pages the trimmer never takes the VAD below
+    ULONG64 workingSetMax;                              // upper bound of the working-set target
+    ULONG64 workingSetTarget;                           // resident pages above which the VAD is trimmed first (PFF-adjusted)
+    volatile LONG64 residentPages;                      // valid PTEs in the VAD (maintained by writePTE)
+    volatile LONG64 faultCount;                         // faults that made a PTE of the VAD valid
+    LONG64 lastFaultCount;                              // faultCount at the last PFF adjustment
+    ULONG64 readAheadPages;                             // neighbouring pages read in with each pagefile fault
+    volatile LONG64 readAheadIssued;                    // pages read ahead since the last read-ahead adjustment
+    volatile LONG64 readAheadHits;                      // of which faulted in before being repurposed
     // ULONG64 refCount;
     HANDLE faultEvent;
 } VADNode, *PVADNode;
 
 
+extern volatile LONG workingSetTrimPending;     // bit per trimming partition, set when a VAD has grown above its working-set target
+
+#define TRIM_ALL_PARTITIONS ( (LONG) -1)
+
+
+//
+// Page fault frequency (PFF) - every PFF_INTERVAL_MS, each VAD's working-set
+// target grows by the pages it faulted in if they exceed 1/(1 << PFF_HIGH_FAULT_SHIFT)
+// of the target, and shrinks by 1/(1 << PFF_SHRINK_SHIFT) of its excess over the
+// minimum if they are below 1/(1 << PFF_LOW_FAULT_SHIFT)
+//
+
+#define PFF_INTERVAL_MS 100
+
+#define PFF_HIGH_FAULT_SHIFT 4
+
+#define PFF_LOW_FAULT_SHIFT 6
+
+#define PFF_SHRINK_SHIFT 3
+
+
+//
+// Pagefile read-ahead - every READ_AHEAD_SAMPLE pages read ahead for a VAD, its
+// read-ahead cluster doubles (up to READ_AHEAD_MAX) if at least 3/4 of them were
+// faulted in, and halves (down to a single page) if fewer than 1/4 were
+//
+
+#define READ_AHEAD_INITIAL 2
+
+#define READ_AHEAD_SAMPLE 32
+
+
 /*
  * getVAD: function to find and return VAD associated with a given virtual address
  *  - VAD list lock must be held prior to calling of function (responsibility of caller)
@@ -34,7 +76,7 @@ getVAD(void* virtualAddress);
  * 
  * Returns BOOLEAN
  *  - TRUE if no overlap (VAD can then be allocated by createVAD)
- *  - FALSE if overlap
+ *  - FALSE if overlap (or range not within the VA block)
  */
 BOOLEAN
 checkVADRange(void* startVA, ULONG_PTR size);
@@ -44,13 +86,125 @@ checkVADRange(void* startVA, ULONG_PTR size);
  * createVAD: function to create a new VAD
  *  - acquires "read" and "write" locks 
  *  - calls checkVAD range to verify that the range is clear
+ *  - standbyPriority (below NUM_STANDBY_PRIORITIES, higher survives longer) picks
+ *    the standby lists the VAD's trimmed pages are cached on
  * 
  * Returns PVADNode
  *  - New node if successful
  *  - NULL if unsuccessful
  */
 PVADNode
-createVAD(void* startVA, ULONG_PTR size, PTEpermissions permissions, BOOLEAN isMemCommit);
+createVAD(void* startVA, ULONG_PTR size, PTEpermissions permissions, BOOLEAN isMemCommit, ULONG standbyPriority);
+
+
+/*
+ * setVADWorkingSetLimits: function to set the working-set minimum/maximum of the VAD containing VA
+ *  - acquires "read" and "write" locks
+ *  - the trimmer never trims a VAD at or below its minimum, and trims VADs above
+ *    their working-set target (kept between the two by adjustVADWorkingSetTargets)
+ *    before aging anything else (new VADs have no minimum, and a maximum and
+ *    target of their size)
+ *  - the minimums of all VADs together may reserve at most half the physical pages
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if successful
+ *  - FALSE if VA is in no VAD (or is being deleted), or the limits are invalid
+ */
+BOOLEAN
+setVADWorkingSetLimits(void* VA, ULONG_PTR minPages, ULONG_PTR maxPages);
+
+
+/*
+ * getValidPTEVAD: function to find the VAD of a valid PTE without searching the VAD list
+ *  - read from the PTE's page, which records its VAD as it is faulted or read in
+ *  - PTE lock must be held (which keeps the VAD from being freed)
+ * 
+ * Returns PVADNode
+ *  - the PTE's VAD
+ */
+PVADNode
+getValidPTEVAD(PPTE currPTE);
+
+
+/*
+ * updateVADResidentPages: function to account a PTE becoming valid (delta 1) or
+ * invalid (delta -1) to the VAD's resident page count
+ *  - called by writePTE with the PTE lock held (which keeps the VAD from being freed)
+ *  - wakes the trimmer once the VAD grows above its working-set target
+ * 
+ * No return value
+ */
+VOID
+updateVADResidentPages(PVADNode currVAD, LONG64 delta);
+
+
+/*
+ * recordVADFault: function to count a page fault that made a PTE valid against its VAD
+ *  - called by pageFault with the PTE lock held
+ * 
+ * No return value
+ */
+VOID
+recordVADFault(PVADNode currVAD);
+
+
+/*
+ * getVADReadAheadPages: function to get the read-ahead cluster size of a VAD
+ *  - called by pageFault with the PTE lock held
+ * 
+ * Returns ULONG_PTR
+ *  - number of neighbouring pages to read ahead (at most READ_AHEAD_MAX)
+ */
+ULONG_PTR
+getVADReadAheadPages(PVADNode currVAD);
+
+
+/*
+ * recordVADReadAhead: function to count pages read ahead for a VAD
+ *  - called by pageFault with the PTE lock held
+ *  - resizes the VAD's read-ahead cluster every READ_AHEAD_SAMPLE pages (see READ_AHEAD_* above)
+ * 
+ * No return value
+ */
+VOID
+recordVADReadAhead(PVADNode currVAD, ULONG_PTR numPages);
+
+
+/*
+ * recordVADReadAheadHit: function to count a read-ahead page of a VAD faulted in
+ *  - called by pageFault with the PTE lock held
+ * 
+ * No return value
+ */
+VOID
+recordVADReadAheadHit(PVADNode currVAD);
+
+
+/*
+ * adjustVADWorkingSetTargets: function to resize every VAD's working-set target
+ * from its fault rate since the last call (see PFF_* above)
+ *  - acquires "read" and "write" locks
+ *  - called by the trimmer every PFF_INTERVAL_MS, and wakes it for any VAD
+ *    left above its new target
+ * 
+ * No return value
+ */
+VOID
+adjustVADWorkingSetTargets();
+
+
+/*
+ * setVADStandbyPriority: function to change the standby priority of the VAD containing VA
+ *  - acquires "read" and "write" locks
+ *  - pages already on standby stay on their current list, the new priority applies
+ *    from their next trim
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if successful
+ *  - FALSE if VA is in no VAD (or is being deleted), or the priority is invalid
+ */
+BOOLEAN
+setVADStandbyPriority(void* VA, ULONG standbyPriority);
 
 
 /*
@@ -71,6 +225,8 @@ deleteVAD(void* VA);
 /*
  * checkVADCommit: function to compare VAD commit count with actual commited PTEs
  *  - called when VAD_COMMIT_CHECK is toggled on
+ *  - skipped if any of the VAD's PTE locks is held elsewhere, or any of its page
+ *    table pages is not resident
  * 
  * No return val
  */
@@ -3,9 +3,11 @@
 #include "../coreFunctions/pageFile.h"
 #include "../infrastructure/enqueue-dequeue.h"
 #include "../infrastructure/jLock.h"
+#include "../infrastructure/physicalPages.h"
 #include "VApermissions.h"
 #include "PTEpermissions.h"
 #include "VADNodes.h"
+#include "PTEscan.h"
 
 
 faultStatus 
@@ -20,69 +22,53 @@ accessVA (PVOID virtualAddress, PTEpermissions RWEpermissions)
 
     PFstatus = SUCCESS;
 
+    #ifdef TRANSPARENT_FAULTS
+
+        //
+        // Faults are serviced by the vectored exception handler as the VA is
+        // touched - only a genuine access violation surfaces here
+        //
+
+        return isVAaccessible(virtualAddress, RWEpermissions);
+
+    #endif
+
     while (PFstatus == SUCCESS ) {
 
         #ifdef AV_TEMP_TESTING
 
             //
-            // Workaround for special pool/application verifier
+            // Lock-free fast path: a valid PTE with sufficient permissions needs no
+            // fault. The snapshot is validated against the lock group's sequence
+            // counter instead of under a lock. Aged PTEs, and writes to clean PTEs,
+            // take the fault path so the aging/dirty bits are maintained
             //
 
             PPTE currPTE;
             PTE snapPTE;
+            ULONG64 sequence;
 
             currPTE = getPTE(virtualAddress);
 
-            snapPTE = *currPTE;
-
-            if (snapPTE.u1.hPTE.validBit == 1) {
-
-                PPFNdata currPFN;
-                ULONG_PTR currPFNindex;
-
-                currPFNindex = snapPTE.u1.hPTE.PFN;
-
-                currPFN = PFNarray + currPFNindex;
-
-                acquireJLock(&currPFN->lockBits);
-
-                if (snapPTE.u1.ulongPTE == currPTE->u1.ulongPTE) {
-
-                    PTEpermissions tempRWEpermissions;
-                    
-                    tempRWEpermissions = getPTEpermissions(snapPTE);
-
-                    if (!checkPTEpermissions(tempRWEpermissions, RWEpermissions)) {
+            if (currPTE != NULL) {
 
-                        releaseJLock(&currPFN->lockBits);
+                sequence = readPTESequence(currPTE);
 
-                        PFstatus = pageFault(virtualAddress, RWEpermissions);
+                snapPTE = * (volatile PTE *) currPTE;
 
-                        PRINT("Invalid permissions\n");
-
-                        return PFstatus;
-
-                    } 
-
-                    releaseJLock(&currPFN->lockBits);
+                if (snapPTE.u1.hPTE.validBit == 1 &&
+                    snapPTE.u1.hPTE.agingBit == 0 &&
+                    checkPTEpermissions(getPTEpermissions(snapPTE), RWEpermissions) &&
+                    (snapPTE.u1.hPTE.dirtyBit == 1 || (permissionMasks[RWEpermissions] & writeMask) == 0) &&
+                    checkPTESequence(currPTE, sequence)) {
 
                     return SUCCESS;
 
                 }
-                else {
-
-                    releaseJLock(&currPFN->lockBits);
-
-                    continue;
-                    
-                }
-
-            } else {
-
-                PFstatus = pageFault(virtualAddress, RWEpermissions);
 
             }
 
+            PFstatus = pageFault(virtualAddress, RWEpermissions);
 
         #else
 
@@ -321,7 +307,7 @@ commitVA (PVOID startVA, PTEpermissions RWEpermissions, ULONG_PTR commitSize)
             // accurately as a parameter to checkDecommitted
             //
 
-            currDecommitted = checkDecommitted(currVAD, startPTE, endPTE);
+            currDecommitted = checkDecommitted(currVAD, startPTE, endPTE, FALSE);
 
             bRes = commitPages(currDecommitted);
 
@@ -397,7 +383,7 @@ commitVA (PVOID startVA, PTEpermissions RWEpermissions, ULONG_PTR commitSize)
         // accurately as a parameter to checkDecommitted
         //
 
-        currDecommitted = checkDecommitted(currVAD, startPTE, endPTE);
+        currDecommitted = checkDecommitted(currVAD, startPTE, endPTE, FALSE);
 
         bRes = commitPages(currDecommitted);
 
@@ -671,11 +657,247 @@ trimVA(void* virtualAddress)
 
     PTEaddress = getPTE(virtualAddress);
 
+    if (PTEaddress == NULL) {
+
+        PRINT("[trimVA] VA does not correspond to a valid PTE\n");
+        return FALSE;
+
+    }
+
     return trimPTE(PTEaddress);
 
 }
 
 
+static PPTE
+getVARangePTE(PVOID startVA, ULONG_PTR numPages)
+{
+
+    ULONG_PTR PTEsInRange;
+    ULONG_PTR startIndex;
+
+    PTEsInRange = ( ( (ULONG_PTR) leafVABlockEnd - (ULONG_PTR) leafVABlock ) / PAGE_SIZE);
+
+    if ( (ULONG_PTR) startVA < (ULONG_PTR) leafVABlock || (ULONG_PTR) startVA >= (ULONG_PTR) leafVABlockEnd) {
+
+        return NULL;
+
+    }
+
+    startIndex = ( (ULONG_PTR) startVA - (ULONG_PTR) leafVABlock ) >> PAGE_SHIFT;
+
+    if (numPages > PTEsInRange - startIndex) {
+
+        return NULL;
+
+    }
+
+    return PTEarray + startIndex;
+
+}
+
+
+BOOLEAN
+markIdleVA(PVOID startVA, ULONG_PTR numPages)
+{
+
+    PPTE startPTE;
+    PPTE endPTE;
+    PPTE currPTE;
+    PPTE groupEndPTE;
+
+    startPTE = getVARangePTE(startVA, numPages);
+
+    if (startPTE == NULL) {
+
+        PRINT("[markIdleVA] range is not within the VA block\n");
+        return FALSE;
+
+    }
+
+    endPTE = startPTE + numPages;
+
+    for (currPTE = startPTE; currPTE < endPTE; currPTE = groupEndPTE) {
+
+        BOOLEAN lockHeld;
+
+        groupEndPTE = PTEarray + ( (getLockIndex(currPTE) + 1) << pagesPerLockShift);
+
+        if (groupEndPTE > endPTE) {
+
+            groupEndPTE = endPTE;
+
+        }
+
+        //
+        // Set the idle bits before checking residency and aging the PTEs, so no
+        // access can be missed - a PTE made valid after this clears its own bit
+        //
+
+        for (ULONG_PTR PTEindex = currPTE - PTEarray; PTEindex < (ULONG_PTR) (groupEndPTE - PTEarray); ) {
+
+            ULONG_PTR numBits;
+            LONG64 idleBits;
+
+            numBits = 64 - (PTEindex & 63);
+
+            if (numBits > (ULONG_PTR) (groupEndPTE - PTEarray) - PTEindex) {
+
+                numBits = (groupEndPTE - PTEarray) - PTEindex;
+
+            }
+
+            idleBits = (LONG64) ( (numBits == 64) ? ~ (ULONG64) 0 : ( ( (ULONG64) 1 << numBits) - 1) ) << (PTEindex & 63);
+
+            InterlockedOr64(&PTEidleBitmap[PTEindex >> 6], idleBits);
+
+            PTEindex += numBits;
+
+        }
+
+        //
+        // A lock group whose page table is not resident has no valid PTEs to age,
+        // so it is not locked
+        //
+
+        lockHeld = acquirePTELockIfResident(currPTE);
+
+        if (lockHeld == FALSE) {
+
+            continue;
+
+        }
+
+        //
+        // Set the aging bit of every referenced PTE (a run at a time)
+        //
+
+        for (PPTE runPTE = currPTE; runPTE < groupEndPTE; runPTE += PTE_SCAN_MAX) {
+
+            ULONG_PTR runLength;
+            ULONG64 referencedBitmap;
+
+            runLength = groupEndPTE - runPTE;
+
+            if (runLength > PTE_SCAN_MAX) {
+
+                runLength = PTE_SCAN_MAX;
+
+            }
+
+            scanPTEs(runPTE, runLength, &referencedBitmap);
+
+            if (referencedBitmap == 0) {
+
+                continue;
+
+            }
+
+            setPTEAgingBits(runPTE, referencedBitmap);
+
+            for (ULONG_PTR j = 0; j < runLength; j++) {
+
+                if ( ( (referencedBitmap >> j) & 1) == 0) {
+
+                    continue;
+
+                }
+
+                //
+                // The reference is consumed here rather than by the trimming clock, so
+                // reset the page's clock age as clockVisitPTE does (the clock would
+                // otherwise take the aging bit set here as a sweep without a reference)
+                //
+
+                PTEageArray[runPTE + j - PTEarray] = 0;
+
+                #ifdef TRANSPARENT_FAULTS
+
+                    //
+                    // Revoke access so the next touch faults and clears the aging bit
+                    //
+
+                    PVOID currVA;
+                    DWORD oldPermissions;
+
+                    currVA = (PVOID) ( (ULONG_PTR) leafVABlock + ( (runPTE + j - PTEarray) << PAGE_SHIFT ) );
+
+                    VirtualProtect(currVA, PAGE_SIZE, windowsPermissions[getMappedPermissions(runPTE[j])], &oldPermissions);
+
+                #endif
+
+            }
+
+        }
+
+        releasePTELock(currPTE);
+
+    }
+
+    return TRUE;
+
+}
+
+
+BOOLEAN
+getIdleVA(PVOID startVA, ULONG_PTR numPages, PULONG64 idleBitmap)
+{
+
+    PPTE startPTE;
+    ULONG_PTR startIndex;
+    ULONG_PTR shift;
+
+    startPTE = getVARangePTE(startVA, numPages);
+
+    if (startPTE == NULL) {
+
+        PRINT("[getIdleVA] range is not within the VA block\n");
+        return FALSE;
+
+    }
+
+    startIndex = startPTE - PTEarray;
+
+    shift = startIndex & 63;
+
+    //
+    // Copy a word at a time, realigning the range to bit zero
+    //
+
+    for (ULONG_PTR i = 0; i < (numPages + 63) / 64; i++) {
+
+        ULONG_PTR wordIndex;
+        ULONG64 idleWord;
+
+        wordIndex = (startIndex >> 6) + i;
+
+        idleWord = (ULONG64) PTEidleBitmap[wordIndex] >> shift;
+
+        if (shift != 0 && (i + 1) * 64 - shift < numPages) {
+
+            idleWord |= (ULONG64) PTEidleBitmap[wordIndex + 1] << (64 - shift);
+
+        }
+
+        //
+        // Clear the bits past the end of the range
+        //
+
+        if ( (i + 1) * 64 > numPages) {
+
+            idleWord &= ( (ULONG64) 1 << (numPages & 63) ) - 1;
+
+        }
+
+        idleBitmap[i] = idleWord;
+
+    }
+
+    return TRUE;
+
+}
+
+
 BOOLEAN
 protectVA(PVOID startVA, PTEpermissions newRWEpermissions, ULONG_PTR commitSize) 
 {
@@ -776,7 +998,18 @@ protectVA(PVOID startVA, PTEpermissions newRWEpermissions, ULONG_PTR commitSize)
         PRINT("[protectVA] Updated permissions for PTE at VA %llx with permissions %d\n", (ULONG_PTR) currVA, newRWEpermissions);
 
         writePTE(currPTE, tempPTE);
-        
+
+        //
+        // Valid pages must have their mapping updated as well
+        //
+
+        if (tempPTE.u1.hPTE.validBit == 1) {
+
+            DWORD oldProtection;
+
+            VirtualProtect(currVA, PAGE_SIZE, windowsPermissions[getMappedPermissions(tempPTE)], &oldProtection);
+
+        }
                 
     }
     
@@ -791,6 +1024,28 @@ protectVA(PVOID startVA, PTEpermissions newRWEpermissions, ULONG_PTR commitSize)
 }
 
 
+static VOID
+flushFreeBatch(PPFNdata* freeBatch, PULONG_PTR numFreeBatch)
+{
+
+    //
+    // Enqueue the batch to the free list, then release the page locks
+    // held since each page was decommitted
+    //
+
+    enqueuePages(&freeListHead, freeBatch, *numFreeBatch);
+
+    for (ULONG_PTR i = 0; i < *numFreeBatch; i++) {
+
+        releaseJLock(&freeBatch[i]->lockBits);
+
+    }
+
+    *numFreeBatch = 0;
+
+}
+
+
 BOOLEAN
 decommitVA (PVOID startVA, ULONG_PTR commitSize) 
 {
@@ -805,6 +1060,10 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
     ULONG_PTR numPages;
     PVADNode currVAD;
     PPTE VADStartPTE;
+    PPFNdata freeBatch[PAGE_LIST_BATCH_SIZE];
+    ULONG_PTR numFreeBatch;
+
+    numFreeBatch = 0;
     
     startPTE = getPTE(startVA);
 
@@ -896,6 +1155,17 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
         //
 
         if (currPTE != startPTE && reprocessPTE == FALSE) {  
+
+            //
+            // Freed pages stay locked in the free batch until it is flushed, which
+            // must happen before their PTE lock is released
+            //
+
+            if (getLockIndex(currPTE) != getLockIndex(currPTE - 1)) {
+
+                flushFreeBatch(freeBatch, &numFreeBatch);
+
+            }
             
             lockHeld = acquireOrHoldSubsequentPTELock(currPTE, currPTE - 1);
 
@@ -970,7 +1240,7 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
             // Unmap VA from page
             //
 
-            bResult = MapUserPhysicalPages(currVA, 1, NULL);
+            bResult = unmapPhysicalPages(currVA, 1);
 
 
             if (bResult != TRUE) {
@@ -992,11 +1262,11 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
                 // If the PFN contents are also stored in pageFile
                 //
 
-                if (currPFN->pageFileOffset != INVALID_BITARRAY_INDEX) {
+                if (getPFNextension(currPFN)->pageFileOffset != INVALID_BITARRAY_INDEX) {
 
-                    clearPFBitIndex(currPFN->pageFileOffset);
+                    clearPFBitIndex(getPFNextension(currPFN)->pageFileOffset);
 
-                    currPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+                    getPFNextension(currPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
                 }
 
@@ -1007,14 +1277,27 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
                 currPFN->remodifiedBit = 0;
 
                 //
-                // Enqueue page to free list
+                // Add page to the free batch (page lock remains held until the
+                // batch is enqueued to the free list)
                 //
 
-                enqueuePage(&freeListHead, currPFN);
+                if (numFreeBatch == PAGE_LIST_BATCH_SIZE) {
+
+                    flushFreeBatch(freeBatch, &numFreeBatch);
+
+                }
+
+                freeBatch[numFreeBatch] = currPFN;
+
+                numFreeBatch++;
 
             }
 
-            releaseJLock(&currPFN->lockBits);
+            if (currPFN->statusBits == AWAITING_FREE) {
+
+                releaseJLock(&currPFN->lockBits);
+
+            }
 
             tempPTE.u1.ulongPTE = 0;
 
@@ -1084,19 +1367,28 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
                 // and pagefile offset field in PFN
                 //
 
-                if (currPFN->pageFileOffset != INVALID_BITARRAY_INDEX ) {
+                if (getPFNextension(currPFN)->pageFileOffset != INVALID_BITARRAY_INDEX ) {
 
-                    clearPFBitIndex(currPFN->pageFileOffset);
+                    clearPFBitIndex(getPFNextension(currPFN)->pageFileOffset);
 
-                    currPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+                    getPFNextension(currPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
                     
                 }
 
                 //
-                // Enqueue page to free list (setting status bits in process)
+                // Add page to the free batch (enqueued to the free list, setting
+                // status bits in process, when the batch is flushed)
                 //
 
-                enqueuePage(&freeListHead, currPFN);
+                if (numFreeBatch == PAGE_LIST_BATCH_SIZE) {
+
+                    flushFreeBatch(freeBatch, &numFreeBatch);
+
+                }
+
+                freeBatch[numFreeBatch] = currPFN;
+
+                numFreeBatch++;
 
             }      
 
@@ -1136,7 +1428,11 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
 
             writePTE(currPTE, tempPTE);
 
-            releaseJLock(&currPFN->lockBits);
+            if (currPFN->statusBits == AWAITING_FREE) {
+
+                releaseJLock(&currPFN->lockBits);
+
+            }
 
             decrementCommit(currVAD);
 
@@ -1268,9 +1564,12 @@ decommitVA (PVOID startVA, ULONG_PTR commitSize)
     }
 
     //
-    // All PTE's have been updated - final PTE lock can be safely released
+    // All PTE's have been updated - once the last freed pages are enqueued, 
+    // final PTE lock can be safely released
     //
 
+    flushFreeBatch(freeBatch, &numFreeBatch);
+
     releasePTELock(endPTE);
 
     //
@@ -1402,7 +1701,7 @@ decommitPages (ULONG_PTR numPages)
 
 
 ULONG_PTR
-checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE)
+checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE, BOOLEAN noWait)
 {
 
     PPTE currPTE;
@@ -1413,7 +1712,26 @@ checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE)
 
     lockHeld = TRUE;
 
-    acquirePTELock(startPTE);
+    //
+    // A caller already holding PTE or page locks must not wait on another PTE lock
+    // (its holder may be waiting on one of those page locks), nor for an available
+    // page to fault in a page table page (the trimmer may be blocked on its PTE
+    // lock) - such callers only check PTEs whose locks are free and resident
+    //
+
+    if (noWait == TRUE) {
+
+        if (tryAcquirePTELockIfResident(startPTE) == FALSE) {
+
+            return MAXULONG_PTR;
+
+        }
+
+    } else {
+
+        acquirePTELock(startPTE);
+
+    }
 
     for (currPTE = startPTE; currPTE <= endPTE; currPTE++ ) {
 
@@ -1424,7 +1742,17 @@ checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE)
         // if current PTE's lock differs from the previous PTE's lock 
         //
 
-        if (currPTE != startPTE) {
+        if (currPTE != startPTE && noWait == TRUE && getLockIndex(currPTE) != getLockIndex(currPTE - 1)) {
+
+            releasePTELock(currPTE - 1);
+
+            if (tryAcquirePTELockIfResident(currPTE) == FALSE) {
+
+                return MAXULONG_PTR;
+
+            }
+
+        } else if (currPTE != startPTE) {
 
             lockHeld = acquireOrHoldSubsequentPTELock(currPTE, currPTE - 1);
 
@@ -89,6 +89,36 @@ BOOLEAN
 decommitVA (PVOID startVA, ULONG_PTR commitSize);
 
 
+/*
+ * markIdleVA: function to mark numPages pages from startVA idle (see getIdleVA)
+ *  - resident pages have their aging bit set, so their next access clears
+ *    both it and the idle bit. A reference consumed this way resets the page's
+ *    trimming clock age, just as a sweep of the clock would
+ *  - cheap enough to call continuously: only resident lock groups are locked,
+ *    and PTEs are scanned/aged a run at a time
+ *
+ * Returns BOOLEAN
+ *  - TRUE on success
+ *  - FALSE if the range is not within the VA block
+ */
+BOOLEAN
+markIdleVA(PVOID startVA, ULONG_PTR numPages);
+
+
+/*
+ * getIdleVA: function to report which of numPages pages from startVA have not been
+ * accessed since markIdleVA
+ *  - idleBitmap must hold (numPages + 63) / 64 ULONG64s, bit i set if page i is idle
+ *  - lock-free, so pages accessed during the call may be reported either way
+ *
+ * Returns BOOLEAN
+ *  - TRUE on success
+ *  - FALSE if the range is not within the VA block
+ */
+BOOLEAN
+getIdleVA(PVOID startVA, ULONG_PTR numPages, PULONG64 idleBitmap);
+
+
 /*
  * commitPages: function to increment the global commit count
  * by param numPages pages
@@ -120,12 +150,16 @@ decommitPages (ULONG_PTR numPages);
  * range have been committed
  *  - VAD "read" lock must be held to prevent changes to the VAD during call
  *  - takes param currVAD, which determines which fields to check
+ *  - if noWait is set, PTE locks are only tried and page table pages are not
+ *    faulted in (for callers holding PTE or page locks)
  * 
  * Returns ULONG_PTR
  *  - Number of PTEs/Pages within range that are decommitted
+ *  - MAXULONG_PTR if noWait is set and a PTE lock is held elsewhere or a page
+ *    table page is not resident
  */
 ULONG_PTR
-checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE);
+checkDecommitted(PVADNode currVAD, PPTE startPTE, PPTE endPTE, BOOLEAN noWait);
 
 
 #endif
@@ -0,0 +1,830 @@
+#include "../usermodeMemoryManager.h"
+#include "../infrastructure/enqueue-dequeue.h"
+#include "../infrastructure/jLock.h"
+#include "../infrastructure/physicalPages.h"
+#include "../coreFunctions/getPage.h"
+#include "../coreFunctions/pageFile.h"
+#include "VApermissions.h"
+#include "pageDirectory.h"
+
+
+ULONG_PTR zeroPageTablePFN;                 // zero filled page mapped (read-only) at every non-resident page table page
+
+CRITICAL_SECTION pageDirectoryLock;         // serializes page table page faults (acquired after PTE lock)
+
+volatile LONG64 residentPageTables;
+volatile LONG64 peakResidentPageTables;
+volatile LONG64 pageTableFaults;
+volatile LONG64 pageTablesTrimmed;
+volatile LONG64 pageTablesDiscarded;
+
+
+PPDE
+getPDE(PPTE currPTE)
+{
+
+    return PDEarray + ( (ULONG_PTR) (currPTE - PTEarray) >> PTES_PER_PAGE_SHIFT );
+
+}
+
+
+PPTE
+getPTEaddress(void* virtualAddress)
+{
+
+    ULONG_PTR pageTableIndex;
+
+    //
+    // Verify VA param is within the range of the VA block
+    //
+
+    if (virtualAddress < leafVABlock || virtualAddress >= leafVABlockEnd) {
+
+        PRINT("[getPTEaddress] Not within allocated VA block \n");
+        return NULL;
+
+    }
+
+    //
+    // Convert VA's offset into the leafVABlock to a pagetable index
+    //
+
+    pageTableIndex = ( (ULONG_PTR) virtualAddress - (ULONG_PTR) leafVABlock ) >> PAGE_SHIFT;
+
+    return PTEarray + pageTableIndex;
+
+}
+
+
+ULONG_PTR
+getPTEsToNextPageTable(PPTE currPTE, PPTE endPTE)
+{
+
+    ULONG_PTR PTEsToSkip;
+
+    PTEsToSkip = PTES_PER_PAGE - ( (ULONG_PTR) (currPTE - PTEarray) & (PTES_PER_PAGE - 1) );
+
+    //
+    // The final page table page may be partially used
+    //
+
+    if ( (ULONG_PTR) (endPTE - currPTE) < PTEsToSkip) {
+
+        PTEsToSkip = endPTE - currPTE;
+
+    }
+
+    return PTEsToSkip;
+
+}
+
+
+static PVOID
+getPageTableVA(PPDE currPDE)
+{
+
+    return (PVOID) ( (ULONG_PTR) PTEarray + ( (ULONG_PTR) (currPDE - PDEarray) << PAGE_SHIFT ) );
+
+}
+
+
+static VOID
+writePDE(PPDE dest, PDE value)
+{
+
+    //
+    // PDEs are read without locks (getPTE, PTE lock fast path), so they
+    // must be written out as a single store
+    //
+
+    * (volatile ULONG64 *) &dest->u1.ulongPDE = value.u1.ulongPDE;
+
+}
+
+
+static VOID
+mapZeroPageTable(PVOID pageTableVA)
+{
+
+    BOOL bResult;
+    DWORD oldPermissions;
+
+    //
+    // Replaces any page table page mapped at pageTableVA in one step, so a lock-free
+    // reader racing with a trim reads either the old PTE or a zero PTE - never faults
+    //
+
+    bResult = mapPhysicalPages(pageTableVA, 1, &zeroPageTablePFN);
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("[mapZeroPageTable] Error mapping zero page table page\n");
+
+    }
+
+    bResult = VirtualProtect(pageTableVA, PAGE_SIZE, PAGE_READONLY, &oldPermissions);
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("[mapZeroPageTable] Error protecting zero page table page\n");
+
+    }
+
+}
+
+
+static VOID
+wakeModifiedWriterThread()
+{
+
+    BOOL bRes;
+
+    bRes = SetEvent(wakeModifiedWriterHandle);
+
+    if (bRes != TRUE) {
+
+        PRINT_ERROR("[trimPageTables] failed to set event\n");
+
+    }
+
+    ResetEvent(wakeModifiedWriterHandle);
+
+}
+
+
+VOID
+initPageDirectory()
+{
+
+    PPFNdata zeroPFN;
+
+    InitializeCriticalSection(&pageDirectoryLock);
+
+    //
+    // Take a (zeroed) page out of circulation to back every non-resident
+    // page table page
+    //
+
+    zeroPFN = getPage(TRUE);
+
+    if (zeroPFN == NULL) {
+
+        PRINT_ERROR("Could not get a page for the zero page table page\n");
+        exit(-1);
+
+    }
+
+    zeroPFN->statusBits = ACTIVE;
+
+    releaseJLock(&zeroPFN->lockBits);
+
+    zeroPageTablePFN = zeroPFN - PFNarray;
+
+}
+
+
+BOOLEAN
+commitPageTables(void* startVA, ULONG_PTR numPages)
+{
+
+    PPTE startPTE;
+    PPTE endPTE;
+    PPDE currPDE;
+    PPDE endPDE;
+    PDE newPDE;
+
+    startPTE = getPTEaddress(startVA);
+
+    endPTE = getPTEaddress( (PVOID) ( (ULONG_PTR) startVA + (numPages << PAGE_SHIFT) - 1 ) );
+
+    if (startPTE == NULL || endPTE == NULL) {
+
+        PRINT_ERROR("[commitPageTables] range not within VA block\n");
+        return FALSE;
+
+    }
+
+    endPDE = getPDE(endPTE);
+
+    for (currPDE = getPDE(startPTE); currPDE <= endPDE; currPDE++) {
+
+        if (currPDE->u1.hPDE.committedBit == 1) {
+            continue;
+        }
+
+        //
+        // Charge commit for the page table page, since once it holds pagefile
+        // format PTEs it needs either a physical page or pagefile space.
+        // Page table pages committed earlier in this loop keep their charge
+        // (page table pages are never decommitted)
+        //
+
+        if (commitPages(1) == FALSE) {
+
+            PRINT("[commitPageTables] insufficient commit charge for page table page\n");
+            return FALSE;
+
+        }
+
+        //
+        // Map the zero page table page before the PDE is published, since getPTE
+        // (including the lock-free accessVA path) only checks the committed bit
+        //
+
+        mapZeroPageTable(getPageTableVA(currPDE));
+
+        MemoryBarrier();
+
+        //
+        // Commit in discarded (all zero) state - the first PTE lock acquisition
+        // on the page table page faults in a zero page
+        //
+
+        newPDE.u1.ulongPDE = 0;
+
+        newPDE.u1.pfPDE.committedBit = 1;
+
+        newPDE.u1.pfPDE.pageFileIndex = INVALID_BITARRAY_INDEX;
+
+        writePDE(currPDE, newPDE);
+
+    }
+
+    return TRUE;
+
+}
+
+
+BOOLEAN
+isPageTableResident(PPTE currPTE)
+{
+
+    PDE snapPDE;
+
+    snapPDE = * (volatile PDE *) getPDE(currPTE);
+
+    return (BOOLEAN) snapPDE.u1.hPDE.validBit;
+
+}
+
+
+BOOLEAN
+makePageTableResident(PPTE currPTE)
+{
+
+    PPDE currPDE;
+    PDE snapPDE;
+    PDE newPDE;
+    PPFNdata pageTablePFN;
+    ULONG_PTR pageNum;
+    PVOID pageTableVA;
+    BOOL bResult;
+    DWORD oldPermissions;
+
+    currPDE = getPDE(currPTE);
+
+    snapPDE = * (volatile PDE *) currPDE;
+
+    //
+    // Fast path - page table page is resident. It cannot be trimmed while the
+    // caller holds its PTE lock, so the aging bit can be cleared without
+    // the page directory lock
+    //
+
+    if (snapPDE.u1.hPDE.validBit == 1) {
+
+        if (snapPDE.u1.hPDE.agingBit == 1) {
+
+            snapPDE.u1.hPDE.agingBit = 0;
+
+            writePDE(currPDE, snapPDE);
+
+        }
+
+        return TRUE;
+
+    }
+
+    //
+    // Page table pages are only referenced once committed (getPTE checks),
+    // and are never decommitted
+    //
+
+    if (snapPDE.u1.hPDE.committedBit == 0) {
+
+        PRINT_ERROR("[makePageTableResident] page table page not committed\n");
+        return TRUE;
+
+    }
+
+    pageTableVA = getPageTableVA(currPDE);
+
+    //
+    // Serialize with threads holding other PTE locks on the same page table page
+    //
+
+    EnterCriticalSection(&pageDirectoryLock);
+
+    while (TRUE) {
+
+        snapPDE = * (volatile PDE *) currPDE;
+
+        if (snapPDE.u1.hPDE.validBit == 1) {
+
+            //
+            // Faulted in by another thread while waiting on the page directory lock
+            //
+
+            LeaveCriticalSection(&pageDirectoryLock);
+
+            return TRUE;
+
+        }
+
+        if (snapPDE.u1.tPDE.transitionBit == 0) {
+            break;
+        }
+
+        //
+        // Transition - page table page remains on the modified/standby list. PDE
+        // must be re-checked under the page lock, since getStandbyPage may
+        // have repurposed the page (writing the PDE with only the page lock held)
+        //
+
+        pageNum = snapPDE.u1.tPDE.PFN;
+
+        pageTablePFN = PFNarray + pageNum;
+
+        acquireJLock(&pageTablePFN->lockBits);
+
+        if (currPDE->u1.ulongPDE != snapPDE.u1.ulongPDE) {
+
+            releaseJLock(&pageTablePFN->lockBits);
+
+            continue;
+
+        }
+
+        ASSERT(pageTablePFN->pageTableBit == 1 && pageTablePFN->PTEindex == (ULONG64) (currPDE - PDEarray));
+
+        //
+        // Page tables are always treated as dirty once resident, so any pagefile
+        // copy becomes stale - free it now, or have the modified writer discard it
+        // if a write is still in progress
+        //
+
+        if (pageTablePFN->writeInProgressBit == 0) {
+
+            if (getPFNextension(pageTablePFN)->pageFileOffset != INVALID_BITARRAY_INDEX) {
+
+                clearPFBitIndex(getPFNextension(pageTablePFN)->pageFileOffset);
+
+                getPFNextension(pageTablePFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+            }
+
+            dequeueSpecificPage(pageTablePFN);
+
+        }
+        else {
+
+            pageTablePFN->remodifiedBit = 1;
+
+        }
+
+        pageTablePFN->statusBits = ACTIVE;
+
+        releaseJLock(&pageTablePFN->lockBits);
+
+        goto mapPageTable;
+
+    }
+
+    //
+    // Pagefile format (or discarded) - get a zeroed page for the page table page
+    //
+
+    pageTablePFN = getFaultPage(TRUE);
+
+    if (pageTablePFN == NULL) {
+
+        LeaveCriticalSection(&pageDirectoryLock);
+
+        return FALSE;
+
+    }
+
+    pageNum = pageTablePFN - PFNarray;
+
+    if (snapPDE.u1.pfPDE.pageFileIndex != INVALID_BITARRAY_INDEX) {
+
+        //
+        // Read page table page contents back in and release its pagefile space.
+        // No other thread can reference the PDE, since the page directory
+        // lock is held and the page is not in transition
+        //
+
+        bResult = FALSE;
+
+        while (bResult != TRUE) {
+
+            bResult = readPageFromFileSystem(pageNum, snapPDE.u1.pfPDE.pageFileIndex, NO_PAGE_SIGNATURE);
+
+        }
+
+        clearPFBitIndex(snapPDE.u1.pfPDE.pageFileIndex);
+
+    }
+
+    pageTablePFN->statusBits = ACTIVE;
+
+    pageTablePFN->pageTableBit = 1;
+
+    pageTablePFN->PTEindex = currPDE - PDEarray;
+
+    releaseJLock(&pageTablePFN->lockBits);
+
+    mapPageTable:
+
+    //
+    // Map the page table page over the zero page table page, then validate the PDE
+    //
+
+    bResult = mapPhysicalPages(pageTableVA, 1, &pageNum);
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("[makePageTableResident] Error mapping page table page\n");
+
+    }
+
+    bResult = VirtualProtect(pageTableVA, PAGE_SIZE, PAGE_READWRITE, &oldPermissions);
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("[makePageTableResident] Error protecting page table page\n");
+
+    }
+
+    newPDE.u1.ulongPDE = 0;
+
+    newPDE.u1.hPDE.validBit = 1;
+
+    newPDE.u1.hPDE.committedBit = 1;
+
+    newPDE.u1.hPDE.PFN = pageNum;
+
+    writePDE(currPDE, newPDE);
+
+    LeaveCriticalSection(&pageDirectoryLock);
+
+    InterlockedIncrement64(&pageTableFaults);
+
+    if (InterlockedIncrement64(&residentPageTables) > peakResidentPageTables) {
+
+        peakResidentPageTables = residentPageTables;
+
+    }
+
+    return TRUE;
+
+}
+
+
+static BOOLEAN
+trimPageTable(PPDE currPDE)
+{
+
+    PPTE startPTE;
+    PPTE endPTE;
+    PPTE currPTE;
+    ULONG_PTR startLockIndex;
+    ULONG_PTR endLockIndex;
+    ULONG_PTR lockIndex;
+    BOOLEAN isZero;
+    BOOLEAN isTrimmed;
+    BOOLEAN wakeModifiedWriter;
+    PPFNdata pageTablePFN;
+    PDE newPDE;
+
+    isTrimmed = FALSE;
+
+    wakeModifiedWriter = FALSE;
+
+    startPTE = PTEarray + ( (ULONG_PTR) (currPDE - PDEarray) << PTES_PER_PAGE_SHIFT );
+
+    endPTE = startPTE + getPTEsToNextPageTable(startPTE, PTEarray + virtualMemPages);
+
+    startLockIndex = getLockIndex(startPTE);
+
+    endLockIndex = getLockIndex(endPTE - 1);
+
+    //
+    // Try to acquire every PTE lock on the page table page - never wait, since a
+    // lock holder may itself be waiting for pages this thread is trimming
+    //
+
+    for (lockIndex = startLockIndex; lockIndex <= endLockIndex; lockIndex++) {
+
+        if (TryEnterCriticalSection(&PTELockArray[lockIndex]) == FALSE) {
+
+            break;
+
+        }
+
+    }
+
+    if (lockIndex <= endLockIndex) {
+
+        while (lockIndex > startLockIndex) {
+
+            lockIndex--;
+
+            LeaveCriticalSection(&PTELockArray[lockIndex]);
+
+        }
+
+        return FALSE;
+
+    }
+
+    //
+    // Re-check residency now that no PTE lock holder can change it
+    //
+
+    if (currPDE->u1.hPDE.validBit == 0) {
+
+        goto releaseLocks;
+
+    }
+
+    //
+    // Page table page can only be trimmed if it maps no valid or transition PTEs
+    //
+
+    isZero = TRUE;
+
+    for (currPTE = startPTE; currPTE < endPTE; currPTE++) {
+
+        if (currPTE->u1.hPTE.validBit == 1 || currPTE->u1.tPTE.transitionBit == 1) {
+
+            goto releaseLocks;
+
+        }
+
+        if (currPTE->u1.ulongPTE != 0) {
+
+            isZero = FALSE;
+
+        }
+
+    }
+
+    //
+    // Give the page table page a second chance if it has been used since the last pass
+    //
+
+    if (currPDE->u1.hPDE.agingBit == 0) {
+
+        currPDE->u1.hPDE.agingBit = 1;
+
+        goto releaseLocks;
+
+    }
+
+    pageTablePFN = PFNarray + currPDE->u1.hPDE.PFN;
+
+    //
+    // Swap in the zero page table page before releasing the page
+    //
+
+    mapZeroPageTable(getPageTableVA(currPDE));
+
+    newPDE.u1.ulongPDE = 0;
+
+    acquireJLock(&pageTablePFN->lockBits);
+
+    ASSERT(pageTablePFN->statusBits == ACTIVE && pageTablePFN->pageTableBit == 1);
+
+    if (isZero) {
+
+        //
+        // All zero - discard instead of writing out (the PDE records that the
+        // page table page is zero), freeing the page to the zero list
+        //
+
+        pageTablePFN->pageTableBit = 0;
+
+        if (pageTablePFN->writeInProgressBit == 1) {
+
+            pageTablePFN->statusBits = AWAITING_FREE;
+
+        }
+        else {
+
+            ASSERT(getPFNextension(pageTablePFN)->pageFileOffset == INVALID_BITARRAY_INDEX);
+
+            pageTablePFN->remodifiedBit = 0;
+
+            enqueuePage(&zeroListHead, pageTablePFN);
+
+        }
+
+        newPDE.u1.pfPDE.committedBit = 1;
+
+        newPDE.u1.pfPDE.pageFileIndex = INVALID_BITARRAY_INDEX;
+
+        InterlockedIncrement64(&pageTablesDiscarded);
+
+    }
+    else {
+
+        //
+        // Otherwise handled as a dirty data page would be in trimPTE
+        //
+
+        if (pageTablePFN->writeInProgressBit == 1) {
+
+            pageTablePFN->remodifiedBit = 1;
+
+            pageTablePFN->statusBits = MODIFIED;
+
+        }
+        else {
+
+            ASSERT(getPFNextension(pageTablePFN)->pageFileOffset == INVALID_BITARRAY_INDEX);
+
+            pageTablePFN->remodifiedBit = 0;
+
+            wakeModifiedWriter = enqueuePage(&modifiedListHead, pageTablePFN);
+
+        }
+
+        newPDE.u1.tPDE.transitionBit = 1;
+
+        newPDE.u1.tPDE.committedBit = 1;
+
+        newPDE.u1.tPDE.PFN = pageTablePFN - PFNarray;
+
+        InterlockedIncrement64(&pageTablesTrimmed);
+
+    }
+
+    writePDE(currPDE, newPDE);
+
+    releaseJLock(&pageTablePFN->lockBits);
+
+    InterlockedDecrement64(&residentPageTables);
+
+    isTrimmed = TRUE;
+
+    releaseLocks:
+
+    for (lockIndex = endLockIndex + 1; lockIndex > startLockIndex; lockIndex--) {
+
+        LeaveCriticalSection(&PTELockArray[lockIndex - 1]);
+
+    }
+
+    if (wakeModifiedWriter == TRUE) {
+
+        wakeModifiedWriterThread();
+
+    }
+
+    return isTrimmed;
+
+}
+
+
+ULONG_PTR
+trimPageTables()
+{
+
+    ULONG_PTR startIndex;
+    ULONG_PTR numTrimmed;
+    PPDE currPDE;
+
+    numTrimmed = 0;
+
+    //
+    // Randomize starting PDE, so concurrent trimming threads start apart
+    //
+
+    startIndex = GetTickCount() % numPageTablePages;
+
+    for (ULONG_PTR i = 0; i < numPageTablePages; i++) {
+
+        currPDE = PDEarray + ( (startIndex + i) % numPageTablePages );
+
+        if (currPDE->u1.hPDE.validBit == 0) {
+            continue;
+        }
+
+        if (trimPageTable(currPDE) == TRUE) {
+
+            numTrimmed++;
+
+        }
+
+    }
+
+    return numTrimmed;
+
+}
+
+
+VOID
+repurposePageTable(PPFNdata PFN)
+{
+
+    PPDE currPDE;
+    PDE newPDE;
+
+    ASSERT(PFN->lockBit == 1 && PFN->pageTableBit == 1);
+
+    currPDE = PDEarray + PFN->PTEindex;
+
+    ASSERT(currPDE->u1.tPDE.transitionBit == 1 && currPDE->u1.tPDE.PFN == (ULONG64) (PFN - PFNarray));
+
+    //
+    // Standby page table pages have always been written out (discarded ones
+    // never reach the standby list)
+    //
+
+    ASSERT(getPFNextension(PFN)->pageFileOffset != INVALID_BITARRAY_INDEX);
+
+    newPDE.u1.ulongPDE = 0;
+
+    newPDE.u1.pfPDE.committedBit = 1;
+
+    newPDE.u1.pfPDE.pageFileIndex = getPFNextension(PFN)->pageFileOffset;
+
+    writePDE(currPDE, newPDE);
+
+    PFN->pageTableBit = 0;
+
+    getPFNextension(PFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+    PFN->statusBits = FREE;
+
+}
+
+
+VOID
+freePageTables()
+{
+
+    PPDE currPDE;
+    PPFNdata pageTablePFN;
+
+    for (currPDE = PDEarray; currPDE < PDEarray + numPageTablePages; currPDE++) {
+
+        if (currPDE->u1.hPDE.validBit == 0) {
+            continue;
+        }
+
+        //
+        // Program is single threaded at this point - free resident page table
+        // pages (trimmed ones are already on the modified/standby lists)
+        //
+
+        pageTablePFN = PFNarray + currPDE->u1.hPDE.PFN;
+
+        unmapPhysicalPages(getPageTableVA(currPDE), 1);
+
+        acquireJLock(&pageTablePFN->lockBits);
+
+        pageTablePFN->pageTableBit = 0;
+
+        pageTablePFN->remodifiedBit = 0;
+
+        clearPFBitIndex(getPFNextension(pageTablePFN)->pageFileOffset);
+
+        getPFNextension(pageTablePFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
+
+        enqueuePage(&freeListHead, pageTablePFN);
+
+        releaseJLock(&pageTablePFN->lockBits);
+
+        currPDE->u1.ulongPDE = 0;
+
+        residentPageTables--;
+
+    }
+
+    //
+    // Return the zero page table page (still zero) to the zero list
+    //
+
+    pageTablePFN = PFNarray + zeroPageTablePFN;
+
+    acquireJLock(&pageTablePFN->lockBits);
+
+    enqueuePage(&zeroListHead, pageTablePFN);
+
+    releaseJLock(&pageTablePFN->lockBits);
+
+    DeleteCriticalSection(&pageDirectoryLock);
+
+}
@@ -0,0 +1,151 @@
+#ifndef PAGEDIRECTORY_H
+#define PAGEDIRECTORY_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * Two level page table:
+ *  - PTEarray is a single reserved VA range (so PTE pointer arithmetic and
+ *    PFN PTEindex lookups are unchanged), into which page table pages are mapped
+ *  - PDEarray holds one PDE per page table page. A committed page table page is
+ *    either resident (valid), trimmed with its page on the modified/standby list
+ *    (transition), or paged out/discarded (pagefile format)
+ *  - non-resident committed page table pages map a shared read-only zero page, so
+ *    lock-free PTE readers see zero PTEs and fall back to the locked path, which
+ *    faults the page table page back in (see acquirePTELock)
+ *  - holding any PTE lock on a page table page keeps it resident
+ */
+
+extern volatile LONG64 residentPageTables;          // page table pages currently resident
+extern volatile LONG64 peakResidentPageTables;
+extern volatile LONG64 pageTableFaults;             // page table pages faulted back in
+extern volatile LONG64 pageTablesTrimmed;           // page table pages trimmed to the modified list
+extern volatile LONG64 pageTablesDiscarded;         // all zero page table pages freed without a write
+
+
+/*
+ * getPDE: function to find the PDE mapping the page table page a given PTE lives in
+ *  - does not require the page table page to be committed
+ *
+ * Returns PPDE
+ *  - corresponding PDE
+ */
+PPDE
+getPDE(PPTE currPTE);
+
+
+/*
+ * getPTEaddress: function to compute the PTE address for a given VA without
+ * checking that its page table page is committed
+ *  - only for range arithmetic (the result must not be dereferenced unless
+ *    the VA is known to lie within a VAD)
+ *
+ * Returns PPTE
+ *  - PTE address on success
+ *  - NULL if the VA is outside of the VA block
+ */
+PPTE
+getPTEaddress(void* virtualAddress);
+
+
+/*
+ * getPTEsToNextPageTable: function to count the PTEs from currPTE to the start
+ * of the next page table page (or to endPTE, whichever comes first)
+ *  - used by scanners to step over page table pages that are not resident
+ *
+ * Returns ULONG_PTR
+ *  - number of PTEs to advance (always at least one)
+ */
+ULONG_PTR
+getPTEsToNextPageTable(PPTE currPTE, PPTE endPTE);
+
+
+/*
+ * initPageDirectory: function to set aside the zero page table page and initialize
+ * the page directory lock
+ *  - page lists, VA lists and handles must already be initialized
+ *
+ * No return value (exits on failure)
+ */
+VOID
+initPageDirectory();
+
+
+/*
+ * commitPageTables: function to commit the page table pages spanning numPages
+ * VAs from startVA
+ *  - each newly committed page table page is charged one page of commit, and
+ *    starts out discarded (all zero) until a PTE lock on it is acquired
+ *  - caller must hold the VAD write lock (serializes commits)
+ *
+ * Returns BOOLEAN
+ *  - TRUE on success
+ *  - FALSE on failure (insufficient commit charge)
+ */
+BOOLEAN
+commitPageTables(void* startVA, ULONG_PTR numPages);
+
+
+/*
+ * makePageTableResident: function to fault in the page table page holding currPTE
+ *  - caller must hold currPTE's PTE lock
+ *  - clears the PDE's aging bit if the page table page is already resident
+ *
+ * Returns BOOLEAN
+ *  - TRUE if the page table page is resident (or was never committed)
+ *  - FALSE if no pages are available (caller must release the PTE lock and wait)
+ */
+BOOLEAN
+makePageTableResident(PPTE currPTE);
+
+
+/*
+ * isPageTableResident: function to check whether the page table page holding
+ * currPTE is resident, without faulting it in or touching its aging bit
+ *
+ * Returns BOOLEAN
+ *  - TRUE if resident
+ *  - FALSE otherwise
+ */
+BOOLEAN
+isPageTableResident(PPTE currPTE);
+
+
+/*
+ * trimPageTables: function to trim resident page table pages that map no valid
+ * or transition PTEs
+ *  - a page table page is aged on the first pass and trimmed on the next
+ *  - all zero page table pages are discarded, others are moved to the modified
+ *    list and written to the pagefile by the modified page writer
+ *  - PTE locks are only try-acquired, so pages whose PTEs are in use are skipped
+ *
+ * Returns ULONG_PTR
+ *  - number of page table pages trimmed or discarded
+ */
+ULONG_PTR
+trimPageTables();
+
+
+/*
+ * repurposePageTable: function to convert the PDE of a standby page table page
+ * that is being reused to pagefile format
+ *  - called by getStandbyPage with the page's PFN lock held
+ *
+ * No return value
+ */
+VOID
+repurposePageTable(PPFNdata PFN);
+
+
+/*
+ * freePageTables: function to return resident page table pages and the zero
+ * page table page to the page lists
+ *  - only called on exit, once all other threads have finished
+ *
+ * No return value
+ */
+VOID
+freePageTables();
+
+
+#endif //PAGEDIRECTORY_H
@@ -7,8 +7,8 @@
 ULONG_PTR testArray[5];
 #endif
 
-ULONG_PTR
-reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize)
+static ULONG_PTR
+reserveBitRangeFrom(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize, ULONG_PTR startBitIndex)
 {
 
     //
@@ -28,10 +28,10 @@ reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize)
     bitIndex = INVALID_BITARRAY_INDEX;
 
     //
-    // Initialize i and j index variables to zero
+    // Initialize i to the frame holding startBitIndex, and j to zero
     //
 
-    i = 0;
+    i = startBitIndex / BITS_PER_FRAME;
 
     j = 0;
 
@@ -48,12 +48,23 @@ reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize)
     // ULONG_PTR (8-byte/64-bit) level for-loop
     //
 
-    for (i = 0; i < bitArraySize / BITS_PER_FRAME; i++) {
+    for (; i < bitArraySize / BITS_PER_FRAME; i++) {
 
         ULONG_PTR currFrame;
 
         currFrame = bitArray[i];
 
+        //
+        // Treat the bits before startBitIndex in its frame as set, so no range
+        // starts before it
+        //
+
+        if (i == startBitIndex / BITS_PER_FRAME) {
+
+            currFrame |= ( (ULONG_PTR) 1 << (startBitIndex % BITS_PER_FRAME) ) - 1;
+
+        }
+
         //
         // No free bits in the current frame - continue to next
         //
@@ -180,6 +191,114 @@ reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize)
 }
 
 
+static ULONG_PTR
+reserveBitRangeBefore(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR endBitIndex)
+{
+
+    //
+    // Note: Bitarray MUST be locked to use this function
+    //
+
+    ULONG_PTR bitIndex;
+    ULONG_PTR bitsFound;
+
+    bitsFound = 0;
+
+    //
+    // Walk down from endBitIndex (exclusive), so the clear range found is the
+    // highest one that ends by it
+    //
+
+    bitIndex = endBitIndex;
+
+    while (bitIndex != 0) {
+
+        bitIndex--;
+
+        //
+        // No free bits in the current frame - skip to the end of the previous one
+        //
+
+        if (bitIndex % BITS_PER_FRAME == BITS_PER_FRAME - 1 && bitArray[bitIndex / BITS_PER_FRAME] == MAXULONG_PTR) {
+
+            bitsFound = 0;
+
+            bitIndex -= BITS_PER_FRAME - 1;
+
+            continue;
+
+        }
+
+        if ( ( (bitArray[bitIndex / BITS_PER_FRAME] >> (bitIndex % BITS_PER_FRAME) ) & 1) != 0) {
+
+            bitsFound = 0;
+
+            continue;
+
+        }
+
+        bitsFound++;
+
+        if (bitsFound == bits) {
+
+            setBitRange(TRUE, bitIndex, bits, bitArray);
+
+            return bitIndex;
+
+        }
+
+    }
+
+    PRINT("[reserveBitRange] unable to find free bit range\n");
+    return INVALID_BITARRAY_INDEX;
+
+}
+
+
+ULONG_PTR
+reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize)
+{
+
+    return reserveBitRangeFrom(bits, bitArray, bitArraySize, 0);
+
+}
+
+
+ULONG_PTR
+reserveBitRangeNear(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize, ULONG_PTR hintBitIndex)
+{
+
+    ULONG_PTR bitIndex;
+    ULONG_PTR endBitIndex;
+
+    ASSERT(hintBitIndex < bitArraySize);
+
+    //
+    // Search forward from the hint first, then back down from it for the nearest
+    // range starting below the hint (such a range may still run past the hint)
+    //
+
+    bitIndex = reserveBitRangeFrom(bits, bitArray, bitArraySize, hintBitIndex);
+
+    if (bitIndex == INVALID_BITARRAY_INDEX && hintBitIndex != 0) {
+
+        endBitIndex = hintBitIndex + bits - 1;
+
+        if (endBitIndex > bitArraySize) {
+
+            endBitIndex = bitArraySize;
+
+        }
+
+        bitIndex = reserveBitRangeBefore(bits, bitArray, endBitIndex);
+
+    }
+
+    return bitIndex;
+
+}
+
+
 VOID
 setBitRange(BOOLEAN isSet, ULONG_PTR startBitIndex, ULONG_PTR numPages, PULONG_PTR bitArray)
 {
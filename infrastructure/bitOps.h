@@ -13,6 +13,21 @@ ULONG_PTR
 reserveBitRange(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize);
 
 
+/*
+ * reserveBitRangeNear: function to find and set a clear range of bits in a bitarray,
+ * starting as close to hintBitIndex as possible
+ *  - searches forward from hintBitIndex, then (failing that) backward from it, taking
+ *    the nearest clear range below the hint
+ *  - must hold bitarray lock to call if caller is multithreaded
+ * 
+ * Returns ULONG_PTR:
+ *  - starting bitIndex on success
+ *  - INVALID_BITARRAY_INDEX on failure
+ */
+ULONG_PTR
+reserveBitRangeNear(ULONG_PTR bits, PULONG_PTR bitArray, ULONG_PTR bitArraySize, ULONG_PTR hintBitIndex);
+
+
 /*
  * setBitRange: function to either set or clear a range of bits in a bitarray
  *  - if isSet param is true, sets bits. If isSet param is false, clears bits.
@@ -0,0 +1,259 @@
+#include "config.h"
+#include <string.h>
+
+
+static VOID
+printUsage(char* programName)
+{
+
+    PRINT_ALWAYS("usage: %s [-v] [-p pages] [-f pagefilePages] [-l ptesPerLock] [-m vmMultiplier] [-c configFile]\n", programName);
+
+    PRINT_ALWAYS(" - defaults: -p %u -f %u -l %u -m %u\n", DEFAULT_NUM_PAGES, DEFAULT_PAGEFILE_PAGES, DEFAULT_PAGES_PER_LOCK, DEFAULT_VM_MULTIPLIER);
+
+}
+
+
+static BOOLEAN
+parseValue(char* string, PULONG_PTR value)
+{
+
+    char* end;
+
+    if (string == NULL || *string == '\0' || *string == '-') {
+
+        return FALSE;
+
+    }
+
+    //
+    // Base 0 so hex (0x...) sizes are accepted as well
+    //
+
+    *value = strtoull(string, &end, 0);
+
+    return (*end == '\0');
+
+}
+
+
+static BOOLEAN
+setConfigValue(char* key, char* valueString)
+{
+
+    ULONG_PTR value;
+
+    if (parseValue(valueString, &value) == FALSE) {
+
+        return FALSE;
+
+    }
+
+    if (strcmp(key, "pages") == 0 || strcmp(key, "-p") == 0) {
+
+        numPagesRequested = value;
+
+    }
+    else if (strcmp(key, "pagefile") == 0 || strcmp(key, "-f") == 0) {
+
+        pageFilePages = value;
+
+    }
+    else if (strcmp(key, "pagesPerLock") == 0 || strcmp(key, "-l") == 0) {
+
+        pagesPerLock = value;
+
+    }
+    else if (strcmp(key, "vmMultiplier") == 0 || strcmp(key, "-m") == 0) {
+
+        vmMultiplier = value;
+
+    }
+    else {
+
+        return FALSE;
+
+    }
+
+    return TRUE;
+
+}
+
+
+static BOOLEAN
+parseConfigFile(char* fileName)
+{
+
+    FILE* configFile;
+    char line[256];
+    char key[64];
+    char valueString[64];
+    char* comment;
+    int numFields;
+
+    configFile = fopen(fileName, "r");
+
+    if (configFile == NULL) {
+
+        PRINT_ALWAYS("unable to open config file %s\n", fileName);
+        return FALSE;
+
+    }
+
+    while (fgets(line, sizeof(line), configFile) != NULL) {
+
+        //
+        // Strip comments, then skip blank lines
+        //
+
+        comment = strchr(line, '#');
+
+        if (comment != NULL) {
+
+            *comment = '\0';
+
+        }
+
+        numFields = sscanf(line, "%63s %63s", key, valueString);
+
+        if (numFields <= 0) {
+
+            continue;
+
+        }
+
+        if (numFields != 2 || setConfigValue(key, valueString) == FALSE) {
+
+            PRINT_ALWAYS("invalid config file line: %s\n", line);
+
+            fclose(configFile);
+
+            return FALSE;
+
+        }
+
+    }
+
+    fclose(configFile);
+
+    return TRUE;
+
+}
+
+
+static BOOLEAN
+validateConfig()
+{
+
+    //
+    // Physical pages must at least cover the available page floor, and
+    // (with the multiplier) fit the PTE index field of the PFN
+    //
+
+    if (numPagesRequested < LOW_AVAILABLE_PAGES || numPagesRequested > ( (ULONG_PTR) 1 << PTE_INDEX_BITS) ) {
+
+        PRINT_ALWAYS("pages must be between %u and %llu\n", LOW_AVAILABLE_PAGES, (ULONG_PTR) 1 << PTE_INDEX_BITS);
+        return FALSE;
+
+    }
+
+    if (vmMultiplier == 0 || vmMultiplier > ( ( (ULONG_PTR) 1 << PTE_INDEX_BITS) / numPagesRequested) ) {
+
+        PRINT_ALWAYS("vmMultiplier must be between 1 and %llu for %llu pages\n", ( (ULONG_PTR) 1 << PTE_INDEX_BITS) / numPagesRequested, numPagesRequested);
+        return FALSE;
+
+    }
+
+    //
+    // INVALID_BITARRAY_INDEX is reserved, so every slot index must be below it
+    //
+
+    if (pageFilePages == 0 || pageFilePages >= INVALID_BITARRAY_INDEX) {
+
+        PRINT_ALWAYS("pagefile must be between 1 and %llu pages\n", INVALID_BITARRAY_INDEX - 1);
+        return FALSE;
+
+    }
+
+    //
+    // A lock may not straddle page table pages (faulting a page table page in is
+    // tied to acquiring the lock for its PTEs), and a power of two lets the lock
+    // index be a shift
+    //
+
+    if (pagesPerLock == 0 || (pagesPerLock & (pagesPerLock - 1)) != 0 || pagesPerLock > PTES_PER_PAGE) {
+
+        PRINT_ALWAYS("pagesPerLock must be a power of two between 1 and %u\n", PTES_PER_PAGE);
+        return FALSE;
+
+    }
+
+    pagesPerLockShift = 0;
+
+    while ( ( (ULONG_PTR) 1 << pagesPerLockShift) < pagesPerLock) {
+
+        pagesPerLockShift++;
+
+    }
+
+    return TRUE;
+
+}
+
+
+VOID
+parseConfig(int argc, char** argv)
+{
+
+    BOOLEAN bResult;
+
+    for (int i = 1; i < argc; i++) {
+
+        if (strcmp(argv[i], "-v") == 0) {
+
+            debugMode = TRUE;
+
+            continue;
+
+        }
+
+        //
+        // Every other switch takes a value
+        //
+
+        if (i + 1 >= argc) {
+
+            bResult = FALSE;
+
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+
+            bResult = parseConfigFile(argv[i + 1]);
+
+        }
+        else {
+
+            bResult = setConfigValue(argv[i], argv[i + 1]);
+
+        }
+
+        if (bResult == FALSE) {
+
+            PRINT_ALWAYS("invalid argument %s\n", argv[i]);
+
+            printUsage(argv[0]);
+            exit(-1);
+
+        }
+
+        i++;
+
+    }
+
+    if (validateConfig() == FALSE) {
+
+        printUsage(argv[0]);
+        exit(-1);
+
+    }
+
+}
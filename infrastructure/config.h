@@ -0,0 +1,33 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * Runtime geometry - sizes physical memory, pagefile and PTE lock striping at
+ * startup, so a single binary can be tuned per host:
+ *  -v              verbose (enables PRINT statements)
+ *  -p <pages>      physical pages to allocate (numPagesRequested)
+ *  -f <pages>      pagefile capacity in pages (pageFilePages)
+ *  -l <ptes>       PTEs per PTE lock, a power of two up to PTES_PER_PAGE (pagesPerLock)
+ *  -m <multiplier> VM pages per physical page returned (vmMultiplier)
+ *  -c <file>       config file of "<key> <value>" lines, keys pages, pagefile,
+ *                  pagesPerLock and vmMultiplier ('#' starts a comment)
+ *
+ * Switches are applied in order, so a switch after -c overrides the file.
+ */
+
+
+/*
+ * parseConfig: function to parse the command line (and any config file it names)
+ * into the runtime geometry globals
+ *  - unset values keep their DEFAULT_ macro values
+ *  - prints usage and exits on an unknown switch or out of range value
+ *
+ * No return value
+ */
+VOID
+parseConfig(int argc, char** argv);
+
+
+#endif //CONFIG_H
@@ -18,68 +18,188 @@ checkAvailablePages(PFNstatus dequeuedStatus)
     // conditional covers zero, free, and standby (since they are smaller in the enum)
     //
     
-    if (dequeuedStatus <= STANDBY) {
-
-        ULONG_PTR availablePageCount;
-
-        //
-        // calculate available pages
-        //
-
-        availablePageCount = 0;
+    if (dequeuedStatus <= STANDBY && availablePageCount < LOW_AVAILABLE_PAGES) {
         
         //
-        // Acquire page listhead locks in order to calculate page counts accurately
+        // Set event, signaling trimming thread to resume trimming active pages
+        // and replenish the available pages lists. The event stays set until
+        // available pages climb back over HIGH_AVAILABLE_PAGES
         //
 
-        for (int i = 0; i < STANDBY + 1; i++) {
-
-            EnterCriticalSection(&listHeads[i].lock);
+        BOOL bRes;
+        bRes = SetEvent(wakeTrimHandle); 
 
-            availablePageCount += listHeads[i].count;
-            
+        if (bRes != TRUE) {
+            PRINT_ERROR("Failed to set event successfully\n");
         }
 
+    }
     
-        if (availablePageCount < MIN_AVAILABLE_PAGES) {
-        
-            //
-            // Set event, signaling trimming thread to resume trimming active pages
-            // and replenish the available pages lists
-            //
+}
 
-            BOOL bRes;
-            bRes = SetEvent(wakeTrimHandle); 
 
-            if (bRes != TRUE) {
-                PRINT_ERROR("Failed to set event successfully\n");
-            }
+static PFNstatus
+getListStatus(PlistData listHead)
+{
 
-            //
-            // Note: efficacy is tied to implementation of trimValidPTEThread,
-            // where this could deadlock if there was no timeout while
-            // waiting on this event. This scenario could occur if all
-            // trimming threads were actively trimming and this dequeue 
-            // was called by a pagefault, that in turn waited infinitely
-            // on new page events.
-            //
+    //
+    // Every standby list (per priority, probationary or protected) holds STANDBY pages
+    //
 
-            ResetEvent(wakeTrimHandle);
+    if (listHead >= &listHeads[STANDBY_LISTS_BASE]) {
 
-        }
+        return STANDBY;
 
-        //
-        // Release locks in reverse order of acquisition
-        //
+    }
 
-        for (int i = STANDBY; i >= 0; i--) {
+    return (PFNstatus) (listHead - listHeads);
 
-            LeaveCriticalSection(&listHeads[i].lock);
+}
 
-        }
+
+static PlistData
+getPageListHead(PPFNdata PFN)
+{
+
+    if (PFN->statusBits == STANDBY) {
+
+        return &standbyListHeadAt(PFN->standbyPriority, PFN->protectedBit);
 
     }
-    
+
+    return &listHeads[PFN->statusBits];
+
+}
+
+
+static PlistData
+routeStandbyPage(PPFNdata PFN)
+{
+
+    //
+    // Cache the page at its VAD's standby priority (page table pages, which
+    // belong to no VAD, at the default), recording the priority in the PFN
+    // so the page's list can be found again. The page's PTE is in transition
+    // (and a decommit must first take the page lock held here), so the VAD
+    // cannot have been freed
+    //
+
+    if (PFN->pageTableBit == 1) {
+
+        PFN->standbyPriority = DEFAULT_STANDBY_PRIORITY;
+
+    }
+    else {
+
+        PFN->standbyPriority = getPFNextension(PFN)->VAD->standbyPriority;
+
+    }
+
+    return &standbyListHeadAt(PFN->standbyPriority, PFN->protectedBit);
+
+}
+
+
+static VOID
+updatePageListCount(PlistData listHead, LONG64 delta)
+{
+
+    LONG64 newAvailable;
+    LONG64 oldAvailable;
+
+    //
+    // List lock must be held - the per-list count is only written under it,
+    // but may be read without it
+    //
+
+    listHead->count += delta;
+
+    if (getListStatus(listHead) > STANDBY) {
+
+        return;
+
+    }
+
+    newAvailable = InterlockedAdd64(&availablePageCount, delta);
+
+    oldAvailable = newAvailable - delta;
+
+    //
+    // Only the update that crosses a watermark touches the trim event, so the
+    // common case costs a single interlocked add
+    //
+
+    if (oldAvailable >= LOW_AVAILABLE_PAGES && newAvailable < LOW_AVAILABLE_PAGES) {
+
+        SetEvent(wakeTrimHandle);
+
+    }
+    else if (oldAvailable < HIGH_AVAILABLE_PAGES && newAvailable >= HIGH_AVAILABLE_PAGES) {
+
+        ResetEvent(wakeTrimHandle);
+
+    }
+
+}
+
+
+//
+// Page lists link PFNs by index (see PFNlinks) - these resolve an index to the
+// links it names, either a PFN's or a page listhead's
+//
+
+#define getListHeadIndex(listHead) ( (ULONG) (PFN_LIST_HEAD_INDEX_BASE + ( (listHead) - listHeads) ) )
+
+static PPFNlinks
+getPFNlinks(ULONG index)
+{
+
+    if (index >= PFN_LIST_HEAD_INDEX_BASE) {
+
+        return &listHeads[index - PFN_LIST_HEAD_INDEX_BASE].PFNhead;
+
+    }
+
+    return &PFNarray[index].links;
+
+}
+
+
+static VOID
+enqueuePFN(PlistData listHead, PPFNdata PFN)
+{
+
+    ULONG newIndex;
+    ULONG prevFirst;
+
+    newIndex = (ULONG) (PFN - PFNarray);
+
+    prevFirst = listHead->PFNhead.flink;
+
+    listHead->PFNhead.flink = newIndex;
+    PFN->links.blink = getListHeadIndex(listHead);
+    PFN->links.flink = prevFirst;
+    getPFNlinks(prevFirst)->blink = newIndex;
+
+}
+
+
+static VOID
+dequeueSpecificPFN(PPFNdata PFN)
+{
+
+    ULONG prev;
+    ULONG next;
+
+    prev = PFN->links.blink;
+    next = PFN->links.flink;
+
+    getPFNlinks(prev)->flink = next;
+    getPFNlinks(next)->blink = prev;
+
+    PFN->links.flink = INVALID_PFN_LINK;
+    PFN->links.blink = INVALID_PFN_LINK;
+
 }
 
 
@@ -98,6 +218,51 @@ enqueue(PLIST_ENTRY listHead, PLIST_ENTRY newItem)
 }
 
 
+static VOID
+demoteProtectedStandbyPages(ULONG priority, ULONG_PTR numIncoming)
+{
+
+    PPFNdata demotedPFN;
+    PlistData protectedListHead;
+    PlistData probationaryListHead;
+
+    protectedListHead = &standbyListHeadAt(priority, 1);
+
+    probationaryListHead = &standbyListHeadAt(priority, 0);
+
+    //
+    // Keep a protected standby list within PROTECTED_STANDBY_RATIO times the
+    // probationary list of its priority by demoting pages from its tail (at most
+    // as many as are coming in) - demoted pages must be re-promoted to get back
+    //
+
+    for (ULONG_PTR i = 0; i < numIncoming; i++) {
+
+        if (protectedListHead->count + numIncoming <= PROTECTED_STANDBY_RATIO * probationaryListHead->count) {
+
+            break;
+
+        }
+
+        demotedPFN = dequeueLockedPageFromTail(protectedListHead, TRUE);
+
+        if (demotedPFN == NULL) {
+
+            break;
+
+        }
+
+        demotedPFN->protectedBit = 0;
+
+        enqueuePage(&standbyListHead, demotedPFN);
+
+        releaseJLock(&demotedPFN->lockBits);
+
+    }
+
+}
+
+
 BOOLEAN
 enqueuePage(PlistData listHead, PPFNdata PFN)
 {
@@ -111,7 +276,7 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
     // Assert that PFN lock is held upon enqueue function call
     //
 
-    ASSERT(PFN->lockBits != 0);
+    ASSERT(PFN->lockBit == 1);
 
     //
     // PFNs being inserted to a list cannot have a set remodified bit,
@@ -120,9 +285,26 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
 
     ASSERT(PFN->remodifiedBit == 0);
 
-    ASSERT(PFN->refCount == 0 && PFN->readInProgEventNode == NULL);
+    ASSERT(PFN->refCount == 0 && getPFNextension(PFN)->readInProgEventNode == NULL);
+
+    //
+    // Standby pages go to the list of their priority - the protected one if
+    // promoted by a transition fault
+    //
+
+    if (listHead == &standbyListHead) {
 
-    listStatus = listHead - listHeads;
+        listHead = routeStandbyPage(PFN);
+
+        if (PFN->protectedBit == 1) {
+
+            demoteProtectedStandbyPages(PFN->standbyPriority, 1);
+
+        }
+
+    }
+
+    listStatus = getListStatus(listHead);
 
     //
     // If list being enqueued to is either free or zero, the PFN
@@ -134,7 +316,7 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
     
         if (listStatus == FREE || listStatus == ZERO) {
 
-            ASSERT(PFN->pageFileOffset == INVALID_BITARRAY_INDEX);
+            ASSERT(getPFNextension(PFN)->pageFileOffset == INVALID_BITARRAY_INDEX);
 
             #ifdef PAGEFILE_PFN_CHECK
 
@@ -149,7 +331,7 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
 
                 EnterCriticalSection(&pageFileLock);
 
-                for (ULONG_PTR j = 0; j < PAGEFILE_PAGES; j++) {
+                for (ULONG_PTR j = 0; j < pageFilePages; j++) {
 
 
                     checkEntry = pageFileDebugArray + j;
@@ -185,9 +367,9 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
     // Enqueue PFN to list and update pagecount
     //
 
-    enqueue( &(listHead->head), &(PFN->links) );
+    enqueuePFN(listHead, PFN);
 
-    listHead->count++;
+    updatePageListCount(listHead, 1);
 
     #ifdef MULTITHREADING
 
@@ -222,6 +404,168 @@ enqueuePage(PlistData listHead, PPFNdata PFN)
     // set statusBits to the list we've just enqueued the page on
     PFN->statusBits = listStatus;
 
+    //
+    // A page that is no longer cached loses its promotion (and read-ahead mark)
+    //
+
+    if (listStatus == ZERO || listStatus == FREE || listStatus == QUARANTINE) {
+
+        PFN->protectedBit = 0;
+
+        PFN->readAheadBit = 0;
+
+    }
+
+    return wakeModifiedWriter;
+
+}
+
+
+BOOLEAN
+enqueuePages(PlistData listHead, PPFNdata* pageArray, ULONG_PTR numPages)
+{
+
+    BOOLEAN wakeModifiedWriter;
+    PFNstatus listStatus;
+    PPFNdata currPFN;
+    ULONG firstIndex;
+    ULONG lastIndex;
+    ULONG prevFirst;
+    PlistData routedListHead;
+    ULONG_PTR numRouted;
+
+    wakeModifiedWriter = FALSE;
+
+    //
+    // Standby pages are routed by priority and protection - enqueue the batch a
+    // list at a time, gathering each list's pages at the front of what remains
+    //
+
+    if (listHead == &standbyListHead) {
+
+        while (numPages != 0) {
+
+            routedListHead = routeStandbyPage(pageArray[0]);
+
+            numRouted = 1;
+
+            for (ULONG_PTR i = 1; i < numPages; i++) {
+
+                currPFN = pageArray[i];
+
+                if (routeStandbyPage(currPFN) == routedListHead) {
+
+                    pageArray[i] = pageArray[numRouted];
+
+                    pageArray[numRouted] = currPFN;
+
+                    numRouted++;
+
+                }
+
+            }
+
+            if (pageArray[0]->protectedBit == 1) {
+
+                demoteProtectedStandbyPages(pageArray[0]->standbyPriority, numRouted);
+
+            }
+
+            enqueuePages(routedListHead, pageArray, numRouted);
+
+            pageArray += numRouted;
+
+            numPages -= numRouted;
+
+        }
+
+        return wakeModifiedWriter;
+
+    }
+
+    if (numPages == 0) {
+
+        return wakeModifiedWriter;
+
+    }
+
+    listStatus = getListStatus(listHead);
+
+    //
+    // Chain the pages to one another before taking the list lock (they are
+    // locked and on no list, so no one else can follow their links)
+    //
+
+    for (ULONG_PTR i = 0; i < numPages; i++) {
+
+        currPFN = pageArray[i];
+
+        ASSERT(currPFN->lockBit == 1);
+
+        ASSERT(currPFN->remodifiedBit == 0);
+
+        ASSERT(currPFN->refCount == 0 && getPFNextension(currPFN)->readInProgEventNode == NULL);
+
+        ASSERT( (listStatus != FREE && listStatus != ZERO) || currPFN->PTEindex == 0
+                || getPFNextension(currPFN)->pageFileOffset == INVALID_BITARRAY_INDEX);
+
+        currPFN->links.blink = (i == 0) ? INVALID_PFN_LINK : (ULONG) (pageArray[i - 1] - PFNarray);
+
+        currPFN->links.flink = (i == numPages - 1) ? INVALID_PFN_LINK : (ULONG) (pageArray[i + 1] - PFNarray);
+
+    }
+
+    firstIndex = (ULONG) (pageArray[0] - PFNarray);
+
+    lastIndex = (ULONG) (pageArray[numPages - 1] - PFNarray);
+
+    //
+    // Splice the whole chain in at the head of the list
+    //
+
+    EnterCriticalSection(&(listHead->lock));
+
+    prevFirst = listHead->PFNhead.flink;
+
+    listHead->PFNhead.flink = firstIndex;
+    PFNarray[firstIndex].links.blink = getListHeadIndex(listHead);
+    PFNarray[lastIndex].links.flink = prevFirst;
+    getPFNlinks(prevFirst)->blink = lastIndex;
+
+    updatePageListCount(listHead, numPages);
+
+    #ifdef MULTITHREADING
+
+        SetEvent(listHead->newPagesEvent);
+
+    #endif
+
+    if (listStatus == MODIFIED && listHead->count > MODIFIED_PAGE_COUNT_THRESHOLD) {
+
+        wakeModifiedWriter = TRUE;
+
+    }
+
+    LeaveCriticalSection(&(listHead->lock));
+
+    //
+    // set statusBits to the list the pages have just been enqueued on
+    //
+
+    for (ULONG_PTR i = 0; i < numPages; i++) {
+
+        pageArray[i]->statusBits = listStatus;
+
+        if (listStatus == ZERO || listStatus == FREE || listStatus == QUARANTINE) {
+
+            pageArray[i]->protectedBit = 0;
+
+            pageArray[i]->readAheadBit = 0;
+
+        }
+
+    }
+
     return wakeModifiedWriter;
 
 }
@@ -236,20 +580,20 @@ enqueuePageBasic(PlistData listHead, PPFNdata PFN) {
 
     wakeModifiedWriter = FALSE;
 
-    ASSERT(PFN->lockBits != 0);
+    ASSERT(PFN->lockBit == 1);
 
     ASSERT(PFN->remodifiedBit == 0);
 
-    listStatus = listHead - listHeads;
+    listStatus = getListStatus(listHead);
 
     //lock listHead (since listHead values are not changed/accessed until dereferenced)
     EnterCriticalSection(&(listHead->lock));
 
     // enqueue onto list
-    enqueue( &(listHead->head), &(PFN->links) );
+    enqueuePFN(listHead, PFN);
 
     // update pagecount of that list
-    listHead->count++;
+    updatePageListCount(listHead, 1);
 
     #ifdef MULTITHREADING
     SetEvent(listHead->newPagesEvent);
@@ -280,53 +624,46 @@ PPFNdata
 dequeuePage(PlistData listHead) 
 {
 
-    PLIST_ENTRY headLink;
+    ULONG headIndex;
     PPFNdata returnPFN;
-    PLIST_ENTRY returnLink;
-    PLIST_ENTRY newFirst;
+    ULONG newFirst;
 
-    headLink = &(listHead->head);
+    headIndex = getListHeadIndex(listHead);
 
     //
     // Assert that list must have items chained to the head (since parent function 
     // dequeueLockedPage must check)
     //
 
-    ASSERT(headLink->Flink != headLink);
+    ASSERT(listHead->PFNhead.flink != headIndex);
 
     ASSERT(listHead->count != 0);
 
-    returnLink = headLink->Flink;
+    returnPFN = PFNarray + listHead->PFNhead.flink;
 
-    newFirst = returnLink->Flink;
+    newFirst = returnPFN->links.flink;
 
     //
-    // set headLink's flink to the return item's flink
+    // set listhead's flink to the return item's flink
     //
 
-    headLink->Flink = newFirst;
+    listHead->PFNhead.flink = newFirst;
 
-    newFirst->Blink = headLink;
+    getPFNlinks(newFirst)->blink = headIndex;
 
     //
-    // set returnLink's flink/blink to null before returning to caller
+    // Invalidate returned PFN's flink/blink before returning to caller
     //
 
-    returnLink->Flink = NULL;
+    returnPFN->links.flink = INVALID_PFN_LINK;
 
-    returnLink->Blink = NULL;
+    returnPFN->links.blink = INVALID_PFN_LINK;
 
     //
     // Decrement listHead data pageCount
     //
 
-    listHead->count--;
-
-    //
-    // Derive and return containing PFN metadata from links field
-    //
-
-    returnPFN = CONTAINING_RECORD(returnLink, PFNdata, links);
+    updatePageListCount(listHead, -1);
 
     returnPFN->statusBits = NONE;
 
@@ -339,10 +676,13 @@ PPFNdata
 dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked)
 {
 
-    PLIST_ENTRY headLink;
+    ULONG headIndex;
     PPFNdata headPFN;
     PPFNdata returnPFN;
     PFNstatus dequeueStatus;
+    ULONG currSpins;
+
+    currSpins = 0;
     
     while (TRUE) {
 
@@ -350,22 +690,30 @@ dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked)
         // "Peek" at the listhead's flink
         //
 
-        headLink = (listHead->head).Flink;
+        headIndex = * (volatile ULONG *) &listHead->PFNhead.flink;
 
-        if (headLink == &listHead->head ) {
+        if (headIndex == getListHeadIndex(listHead)) {
 
             PRINT("[dequeueLockedPage] List is empty - page cannot be dequeued\n");
             return NULL;
 
         }
 
-        headPFN = CONTAINING_RECORD(headLink, PFNdata, links);
+        headPFN = PFNarray + headIndex;
 
         //
-        // Lock page initially from at head - however it could have been pulled off list in meantime
+        // Lock page initially from at head - however it could have been pulled off list in meantime.
+        // If the head page is locked it is most likely being pulled off by another thread, so
+        // back off and re-peek rather than queueing on its lock
         //
 
-        acquireJLock(&headPFN->lockBits);
+        if (tryAcquireJLock(&headPFN->lockBits) == FALSE) {
+
+            backoffSpin(&currSpins);
+
+            continue;
+
+        }
 
         //
         // Lock list itself - both list and page locks have now been acquired
@@ -377,7 +725,7 @@ dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked)
         // Verify page remains at head of list - if so, break immediately
         //
 
-        if (headLink == (listHead->head).Flink) {
+        if (headIndex == listHead->PFNhead.flink) {
 
             break;
 
@@ -411,7 +759,7 @@ dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked)
     // insufficient, the trim event is set.
     //
 
-    dequeueStatus = listHead - listHeads;
+    dequeueStatus = getListStatus(listHead);
 
     checkAvailablePages(dequeueStatus);
 
@@ -432,16 +780,72 @@ dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked)
 }
 
 
+ULONG_PTR
+dequeuePages(PlistData listHead, ULONG_PTR maxPages, PPFNdata* pageArray, BOOLEAN returnLocked)
+{
+
+    ULONG_PTR numDequeued;
+    PPFNdata headPFN;
+
+    numDequeued = 0;
+
+    EnterCriticalSection(&listHead->lock);
+
+    while (numDequeued < maxPages && listHead->PFNhead.flink != getListHeadIndex(listHead)) {
+
+        headPFN = PFNarray + listHead->PFNhead.flink;
+
+        //
+        // The list lock is already held, so the page lock can only be tried (a
+        // holder may be waiting on the list lock) - stop the batch early instead
+        //
+
+        if (tryAcquireJLock(&headPFN->lockBits) == FALSE) {
+
+            break;
+
+        }
+
+        dequeuePage(listHead);
+
+        if (returnLocked == FALSE) {
+
+            releaseJLock(&headPFN->lockBits);
+
+        }
+
+        pageArray[numDequeued] = headPFN;
+
+        numDequeued++;
+
+    }
+
+    LeaveCriticalSection(&listHead->lock);
+
+    //
+    // Check available pages once for the whole batch
+    //
+
+    if (numDequeued != 0) {
+
+        checkAvailablePages(getListStatus(listHead));
+
+    }
+
+    return numDequeued;
+
+}
+
+
 PPFNdata
 dequeuePageFromTail(PlistData listHead)
 {
 
-    PLIST_ENTRY headLink;
+    ULONG headIndex;
     PPFNdata returnPFN;
-    PLIST_ENTRY returnLink;
-    PLIST_ENTRY newLast;
+    ULONG newLast;
 
-    headLink = &(listHead->head);
+    headIndex = getListHeadIndex(listHead);
 
     //
     // Acquire listHead lock in order to check if there are pages on list
@@ -455,7 +859,7 @@ dequeuePageFromTail(PlistData listHead)
     // page lock and return NULL
     //
 
-    if (headLink->Flink == headLink) {
+    if (listHead->PFNhead.flink == headIndex) {
 
         ASSERT(listHead->count == 0);
 
@@ -470,39 +874,37 @@ dequeuePageFromTail(PlistData listHead)
 
     ASSERT(listHead->count != 0);
 
-    returnLink = headLink->Blink;
+    returnPFN = PFNarray + listHead->PFNhead.blink;
 
-    newLast = returnLink->Blink;
+    newLast = returnPFN->links.blink;
 
     //
-    // Set headLink's flink to the return item's flink
+    // Set listhead's blink to the return item's blink
     //
 
-    headLink->Blink = newLast;
+    listHead->PFNhead.blink = newLast;
 
-    newLast->Flink = headLink;
+    getPFNlinks(newLast)->flink = headIndex;
 
     //
-    // Set returnLink's flink/blink to null before returning it
+    // Invalidate returned PFN's flink/blink before returning it
     //
 
-    returnLink->Flink = NULL;
+    returnPFN->links.flink = INVALID_PFN_LINK;
 
-    returnLink->Blink = NULL;
+    returnPFN->links.blink = INVALID_PFN_LINK;
 
     //
     // Decrement listhead's page count
     //
 
-    listHead->count--;
+    updatePageListCount(listHead, -1);
 
     //
     // Release listHead lock before returning
     //
 
     LeaveCriticalSection(&(listHead->lock));
-    
-    returnPFN = CONTAINING_RECORD(returnLink, PFNdata, links);
 
     returnPFN->statusBits = NONE;
 
@@ -514,10 +916,13 @@ dequeuePageFromTail(PlistData listHead)
 PPFNdata
 dequeueLockedPageFromTail(PlistData listHead, BOOLEAN returnLocked)
 {
-    PLIST_ENTRY tailLink;
+    ULONG tailIndex;
     PPFNdata tailPFN;
     PPFNdata returnPFN;
     PFNstatus dequeueStatus;
+    ULONG currSpins;
+
+    currSpins = 0;
 
     while (TRUE) {
 
@@ -525,22 +930,29 @@ dequeueLockedPageFromTail(PlistData listHead, BOOLEAN returnLocked)
         // "Peek" at the listhead's Blink
         //
 
-        tailLink = (listHead->head).Blink;
+        tailIndex = * (volatile ULONG *) &listHead->PFNhead.blink;
 
-        if (tailLink == &(listHead->head) ) {
+        if (tailIndex == getListHeadIndex(listHead)) {
 
             PRINT("[dequeueLockedPageFromTail] List is empty - page cannot be dequeued\n");
             return NULL;
             
         }
 
-        tailPFN = CONTAINING_RECORD(tailLink, PFNdata, links);
+        tailPFN = PFNarray + tailIndex;
 
         //
-        // Lock page initially at tail (it may have been pulled off list in meantime)
+        // Lock page initially at tail (it may have been pulled off list in meantime),
+        // re-peeking after a backoff if another thread holds it
         //
 
-        acquireJLock(&(tailPFN->lockBits));
+        if (tryAcquireJLock(&tailPFN->lockBits) == FALSE) {
+
+            backoffSpin(&currSpins);
+
+            continue;
+
+        }
 
         //
         // Lock list itself - both page and list locks have now been acquired
@@ -552,7 +964,7 @@ dequeueLockedPageFromTail(PlistData listHead, BOOLEAN returnLocked)
         // Verify page remains at tail of list - if so, break immediately
         //
 
-        if (tailLink == (listHead->head).Blink) {
+        if (tailIndex == listHead->PFNhead.blink) {
 
             break;
 
@@ -586,7 +998,7 @@ dequeueLockedPageFromTail(PlistData listHead, BOOLEAN returnLocked)
     // insufficient, the trim event is set.
     //
 
-    dequeueStatus = listHead - listHeads;
+    dequeueStatus = getListStatus(listHead);
 
     checkAvailablePages(dequeueStatus);
 
@@ -630,27 +1042,31 @@ VOID
 dequeueSpecificPage(PPFNdata removePage)
 {
 
+    PlistData listHead;
+
     //
     // Assert page lock is held by caller
     //
 
-    ASSERT(removePage->lockBits != 0);
+    ASSERT(removePage->lockBit == 1);
 
     //
-    // Acquire list lock
+    // Acquire lock of the list the page is on
     //
 
-    EnterCriticalSection(&listHeads[removePage->statusBits].lock);
+    listHead = getPageListHead(removePage);
 
-    dequeueSpecific(&removePage->links);
+    EnterCriticalSection(&listHead->lock);
+
+    dequeueSpecificPFN(removePage);
 
     //
     // Decrement pageCount for that list
     //
 
-    listHeads[removePage->statusBits].count--;
+    updatePageListCount(listHead, -1);
 
-    LeaveCriticalSection(&(listHeads[removePage->statusBits].lock));
+    LeaveCriticalSection(&listHead->lock);
 
     checkAvailablePages(removePage->statusBits);
 
@@ -7,7 +7,8 @@
 /*
  * checkAvailablePages: function to check and maintain available pages
  *  - if page dequeued is on zero/free/standby, checks total # of pages on zero/free/standby lists
- *  - if total # < MIN_AVAILABLE_PAGES, runs modifiedPageWriter
+ *    (availablePageCount, read without list locks)
+ *  - if total # < LOW_AVAILABLE_PAGES, wakes the balancer (trimValidPTEThread)
  * 
  * No return value 
  */
@@ -29,6 +30,9 @@ enqueue(PLIST_ENTRY listHead, PLIST_ENTRY newItem);
  * enqueuePage: SYNCHRONIZED wrapper function for enqueue PFN to head of specified list
  *  - also updates pageCount and the statusBits of the PFN that has just been enqueued
  *  - expects page lock to be held upon call, acquires and releases listhead lock
+ *  - a page enqueued to the standby list goes to the standby list of its VAD's
+ *    priority, the protected one if the page was promoted (protectedBit) -
+ *    demoting that list's tail if it is full
  *
  * Returns BOOLEAN
  *  - TRUE if we need to run modified writer
@@ -37,6 +41,21 @@ enqueue(PLIST_ENTRY listHead, PLIST_ENTRY newItem);
 BOOLEAN
 enqueuePage(PlistData listHead, PPFNdata PFN);
 
+/*
+ * enqueuePages: SYNCHRONIZED function to enqueue a batch of pages to the head of a list
+ *  - links the batch into a chain and splices it in under a single list lock
+ *    acquisition, updating the count (and signaling the new pages event) once
+ *  - expects every page's lock to be held upon call, and sets their status bits
+ *  - standby batches are reordered, and enqueued a destination list at a time
+ *    (routed as in enqueuePage)
+ *
+ * Returns BOOLEAN
+ *  - TRUE if we need to run modified writer
+ *  - FALSE if not
+ */
+BOOLEAN
+enqueuePages(PlistData listHead, PPFNdata* pageArray, ULONG_PTR numPages);
+
 /*
  * enqueuePageBasic: simplified version of enqueuePage above
  *  - only used if PAGEFILE_PFN_CHECK is enabled
@@ -81,6 +100,22 @@ PPFNdata
 dequeueLockedPage(PlistData listHead, BOOLEAN returnLocked);
 
 
+/*
+ * dequeuePages: SYNCHRONIZED function to dequeue up to maxPages pages from the head
+ * of a list under a single list lock acquisition
+ *  - no locks should be held upon call
+ *  - pages whose page lock is held elsewhere end the batch early
+ *  - returned pages have status NONE, and checkAvailablePages is called once
+ *    for the batch
+ *  - BOOLEAN returnLocked flag can be set to true to not release the page locks
+ * 
+ * Returns ULONG_PTR
+ *  - number of pages written to pageArray (zero if the list is empty)
+ */
+ULONG_PTR
+dequeuePages(PlistData listHead, ULONG_PTR maxPages, PPFNdata* pageArray, BOOLEAN returnLocked);
+
+
 /*
  * dequeuePageFromTail: function to dequeue an item from the tail of a specified list
  *  - same as dequeuePage, but just removes from the tail
@@ -1,21 +1,63 @@
-#include <stdio.h>
-#include <windows.h>
-#include "jlock.h"
+#include "jLock.h"
 #include "../usermodeMemoryManager.h"
+#include "../coreFunctions/getPage.h"
+#include "../dataStructures/pageDirectory.h"
 
 
 
+//
+// Cap on pause instructions per backoff step (spins double up to this)
+//
+
+#define MAX_BACKOFF_SPINS 1024
+
+
 VOID
-acquireJLock(volatile PLONG lock)
+backoffSpin(PULONG currSpins)
 {
 
+    if (*currSpins == 0) {
+
+        *currSpins = 1;
+
+    }
+
+    for (ULONG i = 0; i < *currSpins; i++) {
+
+        YieldProcessor();
+
+    }
+
+    if (*currSpins < MAX_BACKOFF_SPINS) {
+
+        *currSpins <<= 1;
+
+    }
+
+}
+
+
+VOID
+acquireJLock(volatile LONG* lock)
+{
+
+    LONG oldValue;
+    ULONG currSpins;
+
+    currSpins = 0;
+
     //
-    // Spin until InterlockedCompareExchange call is successful
+    // Spin until InterlockedCompareExchange sets bit 0 - the remaining bits
+    // are data owned by the lock holder, so they are carried over unchanged.
+    // The CAS is only attempted once the lock is seen free (plain reads keep 
+    // the line shared while it is held), with backoff after each miss
     //
 
     while (TRUE) {
 
-        if (InterlockedCompareExchange(lock, 1, 0) == 0) {
+        oldValue = *lock;
+
+        if ((oldValue & 1) == 0 && InterlockedCompareExchange(lock, oldValue | 1, oldValue) == oldValue) {
 
             //
             // Return once call is successful
@@ -25,20 +67,25 @@ acquireJLock(volatile PLONG lock)
 
         }
 
+        backoffSpin(&currSpins);
+
     }
 
 }
 
 
 VOID
-releaseJLock(volatile PLONG lock)
+releaseJLock(volatile LONG* lock)
 {
 
     //
-    // Clear lock value
+    // Clear lock bit (interlocked, so the holder's writes to the rest of the
+    // word and the PFN are visible before the lock is seen free)
     //
 
-    *lock = 0;
+    ASSERT((*lock & 1) == 1);
+
+    InterlockedAnd(lock, ~1);
 
     return;
 
@@ -46,10 +93,14 @@ releaseJLock(volatile PLONG lock)
 
 
 BOOL
-tryAcquireJLock(volatile PLONG lock)
+tryAcquireJLock(volatile LONG* lock)
 {
 
-    if (InterlockedCompareExchange(lock, 1, 0) == 0) {
+    LONG oldValue;
+
+    oldValue = *lock;
+
+    if ((oldValue & 1) == 0 && InterlockedCompareExchange(lock, oldValue | 1, oldValue) == oldValue) {
 
         return TRUE;
 
@@ -63,6 +114,39 @@ tryAcquireJLock(volatile PLONG lock)
 }
 
 
+PFNstate
+readPFNstate(PPFNdata PFN)
+{
+
+    PFNstate snapState;
+
+    snapState.value = PFN->lockBits;
+
+    return snapState;
+
+}
+
+
+BOOLEAN
+compareExchangePFNstate(PPFNdata PFN, PFNstate oldState, PFNstate newState)
+{
+
+    //
+    // Lock holders write the state word non-atomically, so a transition may
+    // only be made from an unlocked state (and may not take the lock)
+    //
+
+    if (oldState.lockBit == 1 || newState.lockBit == 1) {
+
+        return FALSE;
+
+    }
+
+    return (InterlockedCompareExchange(&PFN->lockBits, newState.value, oldState.value) == oldState.value);
+
+}
+
+
 VOID
 acquireJCritical(PCRITICAL_SECTION cs)
 {
@@ -85,14 +169,14 @@ initPTELocks(ULONG_PTR totalVirtualMemPages)
 
     ULONG_PTR numLocks;
 
-    numLocks = totalVirtualMemPages / PAGES_PER_LOCK;
+    numLocks = totalVirtualMemPages >> pagesPerLockShift;
 
     //
     // If integer division rounds number of locks down, increment by
     // one to avoid error
     //
 
-    if (totalVirtualMemPages % PAGES_PER_LOCK != 0) {
+    if ((totalVirtualMemPages & (pagesPerLock - 1)) != 0) {
 
         numLocks++;
 
@@ -111,12 +195,25 @@ initPTELocks(ULONG_PTR totalVirtualMemPages)
 
     }
 
-    for (int i = 0; i <= numLocks; i++) {
+    for (ULONG_PTR i = 0; i < numLocks; i++) {
 
         InitializeCriticalSection(&PTELockArray[i]);
 
     }
 
+    //
+    // Allocate a sequence counter alongside each lock (zeroed - even means no write in progress)
+    //
+
+    PTESequenceArray = VirtualAlloc(NULL, numLocks * sizeof(ULONG64), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (PTESequenceArray == NULL) {
+
+        PRINT_ERROR("Unable to allocate for PTE sequence counters\n");
+        exit(-1);
+
+    }
+
 }
 
 
@@ -134,25 +231,27 @@ freePTELocks(PCRITICAL_SECTION LockArray, ULONG_PTR totalVirtualMemPages)
 
     }
 
-    numLocks = totalVirtualMemPages / PAGES_PER_LOCK;
+    numLocks = totalVirtualMemPages >> pagesPerLockShift;
 
     //
     // If integer division rounds number of locks down, increment by
     // one to avoid error
     //
 
-    if (totalVirtualMemPages % PAGES_PER_LOCK != 0) {
+    if ((totalVirtualMemPages & (pagesPerLock - 1)) != 0) {
 
         numLocks++;
 
     }
 
-    for (int i = 0; i <= numLocks; i++) {
+    for (ULONG_PTR i = 0; i < numLocks; i++) {
 
         DeleteCriticalSection(&PTELockArray[i]);
 
     }
 
+    VirtualFree((PVOID) PTESequenceArray, 0, MEM_RELEASE);
+
     bRes = VirtualFree(LockArray, 0, MEM_RELEASE);
 
     if (bRes == FALSE) {
@@ -174,7 +273,7 @@ getLockIndex(PPTE currPTE)
 
     PTEIndex = currPTE - PTEarray;
 
-    return PTEIndex / PAGES_PER_LOCK;
+    return PTEIndex >> pagesPerLockShift;
 
 }
 
@@ -189,6 +288,72 @@ acquirePTELock(PPTE currPTE)
 
     EnterCriticalSection(&PTELockArray[lockIndex]);
 
+    //
+    // The page table page must be resident for as long as the lock is held - if
+    // it cannot be faulted in for lack of pages, release the lock (so trimming can
+    // proceed) and wait
+    //
+
+    while (makePageTableResident(currPTE) == FALSE) {
+
+        LeaveCriticalSection(&PTELockArray[lockIndex]);
+
+        waitForAvailablePages();
+
+        EnterCriticalSection(&PTELockArray[lockIndex]);
+
+    }
+
+}
+
+
+BOOLEAN
+acquirePTELockIfResident(PPTE currPTE) 
+{
+
+    ULONG_PTR lockIndex;
+
+    lockIndex = getLockIndex(currPTE);
+
+    EnterCriticalSection(&PTELockArray[lockIndex]);
+
+    if (isPageTableResident(currPTE) == FALSE) {
+
+        LeaveCriticalSection(&PTELockArray[lockIndex]);
+
+        return FALSE;
+
+    }
+
+    return TRUE;
+
+}
+
+
+BOOLEAN
+tryAcquirePTELockIfResident(PPTE currPTE) 
+{
+
+    ULONG_PTR lockIndex;
+
+    lockIndex = getLockIndex(currPTE);
+
+    if (TryEnterCriticalSection(&PTELockArray[lockIndex]) == FALSE) {
+
+        return FALSE;
+
+    }
+
+    if (isPageTableResident(currPTE) == FALSE) {
+
+        LeaveCriticalSection(&PTELockArray[lockIndex]);
+
+        return FALSE;
+
+    }
+
+    return TRUE;
+
 }
 
 
@@ -238,9 +403,43 @@ acquireOrHoldSubsequentPTELock(PPTE currPTE, PPTE prevPTE)
     } else {
 
         LeaveCriticalSection(&PTELockArray[prevLockIndex]);
-        EnterCriticalSection(&PTELockArray[currLockIndex]);
+        acquirePTELock(currPTE);
         return TRUE;
 
     }
 
-}
\ No newline at end of file
+}
+
+
+ULONG64
+readPTESequence(PPTE currPTE)
+{
+
+    return PTESequenceArray[getLockIndex(currPTE)];
+
+}
+
+
+BOOLEAN
+checkPTESequence(PPTE currPTE, ULONG64 sequence)
+{
+
+    //
+    // Odd sequence means a write was in progress when the read began
+    //
+
+    if (sequence & 1) {
+
+        return FALSE;
+
+    }
+
+    //
+    // Order the caller's PTE reads before the sequence re-read
+    //
+
+    MemoryBarrier();
+
+    return (PTESequenceArray[getLockIndex(currPTE)] == sequence);
+
+}
@@ -1,15 +1,15 @@
-#include <stdio.h>
-#include <windows.h>
 #include "../usermodeMemoryManager.h"
 
 /*
  * acquireJLock: function to acquire a lock
  *  - spins until successful
+ *  - the lock is bit 0 of the word - the other bits are preserved, and may only
+ *    be written by the lock holder (PFN status/state bits share the word)
  * 
  * No return value
  */
 VOID
-acquireJLock(volatile PLONG lock);
+acquireJLock(volatile LONG* lock);
 
 
 /*
@@ -18,7 +18,7 @@ acquireJLock(volatile PLONG lock);
  * No return value
  */
 VOID 
-releaseJLock(volatile PLONG lock);
+releaseJLock(volatile LONG* lock);
 
 
 /*
@@ -29,7 +29,43 @@ releaseJLock(volatile PLONG lock);
  *  - FALSE if currently held elsewhere
  */
 BOOL 
-tryAcquireJLock(volatile PLONG lock);
+tryAcquireJLock(volatile LONG* lock);
+
+
+/*
+ * backoffSpin: function to pause between attempts at a contended word
+ *  - spins for *currSpins pause instructions, then doubles *currSpins (up to a cap)
+ *  - *currSpins should start at zero for each new wait
+ * 
+ * No return value
+ */
+VOID
+backoffSpin(PULONG currSpins);
+
+
+/*
+ * readPFNstate: function to snapshot a PFN's state word without its lock
+ *  - fields may change once the snapshot is taken unless the lock is held
+ * 
+ * Returns PFNstate
+ *  - snapshot of the state word
+ */
+PFNstate
+readPFNstate(PPFNdata PFN);
+
+
+/*
+ * compareExchangePFNstate: function to transition a PFN's state word in a
+ * single CAS, without acquiring the PFN lock
+ *  - fails if oldState has the lock bit set (the holder may be mid-update), or
+ *    if newState would set it
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if the state word was oldState and is now newState
+ *  - FALSE otherwise (caller re-reads and retries)
+ */
+BOOLEAN
+compareExchangePFNstate(PPFNdata PFN, PFNstate oldState, PFNstate newState);
 
 
 VOID
@@ -76,6 +112,8 @@ getLockIndex(PPTE currPTE);
 
 /* 
  * acquirePTELock: function to acquire PTE lock corresponding to given PTE
+ *  - also faults in the PTE's page table page if it has been trimmed (the lock
+ *    is released while waiting for an available page)
  * 
  * No return value
  */
@@ -83,6 +121,35 @@ VOID
 acquirePTELock(PPTE currPTE);
 
 
+/* 
+ * acquirePTELockIfResident: function to acquire PTE lock corresponding to given PTE
+ * only if its page table page is resident
+ *  - for scanners (i.e. the trimmer) that must neither fault in page table pages nor
+ *    count as a use of them
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if the lock was acquired (page table page is resident)
+ *  - FALSE otherwise (lock not held)
+ */
+BOOLEAN
+acquirePTELockIfResident(PPTE currPTE);
+
+
+
+/* 
+ * tryAcquirePTELockIfResident: function to acquire PTE lock corresponding to given PTE
+ * without waiting, and only if its page table page is resident
+ *  - for callers already holding PTE or page locks, which must not wait on
+ *    another PTE lock
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if the lock was acquired (page table page is resident)
+ *  - FALSE otherwise (lock not held)
+ */
+BOOLEAN
+tryAcquirePTELockIfResident(PPTE currPTE);
+
+
 /*
  * acquirePTELock: function to release PTE lock corresponding to given PTE
  * 
@@ -103,3 +170,28 @@ releasePTELock(PPTE currPTE);
  */
 BOOLEAN
 acquireOrHoldSubsequentPTELock(PPTE currPTE, PPTE prevPTE);
+
+
+/*
+ * readPTESequence: function to begin a lock-free read of a PTE
+ *  - returns the sequence counter of the PTE's lock group, to be passed to
+ *    checkPTESequence once the PTE has been read
+ * 
+ * Returns ULONG64
+ *  - current sequence value
+ */
+ULONG64
+readPTESequence(PPTE currPTE);
+
+
+/*
+ * checkPTESequence: function to validate a lock-free read of a PTE
+ *  - fails if a write to the lock group was in progress at, or has occurred
+ *    since, the readPTESequence call
+ * 
+ * Returns BOOLEAN
+ *  - TRUE if the read is consistent
+ *  - FALSE if the read must be retried (or done under the PTE lock)
+ */
+BOOLEAN
+checkPTESequence(PPTE currPTE, ULONG64 sequence);
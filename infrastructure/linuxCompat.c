@@ -0,0 +1,784 @@
+#ifndef _WIN32
+
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include "../usermodeMemoryManager.h"
+
+
+/******************************************************
+ ********************** Handles ***********************
+ *****************************************************/
+
+typedef enum {
+    EVENT_HANDLE,
+    THREAD_HANDLE,
+} handleType;
+
+typedef struct _compatHandle {
+    handleType type;
+    BOOL manualReset;
+    volatile LONG signaled;
+    volatile ULONG64 setCount;              // bumped on every set so a set-then-reset still releases current waiters
+    pthread_t thread;
+    LPTHREAD_START_ROUTINE startAddress;
+    PVOID parameter;
+} compatHandle, *PcompatHandle;
+
+//
+// All waits share one mutex/condition pair - waits are infrequent enough that
+// a broadcast per signal is far cheaper than the simulated work around them
+//
+
+static pthread_mutex_t handleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handleCondition = PTHREAD_COND_INITIALIZER;
+
+
+VOID
+InitializeCriticalSection(PCRITICAL_SECTION criticalSection)
+{
+
+    pthread_mutexattr_t attributes;
+
+    //
+    // Critical sections are recursive on Windows (trimPTE relies on this)
+    //
+
+    pthread_mutexattr_init(&attributes);
+
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+
+    pthread_mutex_init(criticalSection, &attributes);
+
+    pthread_mutexattr_destroy(&attributes);
+
+}
+
+
+HANDLE
+CreateEvent(PVOID eventAttributes, BOOL manualReset, BOOL initialState, PVOID name)
+{
+
+    PcompatHandle newHandle;
+
+    newHandle = calloc(1, sizeof(compatHandle));
+
+    if (newHandle == NULL) {
+        return NULL;
+    }
+
+    newHandle->type = EVENT_HANDLE;
+    newHandle->manualReset = manualReset;
+    newHandle->signaled = initialState ? TRUE : FALSE;
+
+    return (HANDLE) newHandle;
+
+}
+
+
+static VOID
+signalHandle(PcompatHandle handle)
+{
+
+    pthread_mutex_lock(&handleLock);
+
+    handle->signaled = TRUE;
+
+    handle->setCount++;
+
+    pthread_cond_broadcast(&handleCondition);
+
+    pthread_mutex_unlock(&handleLock);
+
+}
+
+
+BOOL
+SetEvent(HANDLE event)
+{
+
+    PcompatHandle handle;
+
+    handle = (PcompatHandle) event;
+
+    //
+    // Manual reset events that are already set need no wakeup - every waiter
+    // that could observe them would also observe the signaled state
+    //
+
+    if (handle->manualReset && handle->signaled) {
+        return TRUE;
+    }
+
+    signalHandle(handle);
+
+    return TRUE;
+
+}
+
+
+BOOL
+ResetEvent(HANDLE event)
+{
+
+    PcompatHandle handle;
+
+    handle = (PcompatHandle) event;
+
+    __atomic_store_n(&handle->signaled, FALSE, __ATOMIC_SEQ_CST);
+
+    return TRUE;
+
+}
+
+
+static PVOID
+threadStart(PVOID parameter)
+{
+
+    PcompatHandle handle;
+
+    handle = (PcompatHandle) parameter;
+
+    handle->startAddress(handle->parameter);
+
+    signalHandle(handle);
+
+    return NULL;
+
+}
+
+
+HANDLE
+CreateThread(PVOID threadAttributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE startAddress, PVOID parameter, DWORD creationFlags, PDWORD threadId)
+{
+
+    PcompatHandle newHandle;
+
+    newHandle = calloc(1, sizeof(compatHandle));
+
+    if (newHandle == NULL) {
+        return NULL;
+    }
+
+    newHandle->type = THREAD_HANDLE;
+    newHandle->manualReset = TRUE;
+    newHandle->startAddress = startAddress;
+    newHandle->parameter = parameter;
+
+    if (pthread_create(&newHandle->thread, NULL, threadStart, newHandle) != 0) {
+
+        free(newHandle);
+        return NULL;
+
+    }
+
+    pthread_detach(newHandle->thread);
+
+    if (threadId != NULL) {
+        *threadId = (DWORD) (ULONG_PTR) newHandle->thread;
+    }
+
+    return (HANDLE) newHandle;
+
+}
+
+
+DWORD
+WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds)
+{
+
+    PcompatHandle currHandle;
+    ULONG64 startCounts[64];
+    struct timespec deadline;
+    DWORD numSatisfied;
+    DWORD firstSatisfied;
+    DWORD i;
+    int waitResult;
+
+    if (count == 0 || count > ARRAYSIZE(startCounts)) {
+        return WAIT_FAILED;
+    }
+
+    if (milliseconds != INFINITE) {
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_sec += milliseconds / 1000;
+        deadline.tv_nsec += (long) (milliseconds % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+    }
+
+    pthread_mutex_lock(&handleLock);
+
+    for (i = 0; i < count; i++) {
+        startCounts[i] = ((PcompatHandle) handles[i])->setCount;
+    }
+
+    while (TRUE) {
+
+        numSatisfied = 0;
+        firstSatisfied = count;
+
+        for (i = 0; i < count; i++) {
+
+            currHandle = (PcompatHandle) handles[i];
+
+            //
+            // A manual reset event set (and possibly reset) since the wait began
+            // satisfies the wait, matching Windows' release-on-set semantics
+            //
+
+            if (currHandle->signaled || (currHandle->manualReset && currHandle->setCount != startCounts[i])) {
+
+                numSatisfied++;
+
+                if (firstSatisfied == count) {
+                    firstSatisfied = i;
+                }
+
+            }
+
+        }
+
+        if (waitAll == FALSE && numSatisfied != 0) {
+
+            currHandle = (PcompatHandle) handles[firstSatisfied];
+
+            if (currHandle->manualReset == FALSE) {
+                currHandle->signaled = FALSE;
+            }
+
+            pthread_mutex_unlock(&handleLock);
+
+            return WAIT_OBJECT_0 + firstSatisfied;
+
+        }
+
+        if (waitAll == TRUE && numSatisfied == count) {
+
+            for (i = 0; i < count; i++) {
+
+                currHandle = (PcompatHandle) handles[i];
+
+                if (currHandle->manualReset == FALSE) {
+                    currHandle->signaled = FALSE;
+                }
+
+            }
+
+            pthread_mutex_unlock(&handleLock);
+
+            return WAIT_OBJECT_0;
+
+        }
+
+        if (milliseconds == INFINITE) {
+
+            pthread_cond_wait(&handleCondition, &handleLock);
+
+        } else {
+
+            waitResult = pthread_cond_timedwait(&handleCondition, &handleLock, &deadline);
+
+            if (waitResult == ETIMEDOUT) {
+
+                pthread_mutex_unlock(&handleLock);
+
+                return WAIT_TIMEOUT;
+
+            }
+
+        }
+
+    }
+
+}
+
+
+DWORD
+WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+
+    return WaitForMultipleObjects(1, &handle, FALSE, milliseconds);
+
+}
+
+
+BOOL
+CloseHandle(HANDLE handle)
+{
+
+    PcompatHandle currHandle;
+
+    currHandle = (PcompatHandle) handle;
+
+    if (currHandle == NULL || handle == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    //
+    // Thread handles are leaked deliberately - a detached thread may still be
+    // signaling its handle on exit
+    //
+
+    if (currHandle->type == EVENT_HANDLE) {
+        free(currHandle);
+    }
+
+    return TRUE;
+
+}
+
+
+VOID
+Sleep(DWORD milliseconds)
+{
+
+    usleep((useconds_t) milliseconds * 1000);
+
+}
+
+
+/******************************************************
+ *************** Structured exceptions ****************
+ *****************************************************/
+
+#define MAX_VECTORED_HANDLERS 8
+
+static __thread PcompatTryFrame currentTryFrame;
+static pthread_once_t exceptionHandlerOnce = PTHREAD_ONCE_INIT;
+
+static PVECTORED_EXCEPTION_HANDLER vectoredHandlers[MAX_VECTORED_HANDLERS];
+static pthread_mutex_t vectoredHandlerLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static ULONG_PTR
+getAccessType(PVOID context)
+{
+
+    #if defined(__x86_64__)
+
+        greg_t errorCode;
+
+        //
+        // x86 page fault error code: bit 1 is set for writes, bit 4 for instruction fetches
+        //
+
+        errorCode = ((ucontext_t*) context)->uc_mcontext.gregs[REG_ERR];
+
+        if (errorCode & 0x10) {
+            return 8;
+        }
+
+        if (errorCode & 0x2) {
+            return 1;
+        }
+
+    #endif
+
+    return 0;
+
+}
+
+
+static VOID
+exceptionHandler(int signalNumber, siginfo_t* signalInfo, PVOID context)
+{
+
+    PcompatTryFrame frame;
+    EXCEPTION_RECORD exceptionRecord;
+    EXCEPTION_POINTERS exceptionPointers;
+    PVECTORED_EXCEPTION_HANDLER currHandler;
+
+    memset(&exceptionRecord, 0, sizeof(exceptionRecord));
+
+    exceptionRecord.ExceptionCode = EXCEPTION_ACCESS_VIOLATION;
+    exceptionRecord.NumberParameters = 2;
+    exceptionRecord.ExceptionInformation[0] = getAccessType(context);
+    exceptionRecord.ExceptionInformation[1] = (ULONG_PTR) signalInfo->si_addr;
+
+    exceptionPointers.ExceptionRecord = &exceptionRecord;
+    exceptionPointers.ContextRecord = context;
+
+    for (int i = 0; i < MAX_VECTORED_HANDLERS; i++) {
+
+        currHandler = vectoredHandlers[i];
+
+        if (currHandler != NULL && currHandler(&exceptionPointers) == EXCEPTION_CONTINUE_EXECUTION) {
+
+            return;
+
+        }
+
+    }
+
+    frame = currentTryFrame;
+
+    //
+    // Faults outside of a _try block are fatal, as they would be on Windows -
+    // restore the default action and let the faulting instruction rerun
+    //
+
+    if (frame == NULL) {
+
+        signal(signalNumber, SIG_DFL);
+
+        return;
+
+    }
+
+    currentTryFrame = frame->previous;
+
+    siglongjmp(frame->jumpBuffer, 1);
+
+}
+
+
+static VOID
+installExceptionHandler()
+{
+
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+
+    action.sa_sigaction = exceptionHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, NULL);
+
+    sigaction(SIGBUS, &action, NULL);
+
+}
+
+
+PcompatTryFrame
+compatPushTryFrame(PcompatTryFrame frame)
+{
+
+    pthread_once(&exceptionHandlerOnce, installExceptionHandler);
+
+    frame->previous = currentTryFrame;
+
+    currentTryFrame = frame;
+
+    return frame;
+
+}
+
+
+PVOID
+AddVectoredExceptionHandler(ULONG first, PVECTORED_EXCEPTION_HANDLER handler)
+{
+
+    PVOID handle;
+
+    pthread_once(&exceptionHandlerOnce, installExceptionHandler);
+
+    handle = NULL;
+
+    pthread_mutex_lock(&vectoredHandlerLock);
+
+    if (first) {
+
+        //
+        // Shift existing handlers down to make room at the front
+        //
+
+        if (vectoredHandlers[MAX_VECTORED_HANDLERS - 1] == NULL) {
+
+            for (int i = MAX_VECTORED_HANDLERS - 1; i > 0; i--) {
+                vectoredHandlers[i] = vectoredHandlers[i - 1];
+            }
+
+            vectoredHandlers[0] = handler;
+            handle = (PVOID) handler;
+
+        }
+
+    } else {
+
+        for (int i = 0; i < MAX_VECTORED_HANDLERS; i++) {
+
+            if (vectoredHandlers[i] == NULL) {
+
+                vectoredHandlers[i] = handler;
+                handle = (PVOID) handler;
+                break;
+
+            }
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&vectoredHandlerLock);
+
+    //
+    // The handle is the handler itself, since slots shift as handlers are added/removed
+    //
+
+    return handle;
+
+}
+
+
+ULONG
+RemoveVectoredExceptionHandler(PVOID handle)
+{
+
+    ULONG removed;
+
+    removed = 0;
+
+    pthread_mutex_lock(&vectoredHandlerLock);
+
+    for (int i = 0; i < MAX_VECTORED_HANDLERS; i++) {
+
+        if ((PVOID) vectoredHandlers[i] == handle) {
+
+            for (int j = i; j < MAX_VECTORED_HANDLERS - 1; j++) {
+                vectoredHandlers[j] = vectoredHandlers[j + 1];
+            }
+
+            vectoredHandlers[MAX_VECTORED_HANDLERS - 1] = NULL;
+            removed = 1;
+            break;
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&vectoredHandlerLock);
+
+    return removed;
+
+}
+
+
+VOID
+compatPopTryFrame(PcompatTryFrame* frame)
+{
+
+    //
+    // Frame has already been popped if its _except block ran
+    //
+
+    if (currentTryFrame == *frame) {
+
+        currentTryFrame = (*frame)->previous;
+
+    }
+
+}
+
+
+/******************************************************
+ ******************* Virtual memory *******************
+ *****************************************************/
+
+#define MAX_ALLOCATIONS 256
+
+//
+// mmap has no notion of a reservation, so VirtualFree(MEM_RELEASE) needs the size
+// of the original allocation - track them here
+//
+
+typedef struct _allocationRecord {
+    PVOID base;
+    SIZE_T size;
+} allocationRecord;
+
+static allocationRecord allocationTable[MAX_ALLOCATIONS];
+static pthread_mutex_t allocationLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int
+getLinuxProtection(DWORD protect)
+{
+
+    switch (protect) {
+
+        case PAGE_NOACCESS:
+            return PROT_NONE;
+
+        case PAGE_READONLY:
+            return PROT_READ;
+
+        case PAGE_READWRITE:
+            return PROT_READ | PROT_WRITE;
+
+        case PAGE_EXECUTE_READ:
+            return PROT_READ | PROT_EXEC;
+
+        case PAGE_EXECUTE_READWRITE:
+            return PROT_READ | PROT_WRITE | PROT_EXEC;
+
+        default:
+            return PROT_NONE;
+
+    }
+
+}
+
+
+PVOID
+VirtualAlloc(PVOID address, SIZE_T size, DWORD allocationType, DWORD protect)
+{
+
+    ULONG_PTR pageMask;
+    ULONG_PTR startAddress;
+    ULONG_PTR endAddress;
+    PVOID newAllocation;
+    int i;
+
+    pageMask = (ULONG_PTR) sysconf(_SC_PAGESIZE) - 1;
+
+    //
+    // Commit within an existing reservation
+    //
+
+    if (address != NULL) {
+
+        if ((allocationType & MEM_COMMIT) == 0) {
+            return NULL;
+        }
+
+        startAddress = (ULONG_PTR) address & ~pageMask;
+        endAddress = ((ULONG_PTR) address + size + pageMask) & ~pageMask;
+
+        if (mprotect((PVOID) startAddress, endAddress - startAddress, getLinuxProtection(protect)) != 0) {
+            return NULL;
+        }
+
+        return address;
+
+    }
+
+    size = (size + pageMask) & ~pageMask;
+
+    newAllocation = mmap(NULL, size, (allocationType & MEM_COMMIT) ? getLinuxProtection(protect) : PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (newAllocation == MAP_FAILED) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&allocationLock);
+
+    for (i = 0; i < MAX_ALLOCATIONS; i++) {
+
+        if (allocationTable[i].base == NULL) {
+
+            allocationTable[i].base = newAllocation;
+            allocationTable[i].size = size;
+            break;
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&allocationLock);
+
+    if (i == MAX_ALLOCATIONS) {
+
+        munmap(newAllocation, size);
+        return NULL;
+
+    }
+
+    return newAllocation;
+
+}
+
+
+BOOL
+VirtualFree(PVOID address, SIZE_T size, DWORD freeType)
+{
+
+    ULONG_PTR pageMask;
+    ULONG_PTR startAddress;
+    ULONG_PTR endAddress;
+    int i;
+
+    if (freeType & MEM_DECOMMIT) {
+
+        pageMask = (ULONG_PTR) sysconf(_SC_PAGESIZE) - 1;
+
+        startAddress = (ULONG_PTR) address & ~pageMask;
+        endAddress = ((ULONG_PTR) address + size + pageMask) & ~pageMask;
+
+        //
+        // Discard contents (recommitted memory reads back as zero, as on Windows)
+        //
+
+        madvise((PVOID) startAddress, endAddress - startAddress, MADV_DONTNEED);
+
+        return mprotect((PVOID) startAddress, endAddress - startAddress, PROT_NONE) == 0;
+
+    }
+
+    pthread_mutex_lock(&allocationLock);
+
+    for (i = 0; i < MAX_ALLOCATIONS; i++) {
+
+        if (allocationTable[i].base == address) {
+
+            munmap(address, allocationTable[i].size);
+
+            allocationTable[i].base = NULL;
+            allocationTable[i].size = 0;
+
+            pthread_mutex_unlock(&allocationLock);
+
+            return TRUE;
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&allocationLock);
+
+    return FALSE;
+
+}
+
+
+BOOL
+VirtualProtect(PVOID address, SIZE_T size, DWORD newProtect, PDWORD oldProtect)
+{
+
+    if (oldProtect != NULL) {
+        *oldProtect = PAGE_READWRITE;
+    }
+
+    return mprotect(address, size, getLinuxProtection(newProtect)) == 0;
+
+}
+
+
+/******************************************************
+ *********************** Misc *************************
+ *****************************************************/
+
+DWORD
+GetTickCount()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (DWORD) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+
+}
+
+#endif
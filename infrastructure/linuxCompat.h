@@ -0,0 +1,261 @@
+#ifndef LINUXCOMPAT_H
+#define LINUXCOMPAT_H
+
+/*
+ * Thin Win32 shim for non-Windows builds
+ *  - only the subset of the Win32 API used by the memory manager is provided
+ *  - physical page (AWE) emulation is NOT done here - see physicalPages.c
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+
+/********************************************************************
+ ************************* Basic types ******************************
+ *******************************************************************/
+
+#define VOID void
+#define WINAPI
+#define TRUE 1
+#define FALSE 0
+
+typedef char CHAR;
+typedef unsigned char UCHAR, *PUCHAR;
+typedef unsigned char BOOLEAN, *PBOOLEAN;
+typedef unsigned char BYTE, *PBYTE;
+typedef unsigned short USHORT, *PUSHORT;
+typedef int BOOL;
+typedef int LONG, *PLONG;
+typedef unsigned int ULONG, *PULONG;
+typedef unsigned int DWORD, *PDWORD;
+typedef long long LONG64, *PLONG64;
+typedef unsigned long long ULONG64, *PULONG64;
+typedef long long LONG_PTR, *PLONG_PTR;
+typedef unsigned long long ULONG_PTR, *PULONG_PTR;
+typedef unsigned long long SIZE_T;
+typedef void* PVOID;
+typedef void* HANDLE;
+
+#define MAXULONG_PTR (~((ULONG_PTR) 0))
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+#define CONTAINING_RECORD(address, type, field) ((type *)((PUCHAR)(address) - offsetof(type, field)))
+
+#define ARRAYSIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+
+/********************************************************************
+ ********************** Interlocked operations **********************
+ *******************************************************************/
+
+#define InterlockedCompareExchange(dest, exchange, comparand) __sync_val_compare_and_swap((dest), (comparand), (exchange))
+
+#define InterlockedCompareExchange64(dest, exchange, comparand) __sync_val_compare_and_swap((dest), (comparand), (exchange))
+
+#define InterlockedIncrement(addend) __sync_add_and_fetch((addend), 1)
+
+#define InterlockedDecrement(addend) __sync_sub_and_fetch((addend), 1)
+
+#define InterlockedIncrement64(addend) __sync_add_and_fetch((addend), 1)
+
+#define InterlockedIncrementAcquire(addend) __sync_add_and_fetch((addend), 1)
+
+#define InterlockedDecrement64(addend) __sync_sub_and_fetch((addend), 1)
+
+#define InterlockedAdd64(addend, value) __sync_add_and_fetch((addend), (value))
+
+#define InterlockedExchangeAdd64(addend, value) __sync_fetch_and_add((addend), (value))
+
+#define InterlockedExchange(dest, value) __atomic_exchange_n((dest), (value), __ATOMIC_SEQ_CST)
+
+#define InterlockedAnd(dest, value) __sync_fetch_and_and((dest), (value))
+
+#define InterlockedOr(dest, value) __sync_fetch_and_or((dest), (value))
+
+#define InterlockedOr64(dest, value) __sync_fetch_and_or((dest), (value))
+
+#define InterlockedAnd64(dest, value) __sync_fetch_and_and((dest), (value))
+
+#define MemoryBarrier() __sync_synchronize()
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor() __builtin_ia32_pause()
+#else
+#define YieldProcessor() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define DebugBreak() raise(SIGTRAP)
+
+
+/********************************************************************
+ ************************ Structured exceptions *********************
+ *******************************************************************/
+
+//
+// SEH is emulated with a per-thread stack of sigsetjmp frames - a SIGSEGV/SIGBUS
+// raised while a frame is pushed unwinds to that frame's _except block.
+//  - the frame is pushed by _try and popped when the enclosing block is left
+//    (so a single _try per block, and it should end the block)
+//  - the exception filter is ignored (always EXCEPTION_EXECUTE_HANDLER)
+//
+
+#define EXCEPTION_EXECUTE_HANDLER 1
+
+typedef struct _compatTryFrame {
+    sigjmp_buf jumpBuffer;
+    struct _compatTryFrame* previous;
+} compatTryFrame, *PcompatTryFrame;
+
+PcompatTryFrame
+compatPushTryFrame(PcompatTryFrame frame);
+
+VOID
+compatPopTryFrame(PcompatTryFrame* frame);
+
+#define _try \
+    compatTryFrame _tryFrame; \
+    PcompatTryFrame _tryScope __attribute__((cleanup(compatPopTryFrame))) = compatPushTryFrame(&_tryFrame); \
+    if (sigsetjmp(_tryFrame.jumpBuffer, 1) == 0)
+
+#define _except(filter) else
+
+//
+// Vectored exception handlers run ahead of any _try frame, with an access
+// violation record built from the SIGSEGV/SIGBUS siginfo
+//
+
+#define EXCEPTION_ACCESS_VIOLATION 0xC0000005
+#define EXCEPTION_CONTINUE_EXECUTION (-1)
+#define EXCEPTION_CONTINUE_SEARCH 0
+#define EXCEPTION_MAXIMUM_PARAMETERS 15
+
+typedef struct _EXCEPTION_RECORD {
+    DWORD ExceptionCode;
+    DWORD ExceptionFlags;
+    struct _EXCEPTION_RECORD* ExceptionRecord;
+    PVOID ExceptionAddress;
+    DWORD NumberParameters;
+    ULONG_PTR ExceptionInformation[EXCEPTION_MAXIMUM_PARAMETERS];
+} EXCEPTION_RECORD, *PEXCEPTION_RECORD;
+
+typedef struct _EXCEPTION_POINTERS {
+    PEXCEPTION_RECORD ExceptionRecord;
+    PVOID ContextRecord;
+} EXCEPTION_POINTERS, *PEXCEPTION_POINTERS;
+
+typedef LONG (*PVECTORED_EXCEPTION_HANDLER)(PEXCEPTION_POINTERS);
+
+PVOID
+AddVectoredExceptionHandler(ULONG first, PVECTORED_EXCEPTION_HANDLER handler);
+
+ULONG
+RemoveVectoredExceptionHandler(PVOID handle);
+
+
+/********************************************************************
+ ************************ Critical sections *************************
+ *******************************************************************/
+
+typedef pthread_mutex_t CRITICAL_SECTION, *PCRITICAL_SECTION;
+
+VOID
+InitializeCriticalSection(PCRITICAL_SECTION criticalSection);
+
+#define EnterCriticalSection(criticalSection) pthread_mutex_lock(criticalSection)
+
+#define LeaveCriticalSection(criticalSection) pthread_mutex_unlock(criticalSection)
+
+#define TryEnterCriticalSection(criticalSection) (pthread_mutex_trylock(criticalSection) == 0)
+
+#define DeleteCriticalSection(criticalSection) pthread_mutex_destroy(criticalSection)
+
+
+/********************************************************************
+ ********************* Events, threads and waits ********************
+ *******************************************************************/
+
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0x00000000
+#define WAIT_ABANDONED 0x00000080
+#define WAIT_TIMEOUT 0x00000102
+#define WAIT_FAILED 0xFFFFFFFF
+
+#define INVALID_HANDLE_VALUE ((HANDLE) -1)
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(PVOID);
+
+HANDLE
+CreateEvent(PVOID eventAttributes, BOOL manualReset, BOOL initialState, PVOID name);
+
+BOOL
+SetEvent(HANDLE event);
+
+BOOL
+ResetEvent(HANDLE event);
+
+HANDLE
+CreateThread(PVOID threadAttributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE startAddress, PVOID parameter, DWORD creationFlags, PDWORD threadId);
+
+DWORD
+WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+
+DWORD
+WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds);
+
+BOOL
+CloseHandle(HANDLE handle);
+
+VOID
+Sleep(DWORD milliseconds);
+
+
+/********************************************************************
+ ************************* Virtual memory ***************************
+ *******************************************************************/
+
+#define MEM_COMMIT 0x00001000
+#define MEM_RESERVE 0x00002000
+#define MEM_DECOMMIT 0x00004000
+#define MEM_RELEASE 0x00008000
+#define MEM_PHYSICAL 0x00400000
+
+#define PAGE_NOACCESS 0x01
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define PAGE_EXECUTE_READ 0x20
+#define PAGE_EXECUTE_READWRITE 0x40
+
+PVOID
+VirtualAlloc(PVOID address, SIZE_T size, DWORD allocationType, DWORD protect);
+
+BOOL
+VirtualFree(PVOID address, SIZE_T size, DWORD freeType);
+
+BOOL
+VirtualProtect(PVOID address, SIZE_T size, DWORD newProtect, PDWORD oldProtect);
+
+
+/********************************************************************
+ ***************************** Misc *********************************
+ *******************************************************************/
+
+#define ERROR_SUCCESS 0
+
+#define GetLastError() ((DWORD) errno)
+
+DWORD
+GetTickCount();
+
+
+#endif //LINUXCOMPAT_H
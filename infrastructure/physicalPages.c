@@ -0,0 +1,436 @@
+#include "../usermodeMemoryManager.h"
+#include "physicalPages.h"
+
+#ifdef _WIN32
+
+/******************************************************
+ ******************** AWE backend *********************
+ *****************************************************/
+
+HANDLE physicalPageHandle;              // for multi-mapped pages (to support multithreading)
+
+
+BOOL
+LoggedSetLockPagesPrivilege ( HANDLE hProcess,
+                            BOOL bEnable)
+{
+    struct {
+        DWORD Count;
+        LUID_AND_ATTRIBUTES Privilege [1];
+    } Info;
+
+    HANDLE Token;
+    BOOL Result;
+
+    // Open the token.
+
+    Result = OpenProcessToken ( hProcess,
+                                TOKEN_ADJUST_PRIVILEGES,
+                                & Token);
+
+    if( Result != TRUE )
+    {
+        _tprintf( _T("Cannot open process token.\n") );
+        return FALSE;
+    }
+
+    // Enable or disable?
+
+    Info.Count = 1;
+    if( bEnable )
+    {
+        Info.Privilege[0].Attributes = SE_PRIVILEGE_ENABLED;
+    }
+    else
+    {
+        Info.Privilege[0].Attributes = 0;
+    }
+
+    // Get the LUID.
+
+    Result = LookupPrivilegeValue ( NULL,
+                                    SE_LOCK_MEMORY_NAME,
+                                    &(Info.Privilege[0].Luid));
+
+    if( Result != TRUE )
+    {
+        _tprintf( _T("Cannot get privilege for %s.\n"), SE_LOCK_MEMORY_NAME );
+        return FALSE;
+    }
+
+    // Adjust the privilege.
+
+    Result = AdjustTokenPrivileges ( Token, FALSE,
+                                    (PTOKEN_PRIVILEGES) &Info,
+                                    0, NULL, NULL);
+
+    // Check the result.
+
+    if( Result != TRUE )
+    {
+        _tprintf (_T("Cannot adjust token privileges (%u)\n"), GetLastError() );
+        return FALSE;
+    }
+    else
+    {
+        if( GetLastError() != ERROR_SUCCESS )
+        {
+        _tprintf (_T("Cannot enable the SE_LOCK_MEMORY_NAME privilege; "));
+        _tprintf (_T("please check the local policy.\n"));
+        return FALSE;
+        }
+    }
+
+    CloseHandle( Token );
+
+    return TRUE;
+}
+
+
+BOOL
+getPrivilege()
+{
+
+    BOOL bResult;
+    bResult = LoggedSetLockPagesPrivilege( GetCurrentProcess(), TRUE );
+    return bResult;
+
+}
+
+
+ULONG_PTR
+allocatePhysPages(ULONG_PTR numPages, PULONG_PTR arrayPFNs)
+{
+
+    BOOL bResult;
+    ULONG_PTR numPagesAllocated;
+
+    //
+    // Secure privilege for the code
+    //
+
+    bResult = getPrivilege();
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("could not get privilege successfully \n");
+        exit(-1);
+
+    }
+
+
+    numPagesAllocated = numPages;
+
+
+
+    #ifdef MULTIPLE_MAPPINGS
+
+    MEM_EXTENDED_PARAMETER extendedParameters = {0};
+
+
+    extendedParameters.Type = MemSectionExtendedParameterUserPhysicalFlags;
+    extendedParameters.ULong64 = 0;
+
+    physicalPageHandle = CreateFileMapping2(NULL,
+                                            NULL,
+                                            SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                            PAGE_READWRITE,
+                                            SEC_RESERVE,
+                                            0,
+                                            NULL,
+                                            &extendedParameters,
+                                            1 );
+
+    if (physicalPageHandle == NULL) {
+
+        PRINT_ERROR("could not create file mapping\n");
+        exit(-1);
+
+    }
+
+
+    #else
+
+    physicalPageHandle = GetCurrentProcess();
+
+    #endif
+
+    bResult = AllocateUserPhysicalPages(physicalPageHandle, &numPagesAllocated, arrayPFNs);
+
+    if (bResult != TRUE) {
+
+        PRINT_ERROR("could not allocate pages successfully \n");
+        exit(-1);
+
+    }
+
+    if (numPagesAllocated != numPages) {
+
+        PRINT("allocated only %llu pages out of %llu pages requested\n", numPagesAllocated, numPages);
+
+    }
+
+    return numPagesAllocated;
+
+}
+
+
+BOOLEAN
+freePhysPages()
+{
+
+    return (BOOLEAN) CloseHandle(physicalPageHandle);
+
+}
+
+
+PVOID
+reserveMappableVA(ULONG_PTR numPages)
+{
+
+    #ifdef MULTIPLE_MAPPINGS
+
+    MEM_EXTENDED_PARAMETER extendedParameters = {0};
+    extendedParameters.Type = MemExtendedParameterUserPhysicalHandle;
+    extendedParameters.Handle = physicalPageHandle;
+
+    return VirtualAlloc2(NULL, NULL, numPages << PAGE_SHIFT, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE, &extendedParameters, 1);      // equiv to numPages*PAGE_SIZE
+
+    #else
+
+    // creates a VAD node that we can define (i.e. is not pagefaulted by underlying kernel mm)
+    return VirtualAlloc(NULL, numPages << PAGE_SHIFT, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE);
+
+    #endif
+
+}
+
+
+VOID
+freeMappableVA(PVOID baseVA, ULONG_PTR numPages)
+{
+
+    VirtualFree(baseVA, 0, MEM_RELEASE);
+
+}
+
+
+BOOLEAN
+mapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages, PULONG_PTR arrayPFNs)
+{
+
+    return (BOOLEAN) MapUserPhysicalPages(virtualAddress, numPages, arrayPFNs);
+
+}
+
+
+BOOLEAN
+unmapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages)
+{
+
+    return (BOOLEAN) MapUserPhysicalPages(virtualAddress, numPages, NULL);
+
+}
+
+
+BOOLEAN
+unmapPhysicalPagesScatter(PVOID* virtualAddresses, ULONG_PTR numPages)
+{
+
+    return (BOOLEAN) MapUserPhysicalPagesScatter(virtualAddresses, numPages, NULL);
+
+}
+
+
+#else
+
+/******************************************************
+ ******************* memfd backend ********************
+ *****************************************************/
+
+#include <unistd.h>
+
+int physicalPageFd = -1;                // memfd whose page-sized offsets act as PFNs
+
+
+ULONG_PTR
+allocatePhysPages(ULONG_PTR numPages, PULONG_PTR arrayPFNs)
+{
+
+    physicalPageFd = memfd_create("usermodeMemoryManager", MFD_CLOEXEC);
+
+    if (physicalPageFd == -1) {
+
+        PRINT_ERROR("could not create physical page memfd\n");
+        exit(-1);
+
+    }
+
+    //
+    // Size the memfd to the full set of "physical" pages - the backing is
+    // populated lazily by the kernel on first touch
+    //
+
+    if (ftruncate(physicalPageFd, (off_t) (numPages << PAGE_SHIFT)) != 0) {
+
+        PRINT_ERROR("could not allocate pages successfully \n");
+        exit(-1);
+
+    }
+
+    //
+    // Each page's offset within the memfd (in pages) is its PFN
+    //
+
+    for (ULONG_PTR i = 0; i < numPages; i++) {
+
+        arrayPFNs[i] = i;
+
+    }
+
+    return numPages;
+
+}
+
+
+BOOLEAN
+freePhysPages()
+{
+
+    if (close(physicalPageFd) != 0) {
+        return FALSE;
+    }
+
+    physicalPageFd = -1;
+
+    return TRUE;
+
+}
+
+
+PVOID
+reserveMappableVA(ULONG_PTR numPages)
+{
+
+    PVOID baseVA;
+
+    baseVA = mmap(NULL, numPages << PAGE_SHIFT, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (baseVA == MAP_FAILED) {
+        return NULL;
+    }
+
+    return baseVA;
+
+}
+
+
+VOID
+freeMappableVA(PVOID baseVA, ULONG_PTR numPages)
+{
+
+    munmap(baseVA, numPages << PAGE_SHIFT);
+
+}
+
+
+BOOLEAN
+unmapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages)
+{
+
+    PVOID result;
+
+    //
+    // Replace the shared mapping with inaccessible anonymous memory rather than
+    // munmap'ing it, so the range stays reserved and cannot be handed out by a
+    // concurrent mmap elsewhere in the process
+    //
+
+    result = mmap(virtualAddress, numPages << PAGE_SHIFT, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+    return (result != MAP_FAILED);
+
+}
+
+
+BOOLEAN
+unmapPhysicalPagesScatter(PVOID* virtualAddresses, ULONG_PTR numPages)
+{
+
+    ULONG_PTR runLength;
+
+    //
+    // Coalesce runs of adjacent pages into a single mmap each
+    //
+
+    for (ULONG_PTR i = 0; i < numPages; i += runLength) {
+
+        runLength = 1;
+
+        while (i + runLength < numPages && 
+               (ULONG_PTR) virtualAddresses[i + runLength] == (ULONG_PTR) virtualAddresses[i] + (runLength << PAGE_SHIFT)) {
+
+            runLength++;
+
+        }
+
+        if (unmapPhysicalPages(virtualAddresses[i], runLength) == FALSE) {
+
+            return FALSE;
+
+        }
+
+    }
+
+    return TRUE;
+
+}
+
+
+BOOLEAN
+mapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages, PULONG_PTR arrayPFNs)
+{
+
+    PVOID result;
+    ULONG_PTR runLength;
+
+    if (arrayPFNs == NULL) {
+
+        return unmapPhysicalPages(virtualAddress, numPages);
+
+    }
+
+    //
+    // Coalesce runs of consecutive PFNs into a single mmap each
+    //
+
+    for (ULONG_PTR i = 0; i < numPages; i += runLength) {
+
+        runLength = 1;
+
+        while (i + runLength < numPages && arrayPFNs[i + runLength] == arrayPFNs[i] + runLength) {
+
+            runLength++;
+
+        }
+
+        result = mmap((PVOID) ((ULONG_PTR) virtualAddress + (i << PAGE_SHIFT)),
+                      runLength << PAGE_SHIFT,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED,
+                      physicalPageFd,
+                      (off_t) (arrayPFNs[i] << PAGE_SHIFT));
+
+        if (result == MAP_FAILED) {
+
+            return FALSE;
+
+        }
+
+    }
+
+    return TRUE;
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef PHYSICALPAGES_H
+#define PHYSICALPAGES_H
+
+#include "../usermodeMemoryManager.h"
+
+/*
+ * Physical page backend - the only code that knows how "physical" pages are
+ * provided and mapped:
+ *  - Windows: AWE (AllocateUserPhysicalPages/MapUserPhysicalPages)
+ *  - elsewhere: a memfd whose page offsets serve as PFNs, mapped with mmap
+ */
+
+
+/*
+ * allocatePhysPages: function to allocate the physical pages backing the simulation
+ *  - fills arrayPFNs with the PFN of each page allocated
+ *
+ * Returns ULONG_PTR:
+ *  - number of pages actually allocated (exits on failure)
+ */
+ULONG_PTR
+allocatePhysPages(ULONG_PTR numPages, PULONG_PTR arrayPFNs);
+
+
+/*
+ * freePhysPages: function to release the physical page backing
+ *
+ * Returns BOOLEAN:
+ *  - TRUE on success
+ *  - FALSE on failure
+ */
+BOOLEAN
+freePhysPages();
+
+
+/*
+ * reserveMappableVA: function to reserve a VA range that physical pages can be mapped into
+ *  - range is initially inaccessible
+ *
+ * Returns PVOID:
+ *  - base address of the range on success
+ *  - NULL on failure
+ */
+PVOID
+reserveMappableVA(ULONG_PTR numPages);
+
+
+/*
+ * freeMappableVA: function to release a range from reserveMappableVA
+ *
+ * No return value
+ */
+VOID
+freeMappableVA(PVOID baseVA, ULONG_PTR numPages);
+
+
+/*
+ * mapPhysicalPages: function to map numPages PFNs at virtualAddress
+ *  - read/write permissions are granted (callers tighten with VirtualProtect)
+ *  - a NULL arrayPFNs unmaps the range instead (mirrors MapUserPhysicalPages)
+ *
+ * Returns BOOLEAN:
+ *  - TRUE on success
+ *  - FALSE on failure
+ */
+BOOLEAN
+mapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages, PULONG_PTR arrayPFNs);
+
+
+/*
+ * unmapPhysicalPages: function to unmap numPages at virtualAddress
+ *  - range remains reserved and inaccessible
+ *
+ * Returns BOOLEAN:
+ *  - TRUE on success
+ *  - FALSE on failure
+ */
+BOOLEAN
+unmapPhysicalPages(PVOID virtualAddress, ULONG_PTR numPages);
+
+
+/*
+ * unmapPhysicalPagesScatter: function to unmap numPages individual pages, one per
+ * entry of virtualAddresses (mirrors MapUserPhysicalPagesScatter with NULL PFNs)
+ *  - runs of adjacent addresses are unmapped a range at a time
+ *
+ * Returns BOOLEAN:
+ *  - TRUE on success
+ *  - FALSE on failure
+ */
+BOOLEAN
+unmapPhysicalPagesScatter(PVOID* virtualAddresses, ULONG_PTR numPages);
+
+
+#endif //PHYSICALPAGES_H
@@ -9,13 +9,19 @@
 #include "usermodeMemoryManager.h"
 #include "./infrastructure/enqueue-dequeue.h"
 #include "./infrastructure/jLock.h"
+#include "./infrastructure/physicalPages.h"
+#include "./infrastructure/config.h"
 #include "./coreFunctions/pageFile.h"
 #include "./coreFunctions/getPage.h"
 #include "./coreFunctions/pageFault.h"
 #include "./coreFunctions/pageTrade.h"
+#include "./coreFunctions/pageMagazine.h"
+#include "./coreFunctions/pageReserve.h"
 #include "./dataStructures/PTEpermissions.h"
 #include "./dataStructures/VApermissions.h"
 #include "./dataStructures/VADNodes.h"
+#include "./dataStructures/pageDirectory.h"
+#include "./dataStructures/PTEscan.h"
 
 
 /******************************************************
@@ -25,17 +31,25 @@ void* leafVABlock;                      // starting address of virtual memory bl
 void* leafVABlockEnd;                   // ending address of virtual memory block
 
 PPFNdata PFNarray;                      // starting address of PFN metadata array
-PPTE PTEarray;                          // starting address of page table
+PPFNextension PFNextensionArray;        // rarely used PFN metadata (parallel to PFNarray)
+PPTE PTEarray;                          // starting address of page table (reserved - committed a page at a time)
+PPDE PDEarray;                          // page directory (one PDE per page of PTEarray)
+PUCHAR PTEageArray;                     // trimming clock age of each PTE (parallel to PTEarray)
+volatile LONG64* PTEidleBitmap;         // bit per PTE, set by markIdleVA and cleared on access
+ULONG_PTR numPageTablePages;            // number of PDEs (pages spanned by PTEarray)
 
 ULONG64 totalCommittedPages;               // count of committed pages (initialized to zero)
-ULONG_PTR totalMemoryPageLimit = NUM_PAGES + (PAGEFILE_SIZE >> PAGE_SHIFT);    // limit of committed pages (memory block + pagefile space)
+ULONG_PTR totalMemoryPageLimit;         // limit of committed pages (memory block + pagefile space)
+
+volatile LONG64 availablePageCount;     // pages on the zero, free and standby lists (maintained atomically)
 
 void* pageFileVABlock;                  // starting address of pagefile "disk" (memory)
 
 #ifdef PAGEFILE_PFN_CHECK
 PPageFileDebug pageFileDebugArray;
 #else 
-ULONG_PTR pageFileBitArray[PAGEFILE_PAGES/(8*sizeof(ULONG_PTR))];
+PULONG_PTR pageFileBitArray;
+ULONG_PTR pageFileBitArraySize;
 #endif
 
 #ifdef CHECK_PFNS
@@ -47,7 +61,7 @@ PULONG_PTR aPFNs;
 ULONG_PTR permissionMasks[] = { 0, readMask, (readMask | writeMask), (readMask | executeMask), (readMask | writeMask | executeMask) };
 
 /************ List declarations *****************/
-listData listHeads[ACTIVE];             // page listHeads array
+listData listHeads[NUM_PAGE_LISTS];     // page listHeads array (per status, then the standby lists)
 
 listData zeroVAListHead;                // listHead of zeroVAs used for zeroing PFNs (via AWE mapping)
 listData writeVAListHead;               // listHead of writeVAs used for writing to page file
@@ -59,11 +73,10 @@ listData readInProgEventListHead;       // list of events
 
 /********** Locks ************/
 PCRITICAL_SECTION PTELockArray;
+volatile ULONG64* PTESequenceArray;     // per-lock-group PTE sequence counters (odd while a write is in progress)
 CRITICAL_SECTION pageFileLock;
 CRITICAL_SECTION VADWriteLock;
 
-HANDLE physicalPageHandle;              // for multi-mapped pages (to support multithreading)
-
 HANDLE wakeTrimHandle;
 HANDLE wakeModifiedWriterHandle;
 
@@ -72,113 +85,25 @@ ULONG_PTR virtualMemPages;
 
 PULONG_PTR VADBitArray;
 
-BOOLEAN debugMode;                      // toggled by -v flag on cmd line
-
-
-BOOL
-LoggedSetLockPagesPrivilege ( HANDLE hProcess,
-                            BOOL bEnable)
-{
-    struct {
-        DWORD Count;
-        LUID_AND_ATTRIBUTES Privilege [1];
-    } Info;
-
-    HANDLE Token;
-    BOOL Result;
-
-    // Open the token.
-
-    Result = OpenProcessToken ( hProcess,
-                                TOKEN_ADJUST_PRIVILEGES,
-                                & Token);
-
-    if( Result != TRUE ) 
-    {
-        _tprintf( _T("Cannot open process token.\n") );
-        return FALSE;
-    }
-
-    // Enable or disable?
-
-    Info.Count = 1;
-    if( bEnable ) 
-    {
-        Info.Privilege[0].Attributes = SE_PRIVILEGE_ENABLED;
-    } 
-    else 
-    {
-        Info.Privilege[0].Attributes = 0;
-    }
-
-    // Get the LUID.
-
-    Result = LookupPrivilegeValue ( NULL,
-                                    SE_LOCK_MEMORY_NAME,
-                                    &(Info.Privilege[0].Luid));
-
-    if( Result != TRUE ) 
-    {
-        _tprintf( _T("Cannot get privilege for %s.\n"), SE_LOCK_MEMORY_NAME );
-        return FALSE;
-    }
-
-    // Adjust the privilege.
-
-    Result = AdjustTokenPrivileges ( Token, FALSE,
-                                    (PTOKEN_PRIVILEGES) &Info,
-                                    0, NULL, NULL);
-
-    // Check the result.
-
-    if( Result != TRUE ) 
-    {
-        _tprintf (_T("Cannot adjust token privileges (%u)\n"), GetLastError() );
-        return FALSE;
-    } 
-    else 
-    {
-        if( GetLastError() != ERROR_SUCCESS ) 
-        {
-        _tprintf (_T("Cannot enable the SE_LOCK_MEMORY_NAME privilege; "));
-        _tprintf (_T("please check the local policy.\n"));
-        return FALSE;
-        }
-    }
-
-    CloseHandle( Token );
-
-    return TRUE;
-}
-
-
-BOOL
-getPrivilege()
-{
-
-    BOOL bResult;
-    bResult = LoggedSetLockPagesPrivilege( GetCurrentProcess(), TRUE );
-    return bResult;
+ULONG_PTR numPagesRequested = DEFAULT_NUM_PAGES;
+ULONG_PTR pageFilePages = DEFAULT_PAGEFILE_PAGES;
+ULONG_PTR pagesPerLock = DEFAULT_PAGES_PER_LOCK;
+ULONG_PTR pagesPerLockShift;            // set by parseConfig
+ULONG_PTR vmMultiplier = DEFAULT_VM_MULTIPLIER;
 
-}
+BOOLEAN debugMode;                      // toggled by -v flag on cmd line
 
 
 VOID 
 initVABlock(ULONG_PTR numPages)
 {
 
-    #ifdef MULTIPLE_MAPPINGS
-
-    MEM_EXTENDED_PARAMETER extendedParameters = {0};
-    extendedParameters.Type = MemExtendedParameterUserPhysicalHandle;
-    extendedParameters.Handle = physicalPageHandle;
-
-    leafVABlock = VirtualAlloc2(NULL, NULL, numPages << PAGE_SHIFT, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE, &extendedParameters, 1);      // equiv to numVAs*PAGE_SIZE
+    //
+    // Reserve a VA range that physical pages can be mapped into (i.e. is not
+    // pagefaulted by underlying kernel mm)
+    //
 
-    #else
-    // creates a VAD node that we can define (i.e. is not pagefaulted by underlying kernel mm)
-    leafVABlock = VirtualAlloc(NULL, numPages*pageSize, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE);
-    #endif
+    leafVABlock = reserveMappableVA(numPages);
 
     if (leafVABlock == NULL) {
 
@@ -210,7 +135,7 @@ initPFNarray(PULONG_PTR arrayPFNs, ULONG_PTR numPages)
     // Loop through arrayPFNs (from AllocateUserPhysicalPages) to find largest numerical PFN
     //
 
-    for (int i = 0; i < numPages; i++) {
+    for (ULONG_PTR i = 0; i < numPages; i++) {
 
         //
         // If current PFN is larger than current maximum, replace
@@ -238,7 +163,18 @@ initPFNarray(PULONG_PTR arrayPFNs, ULONG_PTR numPages)
     }
 
     //
-    // Virtual Alloc (with MEM_RESERVE) PFN metadata array
+    // PFN list links are 32 bit indices, with the top indices reserved for listheads
+    //
+
+    if (maxPFN >= PFN_LIST_HEAD_INDEX_BASE) {
+
+        PRINT_ERROR("Insufficient PFN link bits (cannot represent maximum PFN value returned)\n");
+        exit(-1);
+
+    }
+
+    //
+    // Virtual Alloc (with MEM_RESERVE) PFN metadata array and its extension array
     //
 
     PFNarray = VirtualAlloc(NULL, (maxPFN+1)*(sizeof(PFNdata)), MEM_RESERVE, PAGE_READWRITE);
@@ -250,11 +186,20 @@ initPFNarray(PULONG_PTR arrayPFNs, ULONG_PTR numPages)
 
     }
 
+    PFNextensionArray = VirtualAlloc(NULL, (maxPFN+1)*(sizeof(PFNextension)), MEM_RESERVE, PAGE_READWRITE);
+
+    if (PFNextensionArray == NULL) {
+
+        PRINT_ERROR("Could not allocate for PFN extension array\n");
+        exit(-1);
+
+    }
+
     //
     // Loop through all PFNs, MEM_COMMITTING PFN subsections and enqueueing to free for each page
     //
 
-    for (int i = 0; i < numPages; i++) {
+    for (ULONG_PTR i = 0; i < numPages; i++) {
 
         PPFNdata newPFN;
 
@@ -269,7 +214,16 @@ initPFNarray(PULONG_PTR arrayPFNs, ULONG_PTR numPages)
         
         if (commitCheckVA == NULL) {
 
-            PRINT_ERROR("failed to commit subsection of PFN array at PFN %d\n", i);
+            PRINT_ERROR("failed to commit subsection of PFN array at PFN %llu\n", i);
+            exit(-1);
+
+        }
+
+        commitCheckVA = VirtualAlloc(getPFNextension(newPFN), sizeof (PFNextension), MEM_COMMIT, PAGE_READWRITE);
+        
+        if (commitCheckVA == NULL) {
+
+            PRINT_ERROR("failed to commit subsection of PFN extension array at PFN %llu\n", i);
             exit(-1);
 
         }
@@ -285,7 +239,7 @@ initPFNarray(PULONG_PTR arrayPFNs, ULONG_PTR numPages)
         // "Reset"/clear pagefile offset & refcount PFN fields
         //
 
-        newPFN->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(newPFN)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         newPFN->refCount = 0;
 
@@ -307,10 +261,18 @@ initPTEarray(ULONG_PTR numPages)
 {    
 
     //
-    // Virtual Alloc (with MEM_RESERVE | MEM_COMMIT) for PTE array
+    // Round up to whole page table pages
+    //
+
+    numPageTablePages = (numPages + PTES_PER_PAGE - 1) >> PTES_PER_PAGE_SHIFT;
+
+    //
+    // Reserve the PTE array as mappable VA - page table pages are physical pages
+    // mapped in as they are committed/faulted (see pageDirectory.c), so the page
+    // table only consumes memory for page tables actually in use
     //
 
-    PTEarray = VirtualAlloc(NULL, numPages*(sizeof(PTE)), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    PTEarray = reserveMappableVA(numPageTablePages);
 
     if (PTEarray == NULL) {
 
@@ -319,122 +281,84 @@ initPTEarray(ULONG_PTR numPages)
 
     }
 
-}
-
-
-VOID
-initPageFile(ULONG_PTR diskSize) 
-{
-
     //
-    // Virtual Alloc (with MEM_RESERVE | MEM_COMMIT) for pageFileVABlock
+    // Allocate the page directory (all PDEs initially invalid)
     //
 
-    pageFileVABlock = VirtualAlloc(NULL, diskSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    PDEarray = VirtualAlloc(NULL, numPageTablePages * sizeof(PDE), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 
-    if (pageFileVABlock == NULL) {
+    if (PDEarray == NULL) {
 
-        PRINT_ERROR("Could not allocate for pageFile\n");
+        PRINT_ERROR("Could not allocate for PDEarray\n");
         exit(-1);
 
     }
 
-    #ifndef PAGEFILE_OFF
-
-        #ifdef PAGE_TRADE
-
-            //
-            // Used as a "working" page for page trading in order to avoid deadlock
-            //
-
-            InterlockedIncrement64(&totalCommittedPages); 
+    //
+    // Allocate the trimming clock ages (zeroed - every page starts young)
+    //
 
-        #endif
+    PTEageArray = VirtualAlloc(NULL, numPages * sizeof(UCHAR), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 
-    #else
-    for (int i = 0; i < PAGEFILE_PAGES; i++) {
+    if (PTEageArray == NULL) {
 
-        InterlockedIncrement64(&totalCommittedPages); // (currently used as a "working " page)
+        PRINT_ERROR("Could not allocate for PTEageArray\n");
+        exit(-1);
 
     }
-    #endif
-
-}
-
-
-ULONG_PTR
-allocatePhysPages(ULONG_PTR numPages, PULONG_PTR arrayPFNs) 
-{
-
-    BOOL bResult;
-    ULONG_PTR numPagesAllocated;
 
     //
-    // Secure privilege for the code
+    // Allocate the idle page bitmap (zeroed - no page is tracked as idle)
     //
 
-    bResult = getPrivilege();
+    PTEidleBitmap = VirtualAlloc(NULL, ( (numPages + 63) / 64) * sizeof(LONG64), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 
-    if (bResult != TRUE) {
+    if (PTEidleBitmap == NULL) {
 
-        PRINT_ERROR("could not get privilege successfully \n");
+        PRINT_ERROR("Could not allocate for PTEidleBitmap\n");
         exit(-1);
 
-    }    
-
-
-    numPagesAllocated = numPages;
+    }
 
+}
 
 
-    #ifdef MULTIPLE_MAPPINGS
+VOID
+initPageFile(ULONG_PTR diskSize) 
+{
 
-    MEM_EXTENDED_PARAMETER extendedParameters = {0};
+    //
+    // Virtual Alloc (with MEM_RESERVE | MEM_COMMIT) for pageFileVABlock
+    //
 
+    pageFileVABlock = VirtualAlloc(NULL, diskSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 
-    extendedParameters.Type = MemSectionExtendedParameterUserPhysicalFlags;
-    extendedParameters.ULong64 = 0;
-    
-    physicalPageHandle = CreateFileMapping2(NULL,
-                                            NULL, 
-                                            SECTION_MAP_READ | SECTION_MAP_WRITE, 
-                                            PAGE_READWRITE, 
-                                            SEC_RESERVE, 
-                                            0, 
-                                            NULL, 
-                                            &extendedParameters, 
-                                            1 );
-    
-    if (physicalPageHandle == NULL) {
+    if (pageFileVABlock == NULL) {
 
-        PRINT_ERROR("could not create file mapping\n");
+        PRINT_ERROR("Could not allocate for pageFile\n");
         exit(-1);
 
     }
 
+    #ifndef PAGEFILE_OFF
 
-    #else
-    
-    physicalPageHandle = GetCurrentProcess();
-
-    #endif
-
-    bResult = AllocateUserPhysicalPages(physicalPageHandle, &numPagesAllocated, arrayPFNs);
+        #ifdef PAGE_TRADE
 
-    if (bResult != TRUE) {
+            //
+            // Used as a "working" page for page trading in order to avoid deadlock
+            //
 
-        PRINT_ERROR("could not allocate pages successfully \n");
-        exit(-1);
+            InterlockedIncrement64(&totalCommittedPages); 
 
-    }
+        #endif
 
-    if (numPagesAllocated != numPages) {
+    #else
+    for (ULONG_PTR i = 0; i < pageFilePages; i++) {
 
-        PRINT("allocated only %llu pages out of %u pages requested\n", numPagesAllocated, NUM_PAGES);
+        InterlockedIncrement64(&totalCommittedPages); // (currently used as a "working " page)
 
     }
-
-    return numPagesAllocated;
+    #endif
 
 }
 
@@ -464,7 +388,7 @@ zeroPage(ULONG_PTR PFN)
     // Map PFN to the "zero" VA
     //
 
-    if (!MapUserPhysicalPages(zeroVA, 1, &PFN)) {
+    if (!mapPhysicalPages(zeroVA, 1, &PFN)) {
 
         enqueueVA(&zeroVAListHead, zeroVANode);
 
@@ -484,7 +408,7 @@ zeroPage(ULONG_PTR PFN)
     // Unmap zeroVA from page - PFN is now ready to be alloc'd
     //
 
-    if (!MapUserPhysicalPages(zeroVA, 1, NULL)) {
+    if (!unmapPhysicalPages(zeroVA, 1)) {
 
         enqueueVA(&zeroVAListHead, zeroVANode);
 
@@ -505,76 +429,141 @@ BOOLEAN
 zeroPageWriter()
 {
 
+    PPFNdata pagesToZero[PAGE_LIST_BATCH_SIZE];
+    PPFNdata zeroedPages[PAGE_LIST_BATCH_SIZE];
+    ULONG_PTR numToZero;
+    ULONG_PTR numZeroed;
+    ULONG_PTR numReserved;
     PPFNdata PFNtoZero;
-    ULONG_PTR pageNumtoZero;
+    PFNstate oldState;
+    PFNstate newState;
+    ULONG currSpins;
 
     //
-    // Acquires & releases list lock, but retains
-    // PFN lock
+    // Pull a batch off the free list under a single list lock acquisition
+    // (pages are returned unlocked, with status NONE)
     //
 
-    PFNtoZero = dequeueLockedPage(&freeListHead, TRUE);
+    numToZero = dequeuePages(&freeListHead, PAGE_LIST_BATCH_SIZE, pagesToZero, FALSE);
 
-    if (PFNtoZero == NULL) {
+    if (numToZero == 0) {
 
         PRINT("free list empty - could not write out\n");
         return FALSE;
 
     }
 
-    //
-    // Set overloaded "writeinprogress" bit (to signify page is currently being zeroed)
-    // Note: write in progress is also set by modified page writer, but in a different context
-    //
+    for (ULONG_PTR i = 0; i < numToZero; i++) {
+
+        PFNtoZero = pagesToZero[i];
+
+        //
+        // Set overloaded "writeinprogress" bit (to signify page is currently being zeroed)
+        // Note: write in progress is also set by modified page writer, but in a different context
+        //
+        // The page is on no list, so only its state word changes - set with a CAS
+        // rather than the PFN lock (retried while the page trader holds the lock)
+        //
 
-    PFNtoZero->writeInProgressBit = 1;
+        currSpins = 0;
 
-    releaseJLock(&PFNtoZero->lockBits);
+        while (TRUE) {
 
-    //
-    // Derive physical page number from metadata
-    //
+            oldState = readPFNstate(PFNtoZero);
+
+            newState = oldState;
+
+            newState.writeInProgressBit = 1;
+
+            if (compareExchangePFNstate(PFNtoZero, oldState, newState) == TRUE) {
+
+                break;
+
+            }
+
+            backoffSpin(&currSpins);
+
+        }
+
+        //
+        // zero the page contents, does not update status bits in PFN metadata
+        // note: can be page traded within this time, where status bits could change from ZERO to AWAITING_QUARANTINE
+        //
+
+        zeroPage(PFNtoZero - PFNarray);
 
-    pageNumtoZero = PFNtoZero - PFNarray;
+    }
 
     //
-    // zero the page contents, does not update status bits in PFN metadata
-    // note: can be page traded within this time, where status bits could change from ZERO to AWAITING_QUARANTINE
+    // Lock the batch and clear "writeinprogress" bits (pages can now be traded, 
+    // once locks are released) - pages awaiting quarantine are diverted
     //
 
-    zeroPage(pageNumtoZero);
+    numZeroed = 0;
+
+    for (ULONG_PTR i = 0; i < numToZero; i++) {
+
+        PFNtoZero = pagesToZero[i];
+
+        acquireJLock(&PFNtoZero->lockBits);
+
+        PFNtoZero->writeInProgressBit = 0;
+
+        if (PFNtoZero->statusBits == AWAITING_QUARANTINE) {
+
+            enqueuePage(&quarantineListHead, PFNtoZero);
+
+            releaseJLock(&PFNtoZero->lockBits);
+
+            PRINT(" - moved page from free -> quarantine\n");
+
+            continue;
+
+        }
+
+        zeroedPages[numZeroed] = PFNtoZero;
+
+        numZeroed++;
+
+    }
+
+    numReserved = 0;
 
-    acquireJLock(&PFNtoZero->lockBits);
+    #ifdef FAULT_PAGE_RESERVE
 
     //
-    // Clear "writeinprogress" bit (to signify page has been zeroed and can now be traded, once lock is released)
+    // Top up the fault page reserve before these pages reach the zero list
+    // (and any other consumer) - reserved pages are unlocked by the refill
     //
 
-    PFNtoZero->writeInProgressBit = 0;
+    numReserved = refillPageReserve(zeroedPages, numZeroed);
+
+    numZeroed -= numReserved;
+
+    #endif
 
-    if (PFNtoZero->statusBits == AWAITING_QUARANTINE) {
+    #ifdef PAGEFILE_PFN_CHECK
 
-        enqueuePage(&quarantineListHead, PFNtoZero);
-        PRINT(" - moved page from free -> quarantine\n");
+        for (ULONG_PTR i = 0; i < numZeroed; i++) {
 
-    } else {
+            enqueuePageBasic(&zeroListHead, zeroedPages[i]);
 
-        #ifdef PAGEFILE_PFN_CHECK
+        }
 
-            enqueuePageBasic(&zeroListHead, PFNtoZero);
+    #else
 
-        #else
+        // enqueue batch to zeroList (updates status bits in PFN metadata)
+        enqueuePages(&zeroListHead, zeroedPages, numZeroed);
 
-            // enqueue to zeroList (updates status bits in PFN metadata)
-            enqueuePage(&zeroListHead, PFNtoZero);
+    #endif
 
-        #endif
+    for (ULONG_PTR i = 0; i < numZeroed; i++) {
 
-    }
+        releaseJLock(&zeroedPages[i]->lockBits);
 
-    releaseJLock(&PFNtoZero->lockBits);
+    }
 
-    PRINT(" - Moved page from free -> zero \n");
+    PRINT(" - Moved %llu pages from free -> zero (%llu reserved)\n", numZeroed, numReserved);
 
     return TRUE;
 
@@ -640,7 +629,7 @@ zeroPageThread(HANDLE terminationHandle)
 
             if (index == 0) {
 
-                PRINT_ALWAYS("zeropagethread - numPages moved to zero list : %d, numWaited : %d\n", numZeroed, numWaited);
+                PRINT_ALWAYS("zeropagethread - numBatches moved to zero list : %d, numWaited : %d\n", numZeroed, numWaited);
                 return 0;
 
             }
@@ -662,22 +651,27 @@ BOOLEAN
 freePageTestWriter()
 {
 
-    PPFNdata PFNtoFree;
+    PPFNdata pagesToFree[PAGE_LIST_BATCH_SIZE];
+    ULONG_PTR numToFree;
     
     //
-    // Dequeue page from zero list to enqueue to free list
+    // Dequeue a batch from zero list to enqueue to free list
     //
 
-    PFNtoFree = dequeueLockedPage(&zeroListHead, FALSE);
+    numToFree = dequeuePages(&zeroListHead, PAGE_LIST_BATCH_SIZE, pagesToFree, FALSE);
 
-    if (PFNtoFree == NULL) {
+    if (numToFree == 0) {
 
         PRINT("zero list empty - could not write out\n");
         return FALSE;
 
     }
 
-    acquireJLock(&PFNtoFree->lockBits);
+    for (ULONG_PTR i = 0; i < numToFree; i++) {
+
+        acquireJLock(&pagesToFree[i]->lockBits);
+
+    }
 
     #ifdef PAGEFILE_PFN_CHECK
 
@@ -686,19 +680,27 @@ freePageTestWriter()
         // when pagefile PFNs are checked
         //
 
-        enqueuePageBasic(&freeListHead, PFNtoFree);
+        for (ULONG_PTR i = 0; i < numToFree; i++) {
+
+            enqueuePageBasic(&freeListHead, pagesToFree[i]);
+
+        }
 
     #else
 
         //
-        // enqueue to freeList (updates status bits in PFN metadata)
+        // enqueue batch to freeList (updates status bits in PFN metadata)
         //
 
-        enqueuePage(&freeListHead, PFNtoFree);
+        enqueuePages(&freeListHead, pagesToFree, numToFree);
 
     #endif
 
-    releaseJLock(&PFNtoFree->lockBits);
+    for (ULONG_PTR i = 0; i < numToFree; i++) {
+
+        releaseJLock(&pagesToFree[i]->lockBits);
+
+    }
 
     return TRUE;
 }
@@ -763,7 +765,7 @@ freePageTestThread(HANDLE terminationHandle)
 
             if (index == 0) {
 
-                PRINT_ALWAYS("freepagetestthread - numPages moved to free list: %d, numWaited : %d \n", numFreed, numWaited);
+                PRINT_ALWAYS("freepagetestthread - numBatches moved to free list: %d, numWaited : %d \n", numFreed, numWaited);
                 
                 return 0;
 
@@ -790,16 +792,16 @@ releaseAwaitingFreePFN(PPFNdata PFNtoFree)
     // Verify page lock is held
     //
 
-    ASSERT(PFNtoFree->lockBits != 0);
+    ASSERT(PFNtoFree->lockBit == 1);
         
     //
     // Clear index in pagefile, pagefile offset field in PFN,
     // and remodified bit in PFN.
     //
 
-    clearPFBitIndex(PFNtoFree->pageFileOffset);
+    clearPFBitIndex(getPFNextension(PFNtoFree)->pageFileOffset);
 
-    PFNtoFree->pageFileOffset = INVALID_BITARRAY_INDEX;
+    getPFNextension(PFNtoFree)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
     PFNtoFree->remodifiedBit = 0;
 
@@ -814,101 +816,59 @@ releaseAwaitingFreePFN(PPFNdata PFNtoFree)
 }
 
 
-BOOLEAN
-modifiedPageWriter()
+static BOOLEAN
+completeActiveModifiedWrite(PPFNdata PFNtoWrite)
 {
 
-    BOOLEAN wakeModifiedWriter;
-    PPFNdata PFNtoWrite;
-    BOOLEAN bResult;
-
-    wakeModifiedWriter = FALSE;
-
-    PRINT("[modifiedPageWriter] modifiedListCount == %llu\n", modifiedListHead.count);
-
-    //
-    // Return page with lock bits set
-    //
-
-    PFNtoWrite = dequeueLockedPage(&modifiedListHead, TRUE);
-
-    if (PFNtoWrite == NULL) {
-
-        PRINT("[modifiedPageWriter] modified list empty - could not write out\n");
-        return FALSE;
-
-    }
-
-    //
-    // Lock has previuosly been acquired - assert that PFN has no associated pagefile
-    // offset ad that write in progress bit is zero. Then set write in progress bit to 1
-    //
-
-    ASSERT(PFNtoWrite->pageFileOffset == INVALID_BITARRAY_INDEX);
+    PFNstate oldState;
+    PFNstate newState;
 
-    ASSERT(PFNtoWrite->writeInProgressBit == 0);
-
-    PFNtoWrite->writeInProgressBit = 1;
-
-    //
-    // Revert PFN status to modified so that it can once again be faulted
-    //
-
-    PFNtoWrite->statusBits = MODIFIED;
-    
     //
-    // Clear PFN's remodified bit (since it will be written/attempted to be written
-    // to pagefile), and can now be re-set once page lock is released
+    // A page faulted back in (and not re-modified) during a successful write stays
+    // active, so completing it only clears its write in progress bit - done with a
+    // CAS rather than the PFN lock. Any other page (or one whose lock is held) is
+    // completed under the PFN lock by completeModifiedWrite
     //
 
-    PFNtoWrite->remodifiedBit = 0;
+    while (TRUE) {
 
-    //
-    // Release PFN lock: write in progress bit has been set, status bits have
-    // been set to modified, PFN dirty bit has been cleared so that another
-    // faulter can reset it upon checking that write in progress bit is 1.
-    // Page can be now decommitted or re-modified
-    //
+        oldState = readPFNstate(PFNtoWrite);
 
-    releaseJLock(&PFNtoWrite->lockBits);
+        if (oldState.lockBit == 1 || oldState.statusBits != ACTIVE || oldState.remodifiedBit == 1) {
 
+            return FALSE;
 
-    //
-    // If address verification is enabled (asserts that the contents
-    // of a given page corresponds to the virtual address it is mapped
-    // or standby at)
-    //
+        }
 
-    ULONG_PTR expectedSig;
+        ASSERT(oldState.writeInProgressBit == 1);
 
-    #ifdef TESTING_VERIFY_ADDRESSES
+        newState = oldState;
 
-        expectedSig = (ULONG_PTR) leafVABlock + ( ( PFNtoWrite->PTEindex ) << PAGE_SHIFT );
+        newState.writeInProgressBit = 0;
 
-    #else 
+        if (compareExchangePFNstate(PFNtoWrite, oldState, newState) == TRUE) {
 
-        expectedSig = 0;
+            return TRUE;
 
-    #endif
+        }
 
-    //
-    // Write page to pagefile - can no longer be accessed since write in progress is set
-    //
+    }
 
-    bResult = writePageToFileSystem(PFNtoWrite, expectedSig);
+}
 
-    //
-    // Re-acquire PFN lock post-pagefile write
-    //
 
-    acquireJLock(&PFNtoWrite->lockBits);
+static BOOLEAN
+completeModifiedWrite(PPFNdata PFNtoWrite, BOOLEAN bResult, PBOOLEAN wakeModifiedWriter)
+{
 
     //
-    // Since we've marked the PFN as write in progress, it CANNOT be in zero or free state
+    // Page lock is held - since we've marked the PFN as write in progress, it CANNOT be in zero or free state
     //  - would require a decommit (via decommitVA), which checks the writeInProgressBit
     //  - so, we can assert that it is in neither free nor zero
     //
 
+    ASSERT(PFNtoWrite->lockBit == 1);
+
     ASSERT (PFNtoWrite->statusBits != FREE && PFNtoWrite->statusBits != ZERO);
 
     //
@@ -942,9 +902,7 @@ modifiedPageWriter()
         
         releaseAwaitingFreePFN(PFNtoWrite);
 
-        releaseJLock(&PFNtoWrite->lockBits);
-
-        return TRUE;
+        return FALSE;
 
     }
     
@@ -960,21 +918,21 @@ modifiedPageWriter()
         //
 
 
-        clearPFBitIndex(PFNtoWrite->pageFileOffset);
+        clearPFBitIndex(getPFNextension(PFNtoWrite)->pageFileOffset);
 
-        PFNtoWrite->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(PFNtoWrite)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         //
         // If the page has not since been faulted in, re-enqueue to modified list
         // (since page has failed the write to pagefile, cannnot be enqueued to 
-        // standby list)
+        // standby list). The writer is not woken - the write would fail again
         //
 
         if (PFNtoWrite->statusBits != ACTIVE) {
 
             PFNtoWrite->remodifiedBit = 0;
 
-            wakeModifiedWriter = enqueuePage(&modifiedListHead, PFNtoWrite);
+            enqueuePage(&modifiedListHead, PFNtoWrite);
 
         } else {
             
@@ -982,12 +940,8 @@ modifiedPageWriter()
 
         }
 
-        releaseJLock(&PFNtoWrite->lockBits);
-
-
         PRINT("[modifiedPageWriter] error writing out page\n");
 
-        
         return FALSE;
 
     }
@@ -1002,7 +956,7 @@ modifiedPageWriter()
         // Since write failure (bRes == FALSE) would leave pagefile offset as invalid
         //
 
-        ASSERT(PFNtoWrite->pageFileOffset != INVALID_BITARRAY_INDEX);
+        ASSERT(getPFNextension(PFNtoWrite)->pageFileOffset != INVALID_BITARRAY_INDEX);
 
         PFNtoWrite->remodifiedBit = 0;
             
@@ -1010,9 +964,9 @@ modifiedPageWriter()
         // Clear pagefile space from bitarray and clear index in PFN
         //
 
-        clearPFBitIndex(PFNtoWrite->pageFileOffset);
+        clearPFBitIndex(getPFNextension(PFNtoWrite)->pageFileOffset);
 
-        PFNtoWrite->pageFileOffset = INVALID_BITARRAY_INDEX;
+        getPFNextension(PFNtoWrite)->pageFileOffset = INVALID_BITARRAY_INDEX;
 
         //
         // If the page has not since been faulted in, re-enqueue to modified list
@@ -1021,28 +975,17 @@ modifiedPageWriter()
 
         if (PFNtoWrite->statusBits != ACTIVE) {
 
-            wakeModifiedWriter = enqueuePage(&modifiedListHead, PFNtoWrite);
+            if (enqueuePage(&modifiedListHead, PFNtoWrite) == TRUE) {
 
-        }
+                *wakeModifiedWriter = TRUE;
 
-        releaseJLock(&PFNtoWrite->lockBits);
-
-        if (wakeModifiedWriter == TRUE) {
-            
-            BOOL bRes;
-            bRes = SetEvent(wakeModifiedWriterHandle);
-
-            if (bRes != TRUE) {
-                PRINT_ERROR("[trimPTE] failed to set event\n");
             }
 
-            ResetEvent(wakeModifiedWriterHandle);
-
         }
 
         PRINT("[modifiedPageWriter] Page has since been modified, clearing PF space\n");
         
-        return TRUE;
+        return FALSE;
     }
 
     //
@@ -1054,7 +997,7 @@ modifiedPageWriter()
     currPTE = PTEarray + PFNtoWrite->PTEindex;    
 
     //
-    // if PFN has not since been faulted in to active, enqueue to standby list
+    // if PFN has not since been faulted in to active, it goes to the standby list
     // if it has been write faulted in, check the dirty bit
     //  - if it is set, clear the PF bit index
     //  - otherwise, continue
@@ -1062,22 +1005,204 @@ modifiedPageWriter()
 
     if (PFNtoWrite->statusBits != ACTIVE && PFNtoWrite->remodifiedBit == 0) {
 
-        ASSERT(currPTE->u1.hPTE.validBit != 1 && currPTE->u1.tPTE.transitionBit == 1);
+        ASSERT(PFNtoWrite->pageTableBit == 1 || (currPTE->u1.hPTE.validBit != 1 && currPTE->u1.tPTE.transitionBit == 1) );
+
+        return TRUE;
+
+    }
+
+    return FALSE;
+
+}
+
+
+BOOLEAN
+modifiedPageWriter()
+{
+
+    PPFNdata pagesToWrite[MODIFIED_WRITE_BATCH_SIZE];
+    ULONG_PTR expectedSigs[MODIFIED_WRITE_BATCH_SIZE];
+    BOOLEAN pageWritten[MODIFIED_WRITE_BATCH_SIZE];
+    ULONG_PTR numToWrite;
+    ULONG_PTR numWritten;
+    BOOLEAN wakeModifiedWriter;
+    PPFNdata PFNtoWrite;
+    BOOLEAN isPageTable;
+
+    wakeModifiedWriter = FALSE;
+
+    PRINT("[modifiedPageWriter] modifiedListCount == %llu\n", modifiedListHead.count);
+
+    //
+    // Pull a batch off the modified list under a single list lock acquisition
+    // (pages are returned with lock bits set, so they cannot be faulted while
+    // their status is NONE)
+    //
+
+    numToWrite = dequeuePages(&modifiedListHead, MODIFIED_WRITE_BATCH_SIZE, pagesToWrite, TRUE);
+
+    if (numToWrite == 0) {
+
+        PRINT("[modifiedPageWriter] modified list empty - could not write out\n");
+        return FALSE;
+
+    }
+
+    //
+    // Sort the batch by PTEindex (leaf pages before page table pages), so pages
+    // adjacent in VA space are written to adjacent pagefile slots
+    //
+
+    for (ULONG_PTR i = 1; i < numToWrite; i++) {
+
+        ULONG_PTR j;
+
+        PFNtoWrite = pagesToWrite[i];
+
+        for (j = i; j > 0; j--) {
+
+            PPFNdata prevPFN;
+            prevPFN = pagesToWrite[j - 1];
+
+            if (prevPFN->pageTableBit < PFNtoWrite->pageTableBit
+                || (prevPFN->pageTableBit == PFNtoWrite->pageTableBit && prevPFN->PTEindex <= PFNtoWrite->PTEindex) ) {
+
+                break;
+
+            }
+
+            pagesToWrite[j] = prevPFN;
+
+        }
+
+        pagesToWrite[j] = PFNtoWrite;
+
+    }
+
+    for (ULONG_PTR i = 0; i < numToWrite; i++) {
+
+        PFNtoWrite = pagesToWrite[i];
+
+        //
+        // Lock has previuosly been acquired - assert that PFN has no associated pagefile
+        // offset ad that write in progress bit is zero. Then set write in progress bit to 1
+        //
+
+        ASSERT(getPFNextension(PFNtoWrite)->pageFileOffset == INVALID_BITARRAY_INDEX);
+
+        ASSERT(PFNtoWrite->writeInProgressBit == 0);
+
+        PFNtoWrite->writeInProgressBit = 1;
 
         //
-        // Enqueue page to standby (since has not been redirtied)
+        // Revert PFN status to modified so that it can once again be faulted
         //
 
-        enqueuePage(&standbyListHead, PFNtoWrite);
+        PFNtoWrite->statusBits = MODIFIED;
+        
+        //
+        // Clear PFN's remodified bit (since it will be written/attempted to be written
+        // to pagefile), and can now be re-set once page lock is released
+        //
 
-        PRINT(" - Moved page from modified -> standby (wrote out to PageFile successfully)\n");
+        PFNtoWrite->remodifiedBit = 0;
 
+        //
+        // Page table pages carry no VA signature (and their PTEindex is a PDE index)
+        //
+
+        isPageTable = (BOOLEAN) PFNtoWrite->pageTableBit;
+
+        //
+        // If address verification is enabled (asserts that the contents
+        // of a given page corresponds to the virtual address it is mapped
+        // or standby at)
+        //
+
+        #ifdef TESTING_VERIFY_ADDRESSES
+
+            expectedSigs[i] = (ULONG_PTR) leafVABlock + ( ( PFNtoWrite->PTEindex ) << PAGE_SHIFT );
+
+            if (isPageTable) {
+
+                expectedSigs[i] = NO_PAGE_SIGNATURE;
+
+            }
+
+        #else 
+
+            expectedSigs[i] = 0;
+
+        #endif
+
+        //
+        // Release PFN lock: write in progress bit has been set, status bits have
+        // been set to modified, PFN dirty bit has been cleared so that another
+        // faulter can reset it upon checking that write in progress bit is 1.
+        // Page can be now decommitted or re-modified
+        //
+
+        releaseJLock(&PFNtoWrite->lockBits);
 
     }
 
-    releaseJLock(&PFNtoWrite->lockBits);
+    //
+    // Write the batch to pagefile as a single clustered write - pages can no longer
+    // be accessed since write in progress is set
+    //
+
+    numWritten = writePagesToFileSystem(pagesToWrite, numToWrite, expectedSigs, pageWritten);
+
+    //
+    // Complete each page post-pagefile write - pages still active only need their
+    // write in progress bit cleared (see completeActiveModifiedWrite), the rest
+    // re-acquire their PFN lock. Each lock is released before the next is acquired 
+    // - a page faulted back in during the write may be locked by the trimmer, which 
+    // holds other page locks meanwhile
+    //
+
+    for (ULONG_PTR i = 0; i < numToWrite; i++) {
 
-    return TRUE;   
+        PFNtoWrite = pagesToWrite[i];
+
+        if (pageWritten[i] == TRUE && completeActiveModifiedWrite(PFNtoWrite) == TRUE) {
+
+            continue;
+
+        }
+
+        acquireJLock(&PFNtoWrite->lockBits);
+
+        if (completeModifiedWrite(PFNtoWrite, pageWritten[i], &wakeModifiedWriter) == TRUE) {
+
+            //
+            // Enqueue page to standby (since has not been redirtied)
+            //
+
+            enqueuePage(&standbyListHead, PFNtoWrite);
+
+            PRINT(" - Moved page from modified -> standby (wrote out to PageFile successfully)\n");
+
+        }
+
+        releaseJLock(&PFNtoWrite->lockBits);
+
+    }
+
+    if (wakeModifiedWriter == TRUE) {
+        
+        BOOL bRes;
+        bRes = SetEvent(wakeModifiedWriterHandle);
+
+        if (bRes != TRUE) {
+            PRINT_ERROR("[modifiedPageWriter] failed to set event\n");
+        }
+
+        ResetEvent(wakeModifiedWriterHandle);
+
+    }
+
+    return (numWritten != 0);
 
 }
 
@@ -1166,10 +1291,10 @@ faultAndAccessTest()
 {
 
     PVOID testVA;
-    BOOLEAN bRes;
     ULONG_PTR vadSize;
+    ULONG standbyPriority;
     PVADNode node;
-    PVOID vadStartVA;
+    PVOID volatile vadStartVA;              // volatile - modified within _try (implemented with sigsetjmp on Linux)
 
     //
     // Initialize VAD startVA to a "dummy" value
@@ -1186,6 +1311,13 @@ faultAndAccessTest()
     //
 
     vadSize = GetTickCount() % numPagesReturned;
+
+    //
+    // Quasi-randomize the VAD's standby priority as well, so regions of
+    // every priority compete for standby pages
+    //
+
+    standbyPriority = (GetTickCount() / 2) % NUM_STANDBY_PRIORITIES;
     
     #ifdef COMMIT_VAD
 
@@ -1194,7 +1326,7 @@ faultAndAccessTest()
         // Create MEM_COMMIT VADs
         //
 
-        node = createVAD(NULL, vadSize, READ_WRITE, TRUE);
+        node = createVAD(NULL, vadSize, READ_WRITE, TRUE, standbyPriority);
 
     #elif defined RESERVE_VAD
 
@@ -1202,7 +1334,7 @@ faultAndAccessTest()
         // Create MEM_RESERVE VADs
         //
 
-        node = createVAD(NULL, vadSize, READ_WRITE, FALSE);
+        node = createVAD(NULL, vadSize, READ_WRITE, FALSE, standbyPriority);
 
     #else
 
@@ -1215,7 +1347,7 @@ faultAndAccessTest()
 
         randomVADType = (GetTickCount() % 2);
 
-        node = createVAD(NULL, vadSize, READ_WRITE, randomVADType);
+        node = createVAD(NULL, vadSize, READ_WRITE, randomVADType, standbyPriority);
 
     #endif
 
@@ -1241,6 +1373,19 @@ faultAndAccessTest()
 
     }
 
+    //
+    // Bound the VAD's working set (this fails harmlessly if the VAD has
+    // already been deleted, or the minimums of other VADs use the budget)
+    //
+
+    if (vadStartVA != NULL) {
+
+        setVADWorkingSetLimits(vadStartVA, vadSize / 8, vadSize / 2 + 1);
+
+        markIdleVA(vadStartVA, vadSize);
+
+    }
+
     /************** TESTING *****************/
 
     testVA = leafVABlock;
@@ -1267,7 +1412,7 @@ faultAndAccessTest()
 
         }
 
-        bRes = commitVA(testVA, READ_WRITE, commitSize);     // commits with READ_ONLY permissions
+        commitVA(testVA, READ_WRITE, commitSize);     // commits with READ_ONLY permissions
 
         //
         // Write->Trim->Access
@@ -1300,6 +1445,18 @@ faultAndAccessTest()
     }
 
 
+    //
+    // Move the VAD to the next standby priority - pages trimmed from here on are
+    // cached at the new priority (fails harmlessly if the VAD has been deleted)
+    //
+
+    if (vadStartVA != NULL) {
+
+        setVADStandbyPriority(vadStartVA, (standbyPriority + 1) % NUM_STANDBY_PRIORITIES);
+
+    }
+
+
     /************ TRIMMING tested VAs (active -> standby/modified) **************/
 
     PRINT("Trimming %llu pages, modified writing half of them\n", virtualMemPages);
@@ -1364,6 +1521,52 @@ faultAndAccessTest()
     }
 
 
+    /***************** CHECKING idle page tracking **************/
+
+    //
+    // Only this thread marks its own VAD idle. A page touched after being marked
+    // must have its idle bit cleared, while a page whose PTE lock is held across
+    // marking and reading it cannot be touched - it must stay idle (and aged, if
+    // it is resident)
+    //
+
+    if (vadStartVA != NULL && vadSize >= 2) {
+
+        ULONG64 idleBitmap;
+        PVOID untouchedVA;
+        PPTE untouchedPTE;
+
+        markIdleVA(vadStartVA, 1);
+
+        if (accessVA(vadStartVA, READ_ONLY) == SUCCESS && getIdleVA(vadStartVA, 1, &idleBitmap) == TRUE) {
+
+            ASSERT(idleBitmap == 0);
+
+        }
+
+        untouchedVA = (PVOID) ( (ULONG_PTR) vadStartVA + PAGE_SIZE);
+
+        untouchedPTE = getPTE(untouchedVA);
+
+        if (untouchedPTE != NULL) {
+
+            acquirePTELock(untouchedPTE);
+
+            markIdleVA(untouchedVA, 1);
+
+            getIdleVA(untouchedVA, 1, &idleBitmap);
+
+            ASSERT(idleBitmap == 1);
+
+            ASSERT(untouchedPTE->u1.hPTE.validBit == 0 || untouchedPTE->u1.hPTE.agingBit == 1);
+
+            releasePTELock(untouchedPTE);
+
+        }
+
+    }
+
+
     /***************** DECOMMITTING AND CHECKING VAs **************/
 
     testVA = leafVABlock;
@@ -1391,235 +1594,619 @@ faultAndAccessTest()
 
     deleteVAD(vadStartVA);
 
-    return TRUE;
+    return TRUE;
+
+}
+
+
+DWORD WINAPI
+faultAndAccessTestThread(HANDLE terminationHandle) 
+{
+
+    #ifdef CONTINUOUS_FAULT_TEST
+
+    while (TRUE) {
+
+        BOOLEAN bres;
+        DWORD waitRes;
+
+        //
+        // Continuously fault and access addresses until
+        // terminate handle is set
+        //
+
+        bres = faultAndAccessTest();
+
+        waitRes = WaitForSingleObject(terminationHandle, 100);
+
+        if (waitRes == WAIT_TIMEOUT) {
+
+            continue;
+
+        }
+        else if (waitRes == WAIT_OBJECT_0) {
+
+            PRINT_ALWAYS("faultAndAccessTest thread exiting\n");
+            return 0;
+
+        } else if (waitRes == WAIT_ABANDONED) {
+
+            PRINT_ERROR("wait abandoned\n");
+
+
+        } else if (waitRes == WAIT_FAILED) {
+
+            PRINT_ERROR("wait failed\n");
+
+        }
+
+    }
+
+    #else
+
+    BOOLEAN bres;
+    bres = faultAndAccessTest();
+
+    WaitForSingleObject(terminationHandle, INFINITE);
+    return 0;
+
+    #endif
+}
+
+
+static VOID
+releaseTrimmedLockGroup(PPTE lockedPTE, PtrimBatch batch)
+{
+
+    //
+    // Pages trimmed under this PTE lock must reach their lists before
+    // the lock is released
+    //
+
+    flushTrimBatch(batch);
+
+    releasePTELock(lockedPTE);
+
+}
+
+
+//
+// Sweep modes of the trimming clock - the over-target sweep runs once a VAD grows
+// above its working-set target, the aging sweep runs on every pass, and the
+// reclaim sweeps only once available pages drop below the low watermark, from
+// the cheapest pages to evict to the most expensive
+//
+
+typedef enum _trimSweepMode {
+    TRIM_OVER_TARGET,           // trim unreferenced PTEs of VADs above their working-set target
+    AGE_PTES,                   // age unreferenced PTEs, trimming those past their threshold
+    RECLAIM_CLEAN,              // trim unreferenced clean PTEs, regardless of age
+    RECLAIM_UNREFERENCED,       // trim unreferenced PTEs, regardless of age
+    RECLAIM_ANY,                // trim any valid PTE
+} trimSweepMode;
+
+
+ULONG_PTR trimClockHands[NUM_THREADS];  // clock hand of each trimming partition (PTE index, owned by its thread)
+ULONG_PTR trimFallbackHands[NUM_THREADS];   // whole-range clock hand of each partition's fallback sweep
+volatile LONG numTrimPartitions;        // partitions claimed by trimming threads
+
+static THREAD_LOCAL ULONG trimPartition;        // partition of the PTE range swept by this trimming thread
+volatile LONG lastPFFTick;              // tick of the last working-set target adjustment
+
+
+static BOOLEAN
+clockVisitPTE(PPTE currPTE, trimSweepMode sweepMode, PBOOLEAN clearReference)
+{
+
+    PUCHAR age;
+    ULONG ageBonus;
+    PVADNode currVAD;
+
+    age = &PTEageArray[currPTE - PTEarray];
+
+    //
+    // A clear aging bit means the page was referenced since the hand last
+    // aged it - restart its age and clear the reference for the next sweep
+    // (the caller sets the aging bits of a run at once)
+    //
+
+    if (currPTE->u1.hPTE.agingBit == 0) {
+
+        if (sweepMode == RECLAIM_ANY) {
+
+            return TRUE;
+
+        }
+
+        if (sweepMode != AGE_PTES && sweepMode != TRIM_OVER_TARGET) {
+
+            return FALSE;
+
+        }
+
+        //
+        // The VAD is over its target, so look again on the next pass once
+        // this reference has been cleared
+        //
+
+        if (sweepMode == TRIM_OVER_TARGET) {
+
+            InterlockedOr(&workingSetTrimPending, 1 << trimPartition);
+
+        }
+
+        *age = 0;
+
+        *clearReference = TRUE;
+
+        #ifdef TRANSPARENT_FAULTS
+
+            //
+            // Revoke access so the next touch faults and clears the aging bit
+            // (there is no hardware accessed bit to consult) - the PTE lock is
+            // held, so that fault waits until the aging bit has been set
+            //
+
+            PVOID currVA;
+            DWORD oldPermissions;
+            PTE agedPTE;
+
+            currVA = (PVOID) ( (ULONG_PTR) leafVABlock + ( (currPTE - PTEarray) << PAGE_SHIFT ) );
+
+            agedPTE = *currPTE;
+
+            agedPTE.u1.hPTE.agingBit = 1;
+
+            VirtualProtect(currVA, PAGE_SIZE, windowsPermissions[getMappedPermissions(agedPTE)], &oldPermissions);
+
+        #endif
+
+        return FALSE;
+
+    }
+
+    if (sweepMode == RECLAIM_ANY || sweepMode == RECLAIM_UNREFERENCED || sweepMode == TRIM_OVER_TARGET) {
+
+        return TRUE;
+
+    }
+
+    if (sweepMode == RECLAIM_CLEAN) {
+
+        return (currPTE->u1.hPTE.dirtyBit == 0);
+
+    }
+
+    //
+    // Unreferenced for another sweep - clean pages go straight to standby
+    // when trimmed, so they are evicted younger than dirty pages (which
+    // must be written out first)
+    //
+
+    if (*age < TRIM_MAX_AGE) {
+
+        (*age)++;
+
+    }
+
+    //
+    // VADs below their working-set target are still growing into it (their
+    // fault rate is high), so their pages are given longer to be touched again
+    //
+
+    currVAD = getValidPTEVAD(currPTE);
+
+    ageBonus = 0;
+
+    if ( (ULONG64) currVAD->residentPages < currVAD->workingSetTarget) {
+
+        ageBonus = TRIM_GROWING_AGE_BONUS;
+
+    }
+
+    if (currPTE->u1.hPTE.dirtyBit == 0) {
+
+        return (*age >= TRIM_CLEAN_AGE + ageBonus);
+
+    }
+
+    return (*age >= TRIM_DIRTY_AGE + ageBonus);
+
+}
+
+
+static BOOLEAN
+trimWorkingSetAllows(PPTE currPTE, trimSweepMode sweepMode)
+{
+
+    PVADNode currVAD;
+    ULONG64 residentPages;
+
+    //
+    // The PTE is valid (and its lock held), so its VAD cannot be freed here
+    //
+
+    currVAD = getValidPTEVAD(currPTE);
+
+    residentPages = (ULONG64) currVAD->residentPages;
+
+    //
+    // Never trim a VAD down past its working-set minimum, and only visit
+    // VADs above their target in the over-target sweep
+    //
+
+    if (residentPages <= currVAD->workingSetMin) {
+
+        return FALSE;
+
+    }
+
+    if (sweepMode == TRIM_OVER_TARGET) {
+
+        return (residentPages > currVAD->workingSetTarget);
+
+    }
+
+    return TRUE;
+
+}
+
+
+static ULONG_PTR
+trimClockSweep(PPTE startPTE, PPTE endPTE, PULONG_PTR clockHand, trimSweepMode sweepMode, ULONG_PTR maxToTrim, PtrimBatch batch)
+{
+
+    PPTE currPTE;
+    PPTE lockedPTE;
+    PPTE groupEndPTE;
+    ULONG_PTR numPTEs;
+    ULONG_PTR numVisited;
+    ULONG_PTR numTrimmed;
+
+    currPTE = PTEarray + *clockHand;
+
+    if (currPTE < startPTE || currPTE >= endPTE) {
+
+        currPTE = startPTE;
+
+    }
+
+    numPTEs = endPTE - startPTE;
+
+    numVisited = 0;
+
+    numTrimmed = 0;
+
+    while (numVisited < numPTEs && numTrimmed < maxToTrim) {
+
+        //
+        // If the end of the swept range is reached,
+        // wrap around to its front
+        //
+
+        if (currPTE == endPTE) {
+
+            currPTE = startPTE;
+
+        }
+
+        //
+        // Skip the remainder of page table pages that are not resident
+        // (there are no valid PTEs in them to age or trim)
+        //
+
+        if (getPDE(currPTE)->u1.hPDE.validBit == 0) {
+
+            ULONG_PTR PTEsToSkip;
+
+            PTEsToSkip = getPTEsToNextPageTable(currPTE, endPTE);
+
+            numVisited += PTEsToSkip;
+
+            currPTE += PTEsToSkip;
+
+            continue;
+
+        }
+
+        //
+        // A PTE lock is held across the rest of its lock group, so trimmed pages
+        // can be enqueued a batch at a time
+        //
+
+        groupEndPTE = PTEarray + ( (getLockIndex(currPTE) + 1) << pagesPerLockShift);
+
+        if (groupEndPTE > endPTE) {
+
+            groupEndPTE = endPTE;
+
+        }
+
+        //
+        // Acquire PTE lock and check to see if 
+        // PTE is active (the page table page may have been trimmed 
+        // by another trimming thread since the check above)
+        //
+
+        if (acquirePTELockIfResident(currPTE) == FALSE) {
+
+            numVisited += groupEndPTE - currPTE;
+
+            currPTE = groupEndPTE;
+
+            continue;
+
+        }
+
+        lockedPTE = currPTE;
+
+        while (currPTE < groupEndPTE && numVisited < numPTEs && numTrimmed < maxToTrim) {
+
+            ULONG_PTR runLength;
+            ULONG_PTR j;
+            ULONG64 candidateBitmap;
+            ULONG64 referencedBitmap;
+            ULONG64 resetBitmap;
+
+            runLength = groupEndPTE - currPTE;
+
+            if (runLength > PTE_SCAN_MAX) {
+
+                runLength = PTE_SCAN_MAX;
+
+            }
+
+            if (runLength > numPTEs - numVisited) {
+
+                runLength = numPTEs - numVisited;
+
+            }
+
+            //
+            // Harvest the run's valid and referenced bits at once - only valid
+            // PTEs are visited, and the reclaim sweeps that leave referenced
+            // pages alone skip those as well
+            //
+
+            candidateBitmap = scanPTEs(currPTE, runLength, &referencedBitmap);
+
+            if (sweepMode == RECLAIM_CLEAN || sweepMode == RECLAIM_UNREFERENCED) {
+
+                candidateBitmap &= ~referencedBitmap;
+
+            }
+
+            resetBitmap = 0;
+
+            for (j = 0; j < runLength && (candidateBitmap >> j) != 0 && numTrimmed < maxToTrim; j++) {
+
+                BOOLEAN clearReference;
+
+                if ( ( (candidateBitmap >> j) & 1) == 0) {
+
+                    continue;
+
+                }
+
+                clearReference = FALSE;
+
+                if (trimWorkingSetAllows(currPTE + j, sweepMode) == TRUE && clockVisitPTE(currPTE + j, sweepMode, &clearReference) == TRUE) {
+
+                    BOOLEAN bRes;
+                    bRes = trimPTEToBatch(currPTE + j, batch);
+
+                    if (bRes == FALSE) {
+
+                        DebugBreak();
 
-}
+                    } else {
 
+                        numTrimmed++;
 
-DWORD WINAPI
-faultAndAccessTestThread(HANDLE terminationHandle) 
-{
+                    }
 
-    #ifdef CONTINUOUS_FAULT_TEST
+                }
 
-    while (TRUE) {
+                if (clearReference == TRUE) {
 
-        BOOLEAN bres;
-        DWORD waitRes;
+                    resetBitmap |= (ULONG64) 1 << j;
 
-        //
-        // Continuously fault and access addresses until
-        // terminate handle is set
-        //
+                }
 
-        bres = faultAndAccessTest();
+            }
 
-        waitRes = WaitForSingleObject(terminationHandle, 100);
+            //
+            // Clear the run's references in bulk
+            //
 
-        if (waitRes == WAIT_TIMEOUT) {
+            if (resetBitmap != 0) {
 
-            continue;
+                setPTEAgingBits(currPTE, resetBitmap);
 
-        }
-        else if (waitRes == WAIT_OBJECT_0) {
+            }
 
-            PRINT_ALWAYS("faultAndAccessTest thread exiting\n");
-            return 0;
+            //
+            // Stopping at the trim limit leaves the hand just past the last trim
+            //
 
-        } else if (waitRes == WAIT_ABANDONED) {
+            if (numTrimmed >= maxToTrim) {
 
-            PRINT_ERROR("wait abandoned\n");
+                runLength = j;
 
+            }
 
-        } else if (waitRes == WAIT_FAILED) {
+            numVisited += runLength;
 
-            PRINT_ERROR("wait failed\n");
+            currPTE += runLength;
 
         }
 
+        releaseTrimmedLockGroup(lockedPTE, batch);
+
     }
 
-    #else
+    //
+    // Leave the hand where the sweep stopped, so the next sweep picks up there
+    //
 
-    BOOLEAN bres;
-    bres = faultAndAccessTest();
+    *clockHand = currPTE - PTEarray;
 
-    WaitForSingleObject(terminationHandle, INFINITE);
-    return 0;
+    return numTrimmed;
 
-    #endif
 }
 
 
-ULONG_PTR
-trimValidPTEs()
+static VOID
+getTrimPartition(ULONG partition, PPTE* startPTE, PPTE* endPTE)
 {
-    
-    PPTE currPTE;
-    PPTE endPTE;
-    ULONG_PTR numTrimmed;
-    ULONG_PTR PTEsInRange;
-    BOOLEAN trimActive;
-    ULONG_PTR numAvailablePages;
-
-    trimActive = FALSE;
 
-    //
-    // Calculate PTEs in range
-    //
+    ULONG_PTR PTEsInRange;
+    ULONG_PTR numLockGroups;
 
     PTEsInRange = ( ( (ULONG_PTR) leafVABlockEnd - (ULONG_PTR) leafVABlock ) / PAGE_SIZE);
 
-    endPTE = PTEarray + PTEsInRange;
-
     //
-    // Randomize starting PTE
+    // Partition boundaries fall on lock groups, so trimming threads sweeping
+    // their own partitions never contend for the same PTE lock (only the
+    // whole-range fallback sweep of trimValidPTEs crosses partitions)
     //
 
-    currPTE = PTEarray;
+    numLockGroups = (PTEsInRange + pagesPerLock - 1) >> pagesPerLockShift;
 
-    currPTE += (GetTickCount() % PTEsInRange);
+    *startPTE = PTEarray + ( (numLockGroups * partition / NUM_THREADS) << pagesPerLockShift);
 
-    numTrimmed = 0;
+    *endPTE = PTEarray + ( (numLockGroups * (partition + 1) / NUM_THREADS) << pagesPerLockShift);
 
-    for (int i = 0; i < PTEsInRange; i++) {
+    if (*endPTE > PTEarray + PTEsInRange) {
 
-        if (currPTE == endPTE) {
+        *endPTE = PTEarray + PTEsInRange;
 
-            currPTE = PTEarray;
+    }
 
-        }
+}
 
-        //
-        // Acquire PTE lock and check to see if 
-        // PTE is active
-        //
 
-        acquirePTELock(currPTE);
+ULONG_PTR
+trimValidPTEs()
+{
+    
+    ULONG_PTR numTrimmed;
+    ULONG_PTR numAvailablePages;
+    ULONG partition;
+    PPTE startPTE;
+    PPTE endPTE;
+    PULONG_PTR clockHand;
+    DWORD currTick;
+    DWORD lastTick;
+    trimBatch batch;
 
-        if (currPTE->u1.hPTE.validBit == 1) {
+    batch.numStandby = 0;
 
-            //
-            // If aging bit remains set from previous
-            // trimming thread activity, trim PTE
-            //
+    batch.numModified = 0;
 
-            if (currPTE->u1.hPTE.agingBit == 1) {
+    numTrimmed = 0;
 
-                BOOLEAN bRes;
-                bRes = trimPTE(currPTE);
+    //
+    // Each trimming thread sweeps only its own partition of the PTE range,
+    // with its own clock hand
+    //
 
-                if (bRes == FALSE) {
+    partition = trimPartition;
 
-                    DebugBreak();
+    getTrimPartition(partition, &startPTE, &endPTE);
 
-                } else {
+    clockHand = &trimClockHands[partition];
 
-                    numTrimmed++;
-                    
-                }
-            }
-            else {
+    //
+    // Resize working-set targets from each VAD's recent fault rate (one
+    // trimming thread per interval)
+    //
 
-                currPTE->u1.hPTE.agingBit = 1;
+    currTick = GetTickCount();
 
-            }
+    lastTick = lastPFFTick;
 
-        }
+    if (currTick - lastTick >= PFF_INTERVAL_MS && InterlockedCompareExchange(&lastPFFTick, (LONG) currTick, (LONG) lastTick) == (LONG) lastTick) {
 
-        releasePTELock(currPTE);
-        
-        currPTE++;
+        adjustVADWorkingSetTargets();
 
     }
 
     //
-    // Randomize starting PTE using getTickCount call
+    // VADs that grew above their working-set target are trimmed back first,
+    // so one VAD's growth is paid for by its own pages (each partition clears
+    // its own pending bit)
     //
 
-    currPTE = PTEarray;
+    if ( (InterlockedAnd(&workingSetTrimPending, ~(1 << partition)) & (1 << partition)) != 0) {
 
-    currPTE += (GetTickCount() % PTEsInRange);
+        numTrimmed += trimClockSweep(startPTE, endPTE, clockHand, TRIM_OVER_TARGET, endPTE - startPTE, &batch);
+
+    }
 
     //
-    // Calculate number of available pages
-    // (with listhead lock acquisition)
+    // Each pass makes one revolution of the partition, so the trimming threads
+    // together age every PTE once - below the min watermark there is no time
+    // to age, skip straight to reclaiming
     //
 
-    numAvailablePages = 0;
-    for (int i = 0; i < STANDBY + 1; i ++ ) {
+    if (availablePageCount >= MIN_AVAILABLE_PAGES) {
 
-        EnterCriticalSection(&listHeads[i].lock);
-
-        numAvailablePages += listHeads[i].count;
+        numTrimmed += trimClockSweep(startPTE, endPTE, clockHand, AGE_PTES, endPTE - startPTE, &batch);
 
     }
 
-    for (int i = STANDBY; i >= 0; i--) {
-
-        LeaveCriticalSection(&listHeads[i].lock);
-
-    }
+    //
+    // Read number of available pages (maintained atomically, without list locks)
+    //
 
+    numAvailablePages = availablePageCount;
 
-    if (numAvailablePages < MIN_AVAILABLE_PAGES) {
+    //
+    // Once below the low watermark, reclaim up to the high watermark rather
+    // than just back over the low one - clean unreferenced pages first (no
+    // write needed), then dirty unreferenced ones, then anything valid
+    //
 
-        ULONG_PTR numPTEsToTrim;
+    if (numAvailablePages < LOW_AVAILABLE_PAGES) {
 
-        numPTEsToTrim = MIN_AVAILABLE_PAGES - numAvailablePages + 20;
+        ULONG_PTR numPagesToTrim;
+        ULONG_PTR numForceTrimmed;
 
         //
-        // Randomize starting PTE
+        // Every trimming thread is woken together, so each reclaims its share
         //
 
-        currPTE = PTEarray;
+        numPagesToTrim = (HIGH_AVAILABLE_PAGES - numAvailablePages + NUM_THREADS - 1) / NUM_THREADS;
 
-        currPTE += (GetTickCount() % PTEsInRange);
+        numForceTrimmed = 0;
 
-        for (int i = 0; i < numPTEsToTrim; i++) {
+        for (trimSweepMode sweepMode = RECLAIM_CLEAN; sweepMode <= RECLAIM_ANY && numForceTrimmed < numPagesToTrim; sweepMode++) {
 
-            //
-            // If the last PTE in the array is reached,
-            // wrap around to front of PTEarray
-            //
-
-            if (currPTE == endPTE) {
-
-                currPTE = PTEarray;
-
-            }
-
-            //
-            // Acquire PTE lock and check if valid bit
-            // is set - if true, trim regarldess of 
-            // aging bit status
-            //
-
-            acquirePTELock(currPTE);
+            numForceTrimmed += trimClockSweep(startPTE, endPTE, clockHand, sweepMode, numPagesToTrim - numForceTrimmed, &batch);
 
-            if (currPTE->u1.hPTE.validBit == 1) {
-
-                BOOLEAN bRes;
-                bRes = trimPTE(currPTE);
+        }
 
-                if (bRes == FALSE) {
+        //
+        // A partition without enough valid pages to give its share reclaims
+        // the rest from the whole range, with a hand of its own that carries
+        // on from where its last fallback sweep stopped
+        //
 
-                    DebugBreak();
+        if (numForceTrimmed < numPagesToTrim) {
 
-                } else {
+            endPTE = PTEarray + ( ( (ULONG_PTR) leafVABlockEnd - (ULONG_PTR) leafVABlock ) / PAGE_SIZE);
 
-                    numTrimmed++;
-                    
-                }
+            for (trimSweepMode sweepMode = RECLAIM_CLEAN; sweepMode <= RECLAIM_ANY && numForceTrimmed < numPagesToTrim; sweepMode++) {
 
+                numForceTrimmed += trimClockSweep(PTEarray, endPTE, &trimFallbackHands[partition], sweepMode, numPagesToTrim - numForceTrimmed, &batch);
 
             }
 
-            releasePTELock(currPTE);
-        
-            currPTE++;
         }
 
+        numTrimmed += numForceTrimmed;
+
     }
 
     return numTrimmed;
@@ -1635,11 +2222,33 @@ trimValidPTEThread(HANDLE terminationHandle)
     HANDLE handleArray[2];
 
     //
-    // Write out modified pages to pagefile until modified page list empty
+    // Page balancer - ages and trims active pages, and once woken by available
+    // pages dropping below the low watermark, keeps reclaiming (and kicking the
+    // modified writer) until they are back over the high watermark
     //
 
     numTrimmed = 0;
 
+    //
+    // Claim this thread's partition of the PTE range
+    //
+
+    trimPartition = InterlockedIncrement(&numTrimPartitions) - 1;
+
+    ASSERT(trimPartition < NUM_THREADS);
+
+    //
+    // Start its fallback sweep just past the partition (so partitions' fallback
+    // sweeps begin spread over the range)
+    //
+
+    PPTE partitionStartPTE;
+    PPTE partitionEndPTE;
+
+    getTrimPartition(trimPartition, &partitionStartPTE, &partitionEndPTE);
+
+    trimFallbackHands[trimPartition] = partitionEndPTE - PTEarray;
+
     //
     // Create local handle array
     //
@@ -1655,12 +2264,9 @@ trimValidPTEThread(HANDLE terminationHandle)
         DWORD index;
 
         //
-        // Note: efficacy is tied to implementation of checkAvailablePages,
-        // where this could deadlock if there was no timeout while
-        // waiting on this event. This scenario could occur if all
-        // trimming threads were actively trimming and this dequeue 
-        // was called by a pagefault, that in turn waited infinitely
-        // on new page events.
+        // The wake event stays set from the low watermark crossing until the
+        // high watermark crossing, so no wakeup is lost - the timeout only
+        // paces the aging pass while memory is plentiful
         //
 
         retVal = WaitForMultipleObjects(2, handleArray, FALSE, 200);
@@ -1679,6 +2285,37 @@ trimValidPTEThread(HANDLE terminationHandle)
 
         numTrimmed += currNum;
 
+        //
+        // Trim page table pages left with no valid/transition PTEs
+        //
+
+        trimPageTables();
+
+        //
+        // Trimmed dirty pages only become available once written - kick the
+        // modified writer rather than waiting for its own threshold/timeout
+        //
+
+        if (availablePageCount < LOW_AVAILABLE_PAGES && modifiedListHead.count != 0) {
+
+            SetEvent(wakeModifiedWriterHandle);
+
+            ResetEvent(wakeModifiedWriterHandle);
+
+        }
+
+        //
+        // Watermark crossings set and reset the wake event from racing threads, so
+        // an event left set above the high watermark is cleared here (the
+        // balancer otherwise keeps running until the high watermark is reached)
+        //
+
+        if (availablePageCount >= HIGH_AVAILABLE_PAGES) {
+
+            ResetEvent(wakeTrimHandle);
+
+        }
+
     }
 
     return 0;
@@ -1756,7 +2393,7 @@ checkPageStatusThread(HANDLE terminationHandle)
                 // slots
                 //
 
-                for (int k = 0; k < PAGEFILE_PAGES; k++) {
+                for (ULONG_PTR k = 0; k < pageFilePages; k++) {
 
                     PPFNdata PFN;
                     ULONG_PTR PFNindex;
@@ -1779,7 +2416,7 @@ checkPageStatusThread(HANDLE terminationHandle)
                     // (and thus sduplicate PF space)
                     //
 
-                    for (int l = k + 1; l < PAGEFILE_PAGES - 1; l++) {
+                    for (ULONG_PTR l = k + 1; l < pageFilePages - 1; l++) {
 
                         secondCurr = pageFileDebugArray + l;
 
@@ -1896,12 +2533,21 @@ VOID
 initListHeads(PlistData listHeadArray)
 {
     //
-    // Initialize free/standby/modified, etc (up throughg active) lists
+    // Initialize free/standby/modified, etc (up throughg active) lists, then
+    // the protected standby list
     //
 
-    for (int status = 0; status < ACTIVE; status++) {
+    for (int status = 0; status < NUM_PAGE_LISTS; status++) {
 
         initListHead(&listHeadArray[status]);
+
+        //
+        // Page lists link by PFN index, with the listhead's own index as sentinel
+        //
+
+        listHeadArray[status].PFNhead.flink = PFN_LIST_HEAD_INDEX_BASE + status;
+
+        listHeadArray[status].PFNhead.blink = PFN_LIST_HEAD_INDEX_BASE + status;
         
     }
 
@@ -1909,7 +2555,7 @@ initListHeads(PlistData listHeadArray)
  
 
 VOID
-initVAList(PlistData VAListHead, ULONG_PTR numVAs)
+initVAList(PlistData VAListHead, ULONG_PTR numVAs, ULONG_PTR pagesPerVA)
 {
 
     PVANode baseNode;
@@ -1920,7 +2566,7 @@ initVAList(PlistData VAListHead, ULONG_PTR numVAs)
     // Check params
     //
 
-    if (numVAs < 1) {
+    if (numVAs < 1 || pagesPerVA < 1) {
         PRINT_ERROR("[initVAList] Cannot initialize list of VAs with length 0\n");
         exit (-1);
     }
@@ -1929,32 +2575,11 @@ initVAList(PlistData VAListHead, ULONG_PTR numVAs)
     initListHead(VAListHead);
 
     //
-    // Call Virtual Alloc for a block of VAs, which is then subdivided
+    // Reserve a mappable block of VAs equiv to numVAs*pagesPerVA*PAGE_SIZE, which is
+    // then subdivided into windows of pagesPerVA pages
     //
 
-    #ifdef MULTIPLE_MAPPINGS
-
-        MEM_EXTENDED_PARAMETER extendedParameters = {0};
-        
-        extendedParameters.Type = MemExtendedParameterUserPhysicalHandle;
-
-        extendedParameters.Handle = physicalPageHandle;
-
-        //
-        // Allocate a VA block of size equiv to numVAs*PAGE_SIZE (using bit shift)
-        //
-
-        baseVA = VirtualAlloc2(NULL, NULL, numVAs << PAGE_SHIFT, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE, &extendedParameters, 1); 
-
-    #else
-
-        //
-        // Allocate a VA block of size equiv to numVAs*PAGE_SIZE (using bit shift)
-        //
-
-        baseVA = VirtualAlloc(NULL, numVAs << PAGE_SHIFT, MEM_RESERVE | MEM_PHYSICAL, PAGE_READWRITE);
-
-    #endif
+    baseVA = reserveMappableVA(numVAs * pagesPerVA);
 
     //
     // Allocate for VA-encompassing node structures
@@ -1982,7 +2607,7 @@ initVAList(PlistData VAListHead, ULONG_PTR numVAs)
         // into previously allocated block (baseVA)
         //
 
-        currVA = (void*) ( (ULONG_PTR)baseVA + ( i << PAGE_SHIFT ) );   // equiv to i*PAGE_SIZE
+        currVA = (void*) ( (ULONG_PTR)baseVA + ( (i * pagesPerVA) << PAGE_SHIFT ) );   // equiv to i*pagesPerVA*PAGE_SIZE
 
         currNode->VA = currVA;
 
@@ -1998,7 +2623,7 @@ initVAList(PlistData VAListHead, ULONG_PTR numVAs)
 
 
 VOID
-freeVAList(PlistData VAListHead)
+freeVAList(PlistData VAListHead, ULONG_PTR pagesPerVA)
 {
 
     PVANode currNode;
@@ -2044,7 +2669,7 @@ freeVAList(PlistData VAListHead)
     // Free VA's from the nodes
     //
 
-    VirtualFree(baseNode->VA, 0, MEM_RELEASE);
+    freeMappableVA(baseNode->VA, VAListHead->count * pagesPerVA);
 
     //
     // Free nodes from the original base address
@@ -2485,6 +3110,28 @@ testRoutine()
 
     freeVADList(&VADListHead);
 
+    //
+    // Return page table pages (and the zero page table page) to the page lists
+    //
+
+    freePageTables();
+
+    #ifdef PAGE_MAGAZINES
+
+    //
+    // Return pages cached in per-thread magazines to the zero/free lists
+    //
+
+    drainPageMagazines();
+
+    #endif
+
+    #ifdef FAULT_PAGE_RESERVE
+
+    drainPageReserve();
+
+    #endif
+
     /********** Verify no PFNs remain active *********/
 
     #ifdef CHECK_PFNS
@@ -2515,7 +3162,7 @@ testRoutine()
 
     pageCount = 0;
 
-    for (int i = 0; i < ACTIVE; i++) {
+    for (int i = 0; i < NUM_PAGE_LISTS; i++) {
 
         pageCount += listHeads[i].count;
 
@@ -2523,8 +3170,21 @@ testRoutine()
 
     PRINT_ALWAYS("total page count %llu\n", pageCount);
 
+    PRINT_ALWAYS("page tables - peak resident: %llu, faulted in: %llu, trimmed: %llu, discarded: %llu\n", 
+                  peakResidentPageTables, pageTableFaults, pageTablesTrimmed, pageTablesDiscarded);
+
     ASSERT(numPagesReturned == pageCount);
 
+    pageCount = zeroListHead.count + freeListHead.count;
+
+    for (int i = STANDBY_LISTS_BASE; i < NUM_PAGE_LISTS; i++) {
+
+        pageCount += listHeads[i].count;
+
+    }
+
+    ASSERT(availablePageCount == (LONG64) pageCount);
+
 }
 
 
@@ -2575,7 +3235,7 @@ closeHandles()
         
     }
 
-    bRes = CloseHandle(physicalPageHandle);
+    bRes = freePhysPages();
 
     if (bRes != TRUE) {
 
@@ -2595,6 +3255,30 @@ initializeVirtualMemory()
     // initialize zero/free/standby lists 
     initListHeads(listHeads);
 
+    // initialize availablePagesLow & wakeModifiedWriter handles (before any page
+    // is enqueued, since available page watermark crossings set/reset wakeTrimHandle)
+    initHandles();
+
+    #ifndef PAGEFILE_PFN_CHECK
+
+        //
+        // Allocate the pagefile bitarray (one bit per slot, rounded up to whole
+        // ULONG_PTRs)
+        //
+
+        pageFileBitArraySize = (pageFilePages + (8*sizeof(ULONG_PTR)) - 1) / (8*sizeof(ULONG_PTR));
+
+        pageFileBitArray = VirtualAlloc(NULL, pageFileBitArraySize * sizeof(ULONG_PTR), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+        if (pageFileBitArray == NULL) {
+
+            PRINT_ERROR("Could not allocate for pagefile bitarray\n");
+            exit(-1);
+
+        }
+
+    #endif
+
     #ifndef PAGEFILE_OFF
 
         //
@@ -2605,10 +3289,18 @@ initializeVirtualMemory()
         #ifndef PAGEFILE_PFN_CHECK
 
             //
-            // Initialize the pagefilebitarray to all zero (all space is clear)
+            // Initialize the pagefilebitarray to all zero (all space is clear), then
+            // set the bits past the end of the pagefile in the final ULONG_PTR so they
+            // are never handed out
             //
 
-            memset(&pageFileBitArray, 0, PAGEFILE_PAGES/(8*sizeof(ULONG_PTR) ) );
+            memset(pageFileBitArray, 0, pageFileBitArraySize * sizeof(ULONG_PTR));
+
+            if (pageFilePages % (8*sizeof(ULONG_PTR)) != 0) {
+
+                pageFileBitArray[pageFileBitArraySize - 1] = MAXULONG_PTR << (pageFilePages % (8*sizeof(ULONG_PTR)));
+
+            }
 
         #else
 
@@ -2617,9 +3309,9 @@ initializeVirtualMemory()
             // at each pagefile index and initialize it to all zero.
             //
 
-            pageFileDebugArray = VirtualAlloc(NULL, sizeof(pageFileDebug)*PAGEFILE_PAGES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+            pageFileDebugArray = VirtualAlloc(NULL, sizeof(pageFileDebug)*pageFilePages, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
 
-            memset(pageFileDebugArray, 0, PAGEFILE_PAGES * sizeof(pageFileDebug ));
+            memset(pageFileDebugArray, 0, pageFilePages * sizeof(pageFileDebug ));
 
         #endif
 
@@ -2632,7 +3324,7 @@ initializeVirtualMemory()
         // macro, since removing the pagefile would render it moot
         //
 
-        memset(&pageFileBitArray, 1, PAGEFILE_PAGES/(8*sizeof(ULONG_PTR) ) );
+        memset(pageFileBitArray, 0xFF, pageFileBitArraySize * sizeof(ULONG_PTR));
     
     #endif
 
@@ -2659,55 +3351,81 @@ initializeVirtualMemory()
 
     //
     // Regardless of whether CHECK_PFNs is check, aPFNs array is dynamically allocated
-    // to permit varied NUM_PAGES values
+    // to permit varied numPagesRequested values
     //
 
-    aPFNs = VirtualAlloc(NULL, NUM_PAGES*(sizeof(ULONG_PTR)), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    aPFNs = VirtualAlloc(NULL, numPagesRequested*(sizeof(ULONG_PTR)), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
     
     if (aPFNs == NULL) {
 
         PRINT_ERROR("failed to allocate PFNarray\n");
+        exit(-1);
 
     }
 
-    numPagesReturned = allocatePhysPages(NUM_PAGES, aPFNs);
+    numPagesReturned = allocatePhysPages(numPagesRequested, aPFNs);
 
     //
-    // Calculate virtualMemPages, a function of numPagesReturned and pre-defined 
-    // VM_MULTIPLIER, to achieve a greater VM address range than PM would otherwise 
+    // Calculate virtualMemPages, a function of numPagesReturned and configured 
+    // vmMultiplier, to achieve a greater VM address range than PM would otherwise 
     // allow
     //
 
-    virtualMemPages = numPagesReturned * VM_MULTIPLIER;
+    virtualMemPages = numPagesReturned * vmMultiplier;
 
     //
     // Verify sufficient PTE_INDEX_BITS allocated in PFN struct to represent the 
-    // entire prospective virtual address range
+    // entire prospective virtual address range (parseConfig bounds the requested
+    // geometry, this catches the product)
     //
 
-    if ( ( (ULONG_PTR) 1 << PTE_INDEX_BITS) < virtualMemPages) {
+    if ( ( (ULONG_PTR) 1 << PTE_INDEX_BITS) < virtualMemPages || virtualMemPages / vmMultiplier != numPagesReturned) {
 
-        PRINT_ERROR("Too many pages for current PTE index field in PFN bits. \n Unable to run program with current #defines\n");
+        PRINT_ERROR("Too many pages for current PTE index field in PFN bits. \n Unable to run program with current configuration\n");
         exit(-1);
         
     }
 
-    PRINT_ALWAYS("Successfully returned %d pages, with a virtual memory space of %llu pages \n", NUM_PAGES, virtualMemPages);
+    //
+    // Commit limit is the memory actually returned plus pagefile space, less
+    // room for every page table page (and the zero page table page) - page 
+    // tables are not charged commit, but occupy memory or pagefile all the same
+    //
+
+    ULONG_PTR maxPageTablePages;
+
+    maxPageTablePages = ( (virtualMemPages + PTES_PER_PAGE - 1) >> PTES_PER_PAGE_SHIFT) + 1;
+
+    if (numPagesReturned + pageFilePages <= maxPageTablePages) {
+
+        PRINT_ALWAYS("Memory and pagefile (%llu pages) cannot cover %llu page table pages - increase -f or lower -m\n", 
+                      numPagesReturned + pageFilePages, maxPageTablePages);
+        exit(-1);
+
+    }
+
+    totalMemoryPageLimit = numPagesReturned + pageFilePages - maxPageTablePages;
+
+    PRINT_ALWAYS("Successfully returned %llu pages, with a virtual memory space of %llu pages \n", numPagesReturned, virtualMemPages);
 
     //
     // Initialize VA lists, consisting of AWE addresses for page contents
     // manipulation
     //
 
-    initVAList(&zeroVAListHead, NUM_THREADS + 3);
+    initVAList(&zeroVAListHead, NUM_THREADS + 3, 1);
+
+    initVAList(&writeVAListHead, NUM_THREADS + 3, MODIFIED_WRITE_BATCH_SIZE);
 
-    initVAList(&writeVAListHead, NUM_THREADS + 3);
+    initVAList(&readPFVAListHead, NUM_THREADS + 3, READ_AHEAD_MAX + 1);
 
-    initVAList(&readPFVAListHead, NUM_THREADS + 3);
+    initVAList(&pageTradeVAListHead, 2*NUM_THREADS + 3, 1);
 
-    initVAList(&pageTradeVAListHead, 2*NUM_THREADS + 3);
+    //
+    // A pagefile fault holds an event for its own page and each page it reads ahead
+    //
 
-    initEventList(&readInProgEventListHead, NUM_THREADS + 3);
+    initEventList(&readInProgEventListHead, (NUM_THREADS + 3) * (READ_AHEAD_MAX + 1));
 
 
     /******************* initialize data structures ****************/
@@ -2725,7 +3443,7 @@ initializeVirtualMemory()
     // VM range
     //
 
-    VADBitArray = VirtualAlloc(NULL, virtualMemPages/(sizeof(ULONG_PTR) * 8) + 1, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    VADBitArray = VirtualAlloc(NULL, (virtualMemPages/(sizeof(ULONG_PTR) * 8) + 1) * sizeof(ULONG_PTR), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 
     // create local PFN metadata array
     initPFNarray(aPFNs, numPagesReturned);
@@ -2745,13 +3463,31 @@ initializeVirtualMemory()
     initPTEarray(virtualMemPages);
 
     // create PageFile section of memory
-    initPageFile(PAGEFILE_SIZE);
-
-    // initialize availablePagesLow & wakeModifiedWriter handles
-    initHandles();
+    initPageFile(pageFilePages << PAGE_SHIFT);
 
     initPTELocks(virtualMemPages);
 
+    //
+    // Set aside the zero page table page (requires page lists and handles)
+    //
+
+    initPageDirectory();
+
+    #ifdef TRANSPARENT_FAULTS
+
+        //
+        // Service faults on raw leafVABlock dereferences from here on
+        //
+
+        if (initTransparentFaults() != TRUE) {
+
+            PRINT_ERROR("failed to register transparent fault handler\n");
+            exit(-1);
+
+        }
+
+    #endif
+
     return numPagesReturned;
 
 }
@@ -2761,15 +3497,29 @@ VOID
 freeVirtualMemory()
 {
 
+    #ifdef TRANSPARENT_FAULTS
+
+        freeTransparentFaults();
+
+    #endif
+
     //
     // Virtual free all allocated memory blocks
     //
 
-    VirtualFree(leafVABlock, 0, MEM_RELEASE);
+    freeMappableVA(leafVABlock, virtualMemPages);
 
     VirtualFree(PFNarray, 0, MEM_RELEASE);
 
-    VirtualFree(PTEarray, 0, MEM_RELEASE);
+    VirtualFree(PFNextensionArray, 0, MEM_RELEASE);
+
+    freeMappableVA(PTEarray, numPageTablePages);
+
+    VirtualFree(PDEarray, 0, MEM_RELEASE);
+
+    VirtualFree(PTEageArray, 0, MEM_RELEASE);
+
+    VirtualFree( (PVOID) PTEidleBitmap, 0, MEM_RELEASE);
 
     VirtualFree(pageFileVABlock, 0, MEM_RELEASE);
     
@@ -2785,23 +3535,22 @@ freeVirtualMemory()
     // Free all "scratch" VA lists
     //
 
-    freeVAList(&zeroVAListHead);
+    freeVAList(&zeroVAListHead, 1);
 
-    freeVAList(&writeVAListHead);
+    freeVAList(&writeVAListHead, MODIFIED_WRITE_BATCH_SIZE);
 
-    freeVAList(&readPFVAListHead);
+    freeVAList(&readPFVAListHead, READ_AHEAD_MAX + 1);
     
-    freeVAList(&pageTradeVAListHead);
+    freeVAList(&pageTradeVAListHead, 1);
 
     #ifdef PAGEFILE_PFN_CHECK
     
-        //
-        // pageFileDebugArray must be freed since it is dynamically
-        // allocated, unlike static global pageFileBitArray
-        //
-
         VirtualFree(pageFileDebugArray, 0, MEM_RELEASE);
 
+    #else
+
+        VirtualFree(pageFileBitArray, 0, MEM_RELEASE);
+
     #endif
 
     #ifdef CHECK_PFNS
@@ -2830,12 +3579,8 @@ VOID
 main(int argc, char** argv) 
 {
 
-    /*********** switch to toggle verbosity (print statements) *************/
-    if (argc > 1 && strcmp(argv[1], "-v") == 0) {
-
-        debugMode = TRUE;
-
-    }
+    /*********** parse verbosity (-v) and runtime geometry switches *********/
+    parseConfig(argc, argv);
     
     numPagesReturned = initializeVirtualMemory();
 
@@ -4,12 +4,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <tchar.h>
 #include <stdbool.h>
-#include <windows.h>
 #include <math.h> 
+
+#ifdef _WIN32
+#include <tchar.h>
+#include <windows.h>
 #pragma comment(lib, "Advapi32.lib")
 #pragma comment(lib, "MinCore.lib")
+#else
+#include "./infrastructure/linuxCompat.h"               // Win32 subset for non-Windows builds
+#endif
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
 
 
 /********************************************************************
@@ -38,8 +49,20 @@
 
 #define MODIFIED_WRITER_THREAD                          // toggles modified page writer thread
 
+#define PAGE_MAGAZINES                                  // toggles per-thread caches of zero/free pages (see pageMagazine.h)
+
+#define FAULT_PAGE_RESERVE                              // toggles zeroed pages held back for page faults (see pageReserve.h)
+
 #define CONTINUOUS_FAULT_TEST
 
+//
+// Toggle transparent faults - leafVABlock may be dereferenced directly and faults
+// are serviced by a vectored exception handler (SIGSEGV handler on Linux) rather
+// than requiring every access to go through accessVA/writeVA
+//
+
+// #define TRANSPARENT_FAULTS
+
 
 /************************************************************************
 ************************* Debugging macros ****************************
@@ -63,14 +86,51 @@
 
 
 /***************************************************************************
- * number of physical memory pages to allocate (+ PF pages for total memory)
+ * default number of physical memory pages to allocate (+ PF pages for total memory)
+ *  - geometry defaults may be overridden at startup (see config.h)
  ***************************************************************************/
 
-#define NUM_PAGES 512
+#define DEFAULT_NUM_PAGES 512
 
-#define MIN_AVAILABLE_PAGES 100
+//
+// Available (zero + free + standby) page watermarks, kept by the balancer
+// (trimValidPTEThread):
+//  - below LOW the balancer wakes, trimming and writing back until HIGH is reached
+//  - below MIN the balancer skips its aging pass and reclaims immediately, and
+//    only page faults may take an available page - page trading refuses, and
+//    page magazines stop caching well before this (the one page initPageDirectory
+//    takes at startup predates any fault)
+//
+
+#define MIN_AVAILABLE_PAGES (LOW_AVAILABLE_PAGES / 4)
 
-#define VM_MULTIPLIER 2                             // VM space is this many times larger than num physical pages successfully allocated
+#define LOW_AVAILABLE_PAGES 100
+
+#define HIGH_AVAILABLE_PAGES (LOW_AVAILABLE_PAGES + LOW_AVAILABLE_PAGES / 2)
+
+//
+// Trimming clock (WSClock) ages - a valid page unreferenced for this many sweeps
+// of the clock hand is trimmed, dirty pages (which must be written out before
+// they can be reused) surviving longer than clean ones
+//
+
+#define TRIM_CLEAN_AGE 2
+
+#define TRIM_DIRTY_AGE 4
+
+#define TRIM_MAX_AGE 15                             // ages saturate here
+
+#define TRIM_GROWING_AGE_BONUS 2                    // extra sweeps for pages of VADs below their working-set target
+
+#define PROTECTED_STANDBY_RATIO 3                   // protected standby pages outnumber probationary ones at most this many times
+
+#define PAGE_LIST_BATCH_SIZE 16                     // max pages moved per list lock acquisition by zeroing, trimming and decommit
+
+#define MODIFIED_WRITE_BATCH_SIZE 16                // max modified pages clustered into a single pagefile write
+
+#define READ_AHEAD_MAX 8                            // max neighbouring pages read in with a pagefile fault
+
+#define DEFAULT_VM_MULTIPLIER 2                     // VM space is this many times larger than num physical pages successfully allocated
 
 
 /****************************************************************************
@@ -79,11 +139,15 @@
 
 #define PERMISSIONS_BITS 3                          // bits in non-valid PTE formats reserved for permissions
 
-#define PTE_INDEX_BITS 12                           // number of bits to store PTE index (tied to # of VM pages)
+#define PTE_INDEX_BITS 32                           // number of bits to store PTE index in the PFN (tied to # of VM pages)
 
 #define PFN_BITS 40                                 // number of bits to store PFN index (tied to physical pages returned)\
 
-#define PAGES_PER_LOCK 64                           // Defines granularity of PTE locking (does not have to be a factor of total pages)
+#define DEFAULT_PAGES_PER_LOCK 64                   // Defines granularity of PTE locking (power of two, at most PTES_PER_PAGE)
+
+#define PTES_PER_PAGE_SHIFT 9                       // log2 of PTEs per page table page (PAGE_SIZE / sizeof(PTE))
+
+#define PTES_PER_PAGE (1 << PTES_PER_PAGE_SHIFT)    // PTEs mapped by a single PDE
 
 
 /**************************************************************************
@@ -99,13 +163,11 @@
  ************************** pagefile macros *****************************
  ***********************************************************************/
 
-#define PAGEFILE_PAGES 512                          // capacity of pagefile pages (+ NUM_PAGES for total memory)
+#define DEFAULT_PAGEFILE_PAGES 512                  // capacity of pagefile pages (+ physical pages for total memory)
 
-#define PAGEFILE_SIZE PAGEFILE_PAGES*PAGE_SIZE      // total pagefile size 
+#define PAGEFILE_BITS 40                            // number of bits to store pagefile index (in PTEs, PDEs and PFNs)
 
-#define PAGEFILE_BITS 20                            // actually 2^19 currently
-
-#define INVALID_BITARRAY_INDEX 0xfffff              // 20 bits (MUST CORRESPOND TO PAGEFILE BITS)
+#define INVALID_BITARRAY_INDEX ( ( (ULONG64) 1 << PAGEFILE_BITS) - 1)      // all PAGEFILE_BITS set
 
 
 /***********************************************************************
@@ -114,12 +176,28 @@
 
 #define ASSERT(x) if((x) == FALSE) DebugBreak()
 
+#ifdef _WIN32
+
 #define PRINT(fmt, ...) if (debugMode == TRUE) { printf(fmt, __VA_ARGS__); }
 
 #define PRINT_ERROR(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__); ASSERT(FALSE); 
 
 #define PRINT_ALWAYS(fmt, ...) printf(fmt, __VA_ARGS__)
 
+#else
+
+//
+// gcc does not drop the trailing comma for an empty __VA_ARGS__ without ##
+//
+
+#define PRINT(fmt, ...) if (debugMode == TRUE) { printf(fmt, ##__VA_ARGS__); }
+
+#define PRINT_ERROR(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__); ASSERT(FALSE); 
+
+#define PRINT_ALWAYS(fmt, ...) printf(fmt, ##__VA_ARGS__)
+
+#endif
+
 
 /***************** STRUCT definitions **************/
 typedef struct _hardwarePTE{
@@ -170,28 +248,114 @@ typedef struct _PTE{
      } u1;
 } PTE, *PPTE;
 
+typedef struct _hardwarePDE{
+    ULONG64 validBit: 1;            // page table page is resident (mapped at its PTEarray address)
+    ULONG64 transitionBit: 1;       // MUST be 0 for hPDE
+    ULONG64 committedBit: 1;        // page table page has been committed by a VAD (its PTEs may be referenced)
+    ULONG64 agingBit: 1;            // set by the trimmer, cleared when a PTE lock on the page is acquired
+    ULONG64 padding: 4;
+    ULONG64 PFN: PFN_BITS;          // page frame holding the page table page
+} hardwarePDE, *PhardwarePDE;
+
+typedef struct _transitionPDE{
+    ULONG64 validBit: 1;            // valid bit MUST be 0 for tPDE
+    ULONG64 transitionBit: 1;       // transition bit MUST be set for tPDE
+    ULONG64 committedBit: 1;
+    ULONG64 padding: 5;
+    ULONG64 PFN: PFN_BITS;          // page frame (on modified or standby list) holding the page table page
+} transitionPDE, *PtransitionPDE;
+
+typedef struct _pageFilePDE{
+    ULONG64 validBit: 1;            // valid bit MUST be 0 for pfPDE
+    ULONG64 transitionBit: 1;       // transition bit MUST be 0 for pfPDE
+    ULONG64 committedBit: 1;
+    ULONG64 padding: 5;
+    ULONG64 pageFileIndex: PAGEFILE_BITS;   // INVALID_BITARRAY_INDEX if the page table page is all zero
+} pageFilePDE, *PpageFilePDE;
+
+typedef struct _PDE{
+    union {
+        hardwarePDE hPDE;
+        transitionPDE tPDE;
+        pageFilePDE pfPDE;
+        ULONG64 ulongPDE;
+     } u1;
+} PDE, *PPDE;
+
 typedef struct _eventNode {
     LIST_ENTRY links;
     HANDLE event;
 } eventNode, *PeventNode;
 
+//
+// PFN list links are 32-bit PFN indices rather than pointers. Page list heads
+// take the indices from PFN_LIST_HEAD_INDEX_BASE up (one per listHeads entry), so
+// page lists remain circular with the listhead as sentinel
+//
+
+#define PFN_LIST_HEAD_INDEX_BASE 0xFFFFFFE0         // PFNs must be below this to be linked
+#define INVALID_PFN_LINK 0xFFFFFFFF                 // link value while a page is on no list
+
+typedef struct _PFNlinks {
+    ULONG flink;
+    ULONG blink;
+} PFNlinks, *PPFNlinks;
+
+#define STANDBY_PRIORITY_BITS 2                     // bits to store a page's standby priority (in the PFN and VAD)
+
+//
+// PFN state word - the lock bit, status/state bits and refCount in a single
+// CAS-able word. Shared by PFNdata and PFNstate (a snapshot of the word)
+//
+
+#define PFN_STATE_BITS \
+    ULONG lockBit: 1;                   /* bit 0 - set/cleared atomically by acquireJLock/releaseJLock */ \
+    ULONG statusBits: 5; \
+    ULONG writeInProgressBit: 1;        /* Overloaded bit - also used to signify to page trader that page could be being zeroed */ \
+    ULONG readInProgressBit: 1; \
+    ULONG remodifiedBit: 1; \
+    ULONG pageTableBit: 1;              /* page holds a page table page (PTEindex is then its PDE index) */ \
+    ULONG protectedBit: 1;              /* page was re-referenced from standby - it is (or is next) cached on the protected standby list */ \
+    ULONG standbyPriority: STANDBY_PRIORITY_BITS;   /* priority of the standby list the page is cached on */ \
+    ULONG refCount: 16; \
+    ULONG readAheadBit: 1;              /* page was read ahead by a pagefile fault and has not been faulted in since */ \
+    ULONG padding: 2;
+
+typedef union _PFNstate {
+    struct {
+        PFN_STATE_BITS
+    };
+    LONG value;
+} PFNstate, *PPFNstate;
+
+//
+// Compact (16 byte, four per cache line) PFN entry - the lock holder may write
+// the state word's fields directly, anyone else must go through
+// compareExchangePFNstate (which fails while the lock is held). Rarely used
+// fields are in PFNextensionArray
+//
+
 typedef struct _PFNdata {
-    LIST_ENTRY links;
-    ULONG64 statusBits: 5;
-    ULONG64 pageFileOffset: PAGEFILE_BITS;
-    ULONG64 PTEindex: PTE_INDEX_BITS;
-    ULONG64 writeInProgressBit: 1;          // Overloaded bit - also used to signify to page trader that page could be being zeroed
-    ULONG64 readInProgressBit: 1;
-    ULONG64 refCount: 16;                
-    ULONG64 remodifiedBit: 1;      
-    ULONG64 padding: 20;  
-    volatile LONG lockBits;                // 31 free bits if necessary
-    PeventNode readInProgEventNode;
+    PFNlinks links;
+    union {
+        struct {
+            PFN_STATE_BITS
+        };
+        volatile LONG lockBits;                 // whole word, as passed to the jLock functions
+    };
+    ULONG PTEindex;
 } PFNdata, *PPFNdata;
 
+typedef struct _PFNextension {
+    ULONG64 pageFileOffset;                     // INVALID_BITARRAY_INDEX if the page holds no pagefile space
+    PeventNode readInProgEventNode;
+    struct _VADNode* VAD;                       // VAD of the PTE a leaf page backs (set as the page is faulted or read in)
+} PFNextension, *PPFNextension;
+
 typedef struct _listData {
     LIST_ENTRY head;
-    ULONG64 count;
+    PFNlinks PFNhead;                           // head for page lists (head is used for all other lists)
+    volatile ULONG64 count;                     // written under lock, may be read without it
     CRITICAL_SECTION lock;
     HANDLE newPagesEvent;
 } listData, *PlistData;
@@ -216,6 +380,23 @@ typedef enum {          // DO NOT EDIT ORDER without checking enqueue/dequeue
     ACTIVE,             // 8 (ACTIVE must be last since it is used to dimensionalize arrays)
 } PFNstatus;
 
+//
+// Standby pages are cached on a pair of lists per standby priority (set per VAD) -
+// a probationary list and, for pages re-referenced while cached, a protected list
+// that is only repurposed from once the probationary list is empty. Priorities
+// are repurposed from the lowest up. The standby list heads take the slots after
+// the per-status lists - listHeads[STANDBY] itself stays empty, enqueues to it
+// are routed by the page's priority and protectedBit
+//
+
+#define NUM_STANDBY_PRIORITIES (1 << STANDBY_PRIORITY_BITS)
+
+#define DEFAULT_STANDBY_PRIORITY 2
+
+#define STANDBY_LISTS_BASE ACTIVE
+
+#define NUM_PAGE_LISTS (STANDBY_LISTS_BASE + 2 * NUM_STANDBY_PRIORITIES)
+
 typedef enum {
     NO_ACCESS,          // 0
     READ_ONLY,          // 1
@@ -255,11 +436,22 @@ extern void* leafVABlock;                  // starting address of memory block
 extern void* leafVABlockEnd;               // ending address of memory block
 
 extern PPFNdata PFNarray;                  // starting address of PFN array
-extern PPTE PTEarray;                      // starting address of page table
+extern PPFNextension PFNextensionArray;    // rarely used PFN fields (parallel to PFNarray)
+
+#define getPFNextension(PFN) (PFNextensionArray + ((PFN) - PFNarray))
+extern PPTE PTEarray;                      // starting address of page table (reserved - committed a page at a time)
+extern PPDE PDEarray;                      // page directory (one PDE per page of PTEarray)
+extern PUCHAR PTEageArray;                  // trimming clock age of each PTE (parallel to PTEarray)
+extern volatile LONG64* PTEidleBitmap;      // bit per PTE, set by markIdleVA and cleared on access
+extern ULONG_PTR numPageTablePages;        // number of PDEs (pages spanned by PTEarray)
 
 extern ULONG64 totalCommittedPages;           // count of committed pages (initialized to zero)
 extern ULONG_PTR totalMemoryPageLimit;     // limit of committed pages (memory block + pagefile space)
 
+extern ULONG_PTR numPagesReturned;         // physical pages granted by the OS
+
+extern volatile LONG64 availablePageCount; // pages on the zero, free and standby lists (maintained atomically)
+
 
 extern void* pageFileVABlock;              // starting address of pagefile "disk" (memory)
 
@@ -275,7 +467,8 @@ extern void* pageFileVABlock;              // starting address of pagefile "disk
 
 #else
 
-    extern ULONG_PTR pageFileBitArray[PAGEFILE_PAGES/(8*sizeof(ULONG_PTR))];
+    extern PULONG_PTR pageFileBitArray;        // one bit per pagefile slot (pageFileBitArraySize ULONG_PTRs)
+    extern ULONG_PTR pageFileBitArraySize;
     
 #endif
 
@@ -292,16 +485,17 @@ extern ULONG_PTR permissionMasks[];
 // listHeads array
 //
 
-extern listData listHeads[ACTIVE];
+extern listData listHeads[NUM_PAGE_LISTS];
 #define zeroListHead listHeads[ZERO]
 #define freeListHead listHeads[FREE]
-#define standbyListHead listHeads[STANDBY]
+#define standbyListHead listHeads[STANDBY]          // routes pages to their standby list (see NUM_PAGE_LISTS)
 #define modifiedListHead listHeads[MODIFIED]
 #define quarantineListHead listHeads[QUARANTINE]
+#define standbyListHeadAt(priority, isProtected) listHeads[STANDBY_LISTS_BASE + 2 * (priority) + (isProtected)]
 
 extern listData zeroVAListHead;             // list of zeroVAs used for zeroing PFNs (via AWE mapping)
-extern listData writeVAListHead;            // list of writeVAs used for writing to page file
-extern listData readPFVAListHead;
+extern listData writeVAListHead;            // list of writeVA windows (MODIFIED_WRITE_BATCH_SIZE pages each) used for writing to page file
+extern listData readPFVAListHead;            // list of readPFVA windows (READ_AHEAD_MAX + 1 pages each) used for reading from page file
 extern listData pageTradeVAListHead;
 
 extern listData VADListHead;               // list of VADs
@@ -310,6 +504,7 @@ extern listData readInProgEventListHead;
 
 extern CRITICAL_SECTION PTELock;            // coarse-grained lock on page table/directory
 extern PCRITICAL_SECTION PTELockArray;      // finer-grained lock array for page table/directory (replaces above)
+extern volatile ULONG64* PTESequenceArray;  // sequence counter per PTE lock group, for lock-free PTE reads
 
 
 extern HANDLE wakeTrimHandle;
@@ -320,6 +515,16 @@ extern PULONG_PTR VADBitArray;
 
 extern ULONG_PTR virtualMemPages;
 
+//
+// Runtime geometry (defaults above, overridden by parseConfig)
+//
+
+extern ULONG_PTR numPagesRequested;         // physical pages to allocate
+extern ULONG_PTR pageFilePages;             // capacity of pagefile in pages
+extern ULONG_PTR pagesPerLock;              // PTEs covered by each PTE lock
+extern ULONG_PTR pagesPerLockShift;         // log2 pagesPerLock
+extern ULONG_PTR vmMultiplier;              // VM pages per physical page returned
+
 extern CRITICAL_SECTION pageFileLock;
 
 extern CRITICAL_SECTION VADWriteLock;
@@ -342,13 +547,15 @@ releaseAwaitingFreePFN(PPFNdata PFNtoFree);
 
 
 /* 
- * modifiedPageWriter: function to pull a page off modified list and write to pagefile
+ * modifiedPageWriter: function to pull a batch of pages off modified list and write to pagefile
  * - checks if there are any pages on modified list
- * - if there are, call writePageToFileSystem, update status bits and enqueue PFN to standby list
+ * - if there are, dequeues up to MODIFIED_WRITE_BATCH_SIZE of them, calls writePagesToFileSystem
+ *   (one clustered write), then updates the status bits of each page and enqueues the
+ *   written pages to standby list
  * - when shared pages are added, bump refcount
  * 
  * returns BOOLEAN:
- *  - TRUE on success
+ *  - TRUE on success (at least one page of the batch written)
  *  - FALSE on failure
  */
 BOOLEAN